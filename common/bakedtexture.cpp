@@ -0,0 +1,217 @@
+﻿#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "BakedTexture.hpp"
+#include "MappedFile.hpp"
+#include "MipGenerator.hpp"
+#include "TextureFormat.hpp"
+#include "../stb_image.h"
+
+namespace fs = std::filesystem;
+
+const char* BAKED_EXTENSION = ".btex";
+
+size_t BakedRowBytes(uint32_t width, int channels)
+{
+	return ((size_t)width * channels + 3) & ~(size_t)3;
+}
+
+std::string BakedPath(const std::string& imagePath)
+{
+	return imagePath + BAKED_EXTENSION;
+}
+
+bool BakeTexture(const char* imagePath, const char* bakedPath)
+{
+	int width, height, channels;
+	if (!stbi_info(imagePath, &width, &height, &channels))
+	{
+		return false;
+	}
+	channels = (channels == 2 || channels == 4) ? 4 : 3;
+	// Flipped whatever the render thread has set, without changing it for
+	// anything else loaded on this thread
+	stbi_set_flip_vertically_on_load_thread(1);
+	unsigned char* pixels = stbi_load(imagePath, &width, &height, nullptr, channels);
+	stbi_clear_flip_vertically_on_load_thread();
+	if (!pixels)
+	{
+		return false;
+	}
+
+	BakedHeader header = {};
+	header.magic = BAKED_MAGIC;
+	header.version = BAKED_VERSION;
+	header.width = (uint32_t)width;
+	header.height = (uint32_t)height;
+	header.levels = 1;
+	while ((header.width >> header.levels) || (header.height >> header.levels))
+	{
+		header.levels++;
+	}
+	TextureFormat format = NegotiateFormat(channels);
+	header.internalFormat = format.internalFormat;
+	header.format = format.format;
+	header.type = format.type;
+
+	// Lay the levels out after the level table, each 16 byte aligned
+	std::vector<BakedLevel> levels(header.levels);
+	uint64_t offset = sizeof(header) + sizeof(BakedLevel) * levels.size();
+	for (uint32_t i = 0; i < header.levels; i++)
+	{
+		BakedLevel& level = levels[i];
+		level.width = std::max(1u, header.width >> i);
+		level.height = std::max(1u, header.height >> i);
+		level.offset = (offset + 15) & ~(uint64_t)15;
+		level.size = BakedRowBytes(level.width, channels) * level.height;
+		offset = level.offset + level.size;
+	}
+
+	// There's time to spend at build time, so the mipmaps get the sharper
+	// Kaiser filter. Each level's rows are then padded into place
+	std::vector<unsigned char> chain(MipChainSize(width, height, channels));
+	memcpy(chain.data(), pixels, (size_t)width * height * channels);
+	stbi_image_free(pixels);
+	GenerateMips(chain.data(), width, height, channels, MipFilter::Kaiser, true);
+	std::vector<unsigned char> data((size_t)(offset - levels[0].offset));
+	const unsigned char* source = chain.data();
+	for (const BakedLevel& level : levels)
+	{
+		size_t rowBytes = (size_t)level.width * channels;
+		for (uint32_t y = 0; y < level.height; y++)
+		{
+			memcpy(&data[level.offset - levels[0].offset + y * BakedRowBytes(level.width, channels)], source, rowBytes);
+			source += rowBytes;
+		}
+	}
+
+	// Write a temporary file and rename it into place, so a failed bake
+	// leaves nothing half written behind
+	std::string tempPath = std::string(bakedPath) + ".tmp";
+	{
+		std::ofstream stream(fs::u8path(tempPath), std::ios::binary | std::ios::trunc);
+		stream.write((const char*)&header, sizeof(header));
+		stream.write((const char*)levels.data(), sizeof(BakedLevel) * levels.size());
+		std::vector<char> padding(levels[0].offset - sizeof(header) - sizeof(BakedLevel) * levels.size());
+		stream.write(padding.data(), padding.size());
+		stream.write((const char*)data.data(), data.size());
+		if (!stream)
+		{
+			return false;
+		}
+	}
+	std::error_code error;
+	fs::rename(fs::u8path(tempPath), fs::u8path(bakedPath), error);
+	return !error;
+}
+
+int BakeTextures(const char* directory, int numThreads)
+{
+	// Find the images whose baked copies are missing or older than them.
+	// Anything stb_image can't read is skipped when it comes to baking
+	std::vector<std::string> toBake;
+	std::error_code error;
+	fs::recursive_directory_iterator it(directory, fs::directory_options::skip_permission_denied, error);
+	for (; !error && it != fs::recursive_directory_iterator(); it.increment(error))
+	{
+		std::error_code fileError, bakedError;
+		if (!it->is_regular_file(fileError) || it->path().extension() == BAKED_EXTENSION) continue;
+		std::string path = it->path().generic_u8string();
+		fs::file_time_type modified = it->last_write_time(fileError);
+		fs::file_time_type baked = fs::last_write_time(fs::u8path(BakedPath(path)), bakedError);
+		if (!fileError && !bakedError && baked >= modified) continue;
+		toBake.push_back(path);
+	}
+	if (error)
+	{
+		std::cout << "Failed to scan " << directory << ": " << error.message() << std::endl;
+		return -1;
+	}
+
+	if (numThreads <= 0)
+	{
+		numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	numThreads = (int)std::min<size_t>(numThreads, toBake.size());
+	std::atomic<size_t> next(0);
+	std::atomic<int> baked(0);
+	std::atomic<bool> failed(false);
+	auto bake = [&]()
+	{
+		for (size_t i = next++; i < toBake.size(); i = next++)
+		{
+			const char* path = toBake[i].c_str();
+			int width, height, channels;
+			if (!stbi_info(path, &width, &height, &channels)) continue;
+			if (BakeTexture(path, BakedPath(toBake[i]).c_str()))
+			{
+				baked++;
+			}
+			else
+			{
+				std::cout << "Failed to bake " << toBake[i] << std::endl;
+				failed = true;
+			}
+		}
+	};
+	std::vector<std::thread> threads;
+	for (int i = 1; i < numThreads; i++)
+	{
+		threads.emplace_back(bake);
+	}
+	bake();
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+	return failed ? -1 : (int)baked;
+}
+
+GLuint LoadBakedTexture(const char* path, GLenum format)
+{
+	MappedFile file(path);
+	BakedHeader header;
+	if (!file.data() || file.size() < sizeof(header))
+	{
+		return 0;
+	}
+	memcpy(&header, file.data(), sizeof(header));
+	if (header.magic != BAKED_MAGIC || header.version != BAKED_VERSION || header.format != format ||
+		header.levels == 0 || header.levels > 32 || (file.size() - sizeof(header)) / sizeof(BakedLevel) < header.levels)
+	{
+		return 0;
+	}
+
+	// Check every level lies inside the file before uploading any
+	std::vector<BakedLevel> levels(header.levels);
+	memcpy(levels.data(), file.data() + sizeof(header), sizeof(BakedLevel) * levels.size());
+	int channels = FormatChannels(format);
+	for (const BakedLevel& level : levels)
+	{
+		if (level.offset > file.size() || level.size > file.size() - level.offset || level.width == 0 || level.height == 0 ||
+			(format && header.type == GL_UNSIGNED_BYTE && level.size < BakedRowBytes(level.width, channels) * level.height))
+		{
+			std::cout << "Corrupt baked texture: " << path << std::endl;
+			return 0;
+		}
+	}
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	bool allocated = AllocateStorage(header.internalFormat, levels[0].width, levels[0].height, header.levels);
+	for (uint32_t i = 0; i < header.levels; i++)
+	{
+		const BakedLevel& level = levels[i];
+		UploadLevel(allocated, i, header.internalFormat, level.width, level.height, header.format, header.type, file.data() + level.offset, level.size);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.levels - 1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return texture;
+}
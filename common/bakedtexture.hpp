@@ -0,0 +1,48 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+#include <glad/glad.h>
+
+// A baked texture is an image's whole mip chain laid out the way the upload
+// wants it, so that loading one is a file mapping and a glTexImage2D per
+// level with no decoding. Levels are stored bottom row first, as OpenGL
+// expects, with rows padded to the default unpack alignment of 4. The file
+// is this header, a BakedLevel per level and then the levels, little endian
+const uint32_t BAKED_MAGIC = 0x58455442; // "BTEX"
+const uint32_t BAKED_VERSION = 1;
+
+struct BakedHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t levels;
+	uint32_t internalFormat;
+	uint32_t format; // 0 for compressed levels
+	uint32_t type;
+};
+
+struct BakedLevel
+{
+	uint64_t offset; // from the start of the file
+	uint64_t size;
+	uint32_t width;
+	uint32_t height;
+};
+
+// Where the baked copy of an image lives
+std::string BakedPath(const std::string& imagePath);
+
+// Decodes an image and writes out its mip chain. Images with alpha are baked
+// as RGBA8 and everything else as RGB8
+bool BakeTexture(const char* imagePath, const char* bakedPath);
+
+// Bakes every image under the directory that's changed since it was last
+// baked, on numThreads threads (0 for one per core). Returns the number
+// baked, or -1 if any failed
+int BakeTextures(const char* directory, int numThreads = 0);
+
+// Creates a texture from a baked file, uploading each level straight from a
+// mapping of it. Returns 0 if the file is missing, corrupt or not in format
+GLuint LoadBakedTexture(const char* path, GLenum format);
@@ -0,0 +1,396 @@
+﻿#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BLOCK_SSE2
+#endif
+
+#include "BlockCompressor.hpp"
+
+// Gathers the 4x4 texels of a block
+void LoadBlock(const unsigned char* rgba, int width, int height, int bx, int by, unsigned char block[64])
+{
+	for (int y = 0; y < 4; y++)
+	{
+		const unsigned char* row = rgba + (size_t)std::min(by * 4 + y, height - 1) * width * 4;
+		for (int x = 0; x < 4; x++)
+		{
+			memcpy(block + (y * 4 + x) * 4, row + (size_t)std::min(bx * 4 + x, width - 1) * 4, 4);
+		}
+	}
+}
+
+uint16_t Pack565(const int color[3])
+{
+	int r = (color[0] * 31 + 127) / 255;
+	int g = (color[1] * 63 + 127) / 255;
+	int b = (color[2] * 31 + 127) / 255;
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+void Unpack565(uint16_t packed, int color[3])
+{
+	int r = packed >> 11;
+	int g = (packed >> 5) & 63;
+	int b = packed & 31;
+	color[0] = (r << 3) | (r >> 2);
+	color[1] = (g << 2) | (g >> 4);
+	color[2] = (b << 3) | (b >> 2);
+}
+
+// Picks the nearest palette color to each texel, ignoring alpha, and returns
+// the summed squared error. Ties go to the lower index
+int NearestColors(const unsigned char block[64], const int palette[4][3], uint8_t indices[16])
+{
+#ifdef BLOCK_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i rgbMask = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+	__m128i total = zero;
+	for (int group = 0; group < 4; group++)
+	{
+		// Four texels, widened to 16 bits with alpha masked off
+		__m128i texels = _mm_loadu_si128((const __m128i*)(block + group * 16));
+		__m128i lo = _mm_and_si128(_mm_unpacklo_epi8(texels, zero), rgbMask);
+		__m128i hi = _mm_and_si128(_mm_unpackhi_epi8(texels, zero), rgbMask);
+		__m128i best = zero, bestIndex = zero;
+		for (int i = 0; i < 4; i++)
+		{
+			__m128i color = _mm_set_epi16(0, (short)palette[i][2], (short)palette[i][1], (short)palette[i][0],
+				0, (short)palette[i][2], (short)palette[i][1], (short)palette[i][0]);
+			__m128i dlo = _mm_sub_epi16(lo, color);
+			__m128i dhi = _mm_sub_epi16(hi, color);
+			// r*r+g*g and b*b for each texel, then summed across the pairs
+			__m128 slo = _mm_castsi128_ps(_mm_madd_epi16(dlo, dlo));
+			__m128 shi = _mm_castsi128_ps(_mm_madd_epi16(dhi, dhi));
+			__m128i distance = _mm_add_epi32(
+				_mm_castps_si128(_mm_shuffle_ps(slo, shi, _MM_SHUFFLE(2, 0, 2, 0))),
+				_mm_castps_si128(_mm_shuffle_ps(slo, shi, _MM_SHUFFLE(3, 1, 3, 1))));
+			if (i == 0)
+			{
+				best = distance;
+				continue;
+			}
+			__m128i closer = _mm_cmplt_epi32(distance, best);
+			best = _mm_or_si128(_mm_and_si128(closer, distance), _mm_andnot_si128(closer, best));
+			bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(i)), _mm_andnot_si128(closer, bestIndex));
+		}
+		total = _mm_add_epi32(total, best);
+		int32_t groupIndices[4];
+		_mm_storeu_si128((__m128i*)groupIndices, bestIndex);
+		for (int j = 0; j < 4; j++)
+		{
+			indices[group * 4 + j] = (uint8_t)groupIndices[j];
+		}
+	}
+	int32_t sums[4];
+	_mm_storeu_si128((__m128i*)sums, total);
+	return sums[0] + sums[1] + sums[2] + sums[3];
+#else
+	int total = 0;
+	for (int t = 0; t < 16; t++)
+	{
+		const unsigned char* texel = block + t * 4;
+		int best = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			int dr = texel[0] - palette[i][0];
+			int dg = texel[1] - palette[i][1];
+			int db = texel[2] - palette[i][2];
+			int distance = dr * dr + dg * dg + db * db;
+			if (i == 0 || distance < best)
+			{
+				best = distance;
+				indices[t] = (uint8_t)i;
+			}
+		}
+		total += best;
+	}
+	return total;
+#endif
+}
+
+// Endpoints at the corners of the block's bounding box, inset a little as
+// the texels rarely reach the corners
+void BoxEndpoints(const unsigned char block[64], int endpoints[2][3])
+{
+	for (int c = 0; c < 3; c++)
+	{
+		int lo = 255, hi = 0;
+		for (int t = 0; t < 16; t++)
+		{
+			lo = std::min(lo, (int)block[t * 4 + c]);
+			hi = std::max(hi, (int)block[t * 4 + c]);
+		}
+		int inset = (hi - lo) / 16;
+		endpoints[0][c] = hi - inset;
+		endpoints[1][c] = lo + inset;
+	}
+}
+
+// Endpoints at the extremes of the texels along the block's principal axis,
+// found by power iteration on their covariance
+void PrincipalEndpoints(const unsigned char block[64], int endpoints[2][3])
+{
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	for (int t = 0; t < 16; t++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			mean[c] += block[t * 4 + c] / 16.0f;
+		}
+	}
+	float covariance[3][3] = {};
+	for (int t = 0; t < 16; t++)
+	{
+		float d[3] = { block[t * 4] - mean[0], block[t * 4 + 1] - mean[1], block[t * 4 + 2] - mean[2] };
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				covariance[i][j] += d[i] * d[j];
+			}
+		}
+	}
+
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for (int iteration = 0; iteration < 4; iteration++)
+	{
+		float next[3];
+		for (int i = 0; i < 3; i++)
+		{
+			next[i] = covariance[i][0] * axis[0] + covariance[i][1] * axis[1] + covariance[i][2] * axis[2];
+		}
+		float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+		if (length < 1e-6f) break; // every texel the same
+		for (int i = 0; i < 3; i++)
+		{
+			axis[i] = next[i] / length;
+		}
+	}
+
+	float lo = 0.0f, hi = 0.0f;
+	for (int t = 0; t < 16; t++)
+	{
+		float along = (block[t * 4] - mean[0]) * axis[0] + (block[t * 4 + 1] - mean[1]) * axis[1] + (block[t * 4 + 2] - mean[2]) * axis[2];
+		lo = std::min(lo, along);
+		hi = std::max(hi, along);
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		endpoints[0][c] = std::clamp((int)std::lround(mean[c] + axis[c] * hi), 0, 255);
+		endpoints[1][c] = std::clamp((int)std::lround(mean[c] + axis[c] * lo), 0, 255);
+	}
+}
+
+// Solves for the endpoints that best fit the texels given their indices.
+// Returns false if the indices don't pin them down
+bool RefineEndpoints(const unsigned char block[64], const uint8_t indices[16], int endpoints[2][3])
+{
+	// How much of endpoint 0 each index stands for
+	static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+	float aa = 0.0f, bb = 0.0f, ab = 0.0f, ax[3] = {}, bx[3] = {};
+	for (int t = 0; t < 16; t++)
+	{
+		float a = weights[indices[t]];
+		float b = 1.0f - a;
+		aa += a * a;
+		bb += b * b;
+		ab += a * b;
+		for (int c = 0; c < 3; c++)
+		{
+			ax[c] += a * block[t * 4 + c];
+			bx[c] += b * block[t * 4 + c];
+		}
+	}
+	float determinant = aa * bb - ab * ab;
+	if (std::fabs(determinant) < 1e-6f)
+	{
+		return false;
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		endpoints[0][c] = std::clamp((int)std::lround((ax[c] * bb - bx[c] * ab) / determinant), 0, 255);
+		endpoints[1][c] = std::clamp((int)std::lround((bx[c] * aa - ax[c] * ab) / determinant), 0, 255);
+	}
+	return true;
+}
+
+// Quantizes the endpoints and picks each texel's index, returning the error.
+// Endpoints are ordered for the four color mode, which a 565 tie can't have,
+// so then every texel takes endpoint 0
+int FitColors(const unsigned char block[64], const int endpoints[2][3], uint16_t packed[2], uint8_t indices[16])
+{
+	packed[0] = Pack565(endpoints[0]);
+	packed[1] = Pack565(endpoints[1]);
+	if (packed[0] < packed[1])
+	{
+		std::swap(packed[0], packed[1]);
+	}
+	int palette[4][3];
+	Unpack565(packed[0], palette[0]);
+	Unpack565(packed[1], palette[1]);
+	for (int c = 0; c < 3; c++)
+	{
+		if (packed[0] == packed[1])
+		{
+			palette[1][c] = palette[2][c] = palette[3][c] = palette[0][c];
+		}
+		else
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+	}
+	return NearestColors(block, palette, indices);
+}
+
+void EncodeColorBlock(const unsigned char block[64], unsigned char out[8], int quality)
+{
+	int endpoints[2][3];
+	uint16_t packed[2];
+	uint8_t indices[16];
+	int error;
+	if (quality <= 0)
+	{
+		BoxEndpoints(block, endpoints);
+		error = FitColors(block, endpoints, packed, indices);
+	}
+	else
+	{
+		PrincipalEndpoints(block, endpoints);
+		error = FitColors(block, endpoints, packed, indices);
+		if (quality >= 2)
+		{
+			// The bounding box sometimes does better, e.g. for two colors
+			int trialEndpoints[2][3];
+			uint16_t trialPacked[2];
+			uint8_t trialIndices[16];
+			BoxEndpoints(block, trialEndpoints);
+			int trialError = FitColors(block, trialEndpoints, trialPacked, trialIndices);
+			if (trialError < error)
+			{
+				error = trialError;
+				memcpy(packed, trialPacked, sizeof(packed));
+				memcpy(indices, trialIndices, sizeof(indices));
+			}
+		}
+
+		for (int pass = 0; pass < (quality >= 2 ? 8 : 1) && error > 0; pass++)
+		{
+			int trialEndpoints[2][3];
+			uint16_t trialPacked[2];
+			uint8_t trialIndices[16];
+			if (!RefineEndpoints(block, indices, trialEndpoints)) break;
+			int trialError = FitColors(block, trialEndpoints, trialPacked, trialIndices);
+			if (trialError >= error) break;
+			error = trialError;
+			memcpy(packed, trialPacked, sizeof(packed));
+			memcpy(indices, trialIndices, sizeof(indices));
+		}
+	}
+
+	out[0] = (unsigned char)(packed[0] & 255);
+	out[1] = (unsigned char)(packed[0] >> 8);
+	out[2] = (unsigned char)(packed[1] & 255);
+	out[3] = (unsigned char)(packed[1] >> 8);
+	for (int row = 0; row < 4; row++)
+	{
+		out[4 + row] = (unsigned char)(indices[row * 4] | (indices[row * 4 + 1] << 2) | (indices[row * 4 + 2] << 4) | (indices[row * 4 + 3] << 6));
+	}
+}
+
+// Alpha in the eight value mode, between the block's extremes
+void EncodeAlphaBlock(const unsigned char block[64], unsigned char out[8])
+{
+	int lo = 255, hi = 0;
+	for (int t = 0; t < 16; t++)
+	{
+		lo = std::min(lo, (int)block[t * 4 + 3]);
+		hi = std::max(hi, (int)block[t * 4 + 3]);
+	}
+	out[0] = (unsigned char)hi;
+	out[1] = (unsigned char)lo;
+	memset(out + 2, 0, 6);
+	if (hi == lo)
+	{
+		return;
+	}
+
+	int palette[8] = { hi, lo };
+	for (int i = 2; i < 8; i++)
+	{
+		palette[i] = ((8 - i) * hi + (i - 1) * lo) / 7;
+	}
+	uint64_t bits = 0;
+	for (int t = 0; t < 16; t++)
+	{
+		int alpha = block[t * 4 + 3];
+		int best = 0;
+		for (int i = 1; i < 8; i++)
+		{
+			if (std::abs(alpha - palette[i]) < std::abs(alpha - palette[best]))
+			{
+				best = i;
+			}
+		}
+		bits |= (uint64_t)best << (3 * t);
+	}
+	for (int i = 0; i < 6; i++)
+	{
+		out[2 + i] = (unsigned char)(bits >> (8 * i));
+	}
+}
+
+size_t CompressedSize(BlockFormat format, int width, int height)
+{
+	size_t blockBytes = format == BlockFormat::BC1 ? 8 : 16;
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes;
+}
+
+void CompressBlocks(BlockFormat format, const unsigned char* rgba, int width, int height, unsigned char* out, int quality, int numThreads)
+{
+	int blocksWide = (width + 3) / 4;
+	int blocksHigh = (height + 3) / 4;
+	size_t blockBytes = format == BlockFormat::BC1 ? 8 : 16;
+
+	if (numThreads <= 0)
+	{
+		numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	numThreads = std::min(numThreads, blocksHigh);
+	std::atomic<int> next(0);
+	auto compress = [&]()
+	{
+		unsigned char block[64];
+		for (int by = next++; by < blocksHigh; by = next++)
+		{
+			unsigned char* dst = out + (size_t)by * blocksWide * blockBytes;
+			for (int bx = 0; bx < blocksWide; bx++)
+			{
+				LoadBlock(rgba, width, height, bx, by, block);
+				if (format == BlockFormat::BC3)
+				{
+					EncodeAlphaBlock(block, dst);
+					dst += 8;
+				}
+				EncodeColorBlock(block, dst, quality);
+				dst += 8;
+			}
+		}
+	};
+	std::vector<std::thread> threads;
+	for (int i = 1; i < numThreads; i++)
+	{
+		threads.emplace_back(compress);
+	}
+	compress();
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+}
@@ -0,0 +1,21 @@
+﻿#pragma once
+#include <cstddef>
+
+// S3TC (BC) block compression of RGBA8 images, cutting a texture to 4 bits a
+// texel for BC1, which has no alpha, or 8 for BC3, which adds it. quality
+// runs from 0, which fits each block's endpoints to its bounding box, to 2,
+// which refines endpoints along the block's principal axis until they stop
+// improving. 1 refines once and is a good default
+enum class BlockFormat
+{
+	BC1,
+	BC3,
+};
+
+// Bytes of blocks for a level of this size
+size_t CompressedSize(BlockFormat format, int width, int height);
+
+// Compresses a tightly packed RGBA8 image, splitting the rows of blocks
+// across numThreads threads (0 for one per core). Blocks that hang off the
+// right or bottom edge repeat the last column or row
+void CompressBlocks(BlockFormat format, const unsigned char* rgba, int width, int height, unsigned char* out, int quality = 1, int numThreads = 1);
@@ -0,0 +1,355 @@
+﻿#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstring>
+#include <iostream>
+
+#include "ContainerTexture.hpp"
+#include "GLCaps.hpp"
+#include "MappedFile.hpp"
+#include "TextureFormat.hpp"
+#include "../stb_image.h"
+
+// How a format is stored, keyed by its Vulkan format in KTX2 or DXGI format
+// in DDS. Compressed formats have a block size and uncompressed a pixel size
+struct ContainerFormat
+{
+	uint32_t key;
+	GLenum internalFormat;
+	GLenum format;
+	GLenum type;
+	int blockBytes;
+	int pixelBytes;
+};
+
+const ContainerFormat KTX2_FORMATS[] = {
+	{ 9, GL_R8, GL_RED, GL_UNSIGNED_BYTE, 0, 1 },
+	{ 16, GL_RG8, GL_RG, GL_UNSIGNED_BYTE, 0, 2 },
+	{ 23, GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE, 0, 3 },
+	{ 29, GL_SRGB8, GL_RGB, GL_UNSIGNED_BYTE, 0, 3 },
+	{ 37, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 0, 4 },
+	{ 43, GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, 0, 4 },
+	{ 44, GL_RGBA8, GL_BGRA, GL_UNSIGNED_BYTE, 0, 4 },
+	{ 50, GL_SRGB8_ALPHA8, GL_BGRA, GL_UNSIGNED_BYTE, 0, 4 },
+	{ 97, GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 0, 8 },
+	{ 131, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 0, 0, 8, 0 },
+	{ 132, GL_COMPRESSED_SRGB_S3TC_DXT1_EXT, 0, 0, 8, 0 },
+	{ 133, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 0, 0, 8, 0 },
+	{ 134, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, 0, 0, 8, 0 },
+	{ 135, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, 0, 0, 16, 0 },
+	{ 136, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT, 0, 0, 16, 0 },
+	{ 137, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 0, 0, 16, 0 },
+	{ 138, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 0, 0, 16, 0 },
+	{ 139, GL_COMPRESSED_RED_RGTC1, 0, 0, 8, 0 },
+	{ 140, GL_COMPRESSED_SIGNED_RED_RGTC1, 0, 0, 8, 0 },
+	{ 141, GL_COMPRESSED_RG_RGTC2, 0, 0, 16, 0 },
+	{ 142, GL_COMPRESSED_SIGNED_RG_RGTC2, 0, 0, 16, 0 },
+	{ 143, GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT, 0, 0, 16, 0 },
+	{ 144, GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT, 0, 0, 16, 0 },
+	{ 145, GL_COMPRESSED_RGBA_BPTC_UNORM, 0, 0, 16, 0 },
+	{ 146, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM, 0, 0, 16, 0 },
+	{ 147, GL_COMPRESSED_RGB8_ETC2, 0, 0, 8, 0 },
+	{ 148, GL_COMPRESSED_SRGB8_ETC2, 0, 0, 8, 0 },
+	{ 149, GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2, 0, 0, 8, 0 },
+	{ 150, GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2, 0, 0, 8, 0 },
+	{ 151, GL_COMPRESSED_RGBA8_ETC2_EAC, 0, 0, 16, 0 },
+	{ 152, GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC, 0, 0, 16, 0 },
+};
+
+const ContainerFormat DXGI_FORMATS[] = {
+	{ 10, GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 0, 8 },
+	{ 28, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 0, 4 },
+	{ 29, GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, 0, 4 },
+	{ 49, GL_RG8, GL_RG, GL_UNSIGNED_BYTE, 0, 2 },
+	{ 61, GL_R8, GL_RED, GL_UNSIGNED_BYTE, 0, 1 },
+	{ 71, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 0, 0, 8, 0 },
+	{ 72, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, 0, 0, 8, 0 },
+	{ 74, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, 0, 0, 16, 0 },
+	{ 75, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT, 0, 0, 16, 0 },
+	{ 77, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 0, 0, 16, 0 },
+	{ 78, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 0, 0, 16, 0 },
+	{ 80, GL_COMPRESSED_RED_RGTC1, 0, 0, 8, 0 },
+	{ 81, GL_COMPRESSED_SIGNED_RED_RGTC1, 0, 0, 8, 0 },
+	{ 83, GL_COMPRESSED_RG_RGTC2, 0, 0, 16, 0 },
+	{ 84, GL_COMPRESSED_SIGNED_RG_RGTC2, 0, 0, 16, 0 },
+	{ 87, GL_RGBA8, GL_BGRA, GL_UNSIGNED_BYTE, 0, 4 },
+	{ 91, GL_SRGB8_ALPHA8, GL_BGRA, GL_UNSIGNED_BYTE, 0, 4 },
+	{ 95, GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT, 0, 0, 16, 0 },
+	{ 96, GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT, 0, 0, 16, 0 },
+	{ 98, GL_COMPRESSED_RGBA_BPTC_UNORM, 0, 0, 16, 0 },
+	{ 99, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM, 0, 0, 16, 0 },
+};
+
+const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+const uint32_t DDS_MAGIC = 0x20534444; // "DDS "
+const size_t DDS_HEADER_SIZE = 124;
+const size_t DDS_DX10_SIZE = 20;
+
+uint32_t FourCC(const char code[4])
+{
+	return (uint32_t)code[0] | ((uint32_t)code[1] << 8) | ((uint32_t)code[2] << 16) | ((uint32_t)code[3] << 24);
+}
+
+uint32_t ReadU32(const unsigned char* data)
+{
+	uint32_t value;
+	memcpy(&value, data, 4);
+	return value;
+}
+
+uint64_t ReadU64(const unsigned char* data)
+{
+	uint64_t value;
+	memcpy(&value, data, 8);
+	return value;
+}
+
+template <size_t N>
+const ContainerFormat* FindFormat(const ContainerFormat (&formats)[N], uint32_t key)
+{
+	for (const ContainerFormat& format : formats)
+	{
+		if (format.key == key) return &format;
+	}
+	return nullptr;
+}
+
+// Bytes in a level, or 0 if it's too big to address
+size_t LevelSize(const ContainerFormat& format, uint32_t width, uint32_t height)
+{
+	uint64_t size = format.blockBytes
+		? (((uint64_t)width + 3) / 4) * (((uint64_t)height + 3) / 4) * format.blockBytes
+		: (uint64_t)width * height * format.pixelBytes;
+	return size > SIZE_MAX ? 0 : (size_t)size;
+}
+
+// Levels past the first halve down to 1x1, so there can only be so many
+bool ValidLevels(uint32_t width, uint32_t height, uint32_t levels)
+{
+	uint32_t most = 1;
+	while (most < 32 && ((width >> most) || (height >> most)))
+	{
+		most++;
+	}
+	return width > 0 && height > 0 && levels > 0 && levels <= most;
+}
+
+void SetFormat(ContainerTexture& texture, const ContainerFormat& format)
+{
+	texture.internalFormat = format.internalFormat;
+	texture.format = format.format;
+	texture.type = format.type;
+	texture.levels.clear();
+}
+
+// The DXGI format a pre-DX10 DDS pixel format matches, or 0
+uint32_t LegacyDDSFormat(const unsigned char* pixelFormat)
+{
+	const uint32_t DDPF_ALPHAPIXELS = 0x1, DDPF_FOURCC = 0x4, DDPF_RGB = 0x40, DDPF_LUMINANCE = 0x20000;
+	uint32_t flags = ReadU32(pixelFormat + 4);
+	uint32_t fourCC = ReadU32(pixelFormat + 8);
+	uint32_t bits = ReadU32(pixelFormat + 12);
+	uint32_t red = ReadU32(pixelFormat + 16);
+	uint32_t alpha = ReadU32(pixelFormat + 28);
+	if (flags & DDPF_FOURCC)
+	{
+		if (fourCC == FourCC("DXT1")) return 71;
+		if (fourCC == FourCC("DXT2") || fourCC == FourCC("DXT3")) return 74;
+		if (fourCC == FourCC("DXT4") || fourCC == FourCC("DXT5")) return 77;
+		if (fourCC == FourCC("ATI1") || fourCC == FourCC("BC4U")) return 80;
+		if (fourCC == FourCC("BC4S")) return 81;
+		if (fourCC == FourCC("ATI2") || fourCC == FourCC("BC5U")) return 83;
+		if (fourCC == FourCC("BC5S")) return 84;
+		if (fourCC == 113) return 10; // D3DFMT_A16B16G16R16F
+		return 0;
+	}
+	if ((flags & DDPF_RGB) && (flags & DDPF_ALPHAPIXELS) && bits == 32 && alpha == 0xff000000)
+	{
+		if (red == 0x000000ff) return 28;
+		if (red == 0x00ff0000) return 87;
+	}
+	if ((flags & DDPF_LUMINANCE) && bits == 8 && red == 0xff) return 61;
+	return 0;
+}
+
+bool ParseDDS(const unsigned char* data, size_t size, ContainerTexture& texture)
+{
+	const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+	const uint32_t DDSCAPS2_CUBEMAP = 0x200, DDSCAPS2_VOLUME = 0x200000;
+	const uint32_t D3D10_RESOURCE_DIMENSION_TEXTURE2D = 3, D3D10_RESOURCE_MISC_TEXTURECUBE = 0x4;
+	if (size < 4 + DDS_HEADER_SIZE)
+	{
+		return false;
+	}
+	const unsigned char* header = data + 4;
+	uint32_t flags = ReadU32(header + 4);
+	uint32_t height = ReadU32(header + 8);
+	uint32_t width = ReadU32(header + 12);
+	uint32_t levels = (flags & DDSD_MIPMAPCOUNT) ? std::max(1u, ReadU32(header + 24)) : 1;
+	const unsigned char* pixelFormat = header + 72;
+	uint32_t caps2 = ReadU32(header + 108);
+	if (ReadU32(header) != DDS_HEADER_SIZE || (caps2 & (DDSCAPS2_CUBEMAP | DDSCAPS2_VOLUME)))
+	{
+		return false;
+	}
+
+	size_t offset = 4 + DDS_HEADER_SIZE;
+	uint32_t dxgiFormat;
+	if (ReadU32(pixelFormat + 8) == FourCC("DX10"))
+	{
+		if (size < offset + DDS_DX10_SIZE)
+		{
+			return false;
+		}
+		const unsigned char* dx10 = data + offset;
+		if (ReadU32(dx10 + 4) != D3D10_RESOURCE_DIMENSION_TEXTURE2D || (ReadU32(dx10 + 8) & D3D10_RESOURCE_MISC_TEXTURECUBE) ||
+			ReadU32(dx10 + 12) != 1)
+		{
+			return false;
+		}
+		dxgiFormat = ReadU32(dx10);
+		offset += DDS_DX10_SIZE;
+	}
+	else
+	{
+		dxgiFormat = LegacyDDSFormat(pixelFormat);
+	}
+	const ContainerFormat* format = FindFormat(DXGI_FORMATS, dxgiFormat);
+	if (!format || !ValidLevels(width, height, levels))
+	{
+		return false;
+	}
+
+	// Levels follow the header back to back, largest first
+	SetFormat(texture, *format);
+	texture.supercompression = KTX2_SUPERCOMPRESSION_NONE;
+	for (uint32_t i = 0; i < levels; i++)
+	{
+		ContainerTexture::Level level;
+		level.width = (int)std::max(1u, width >> i);
+		level.height = (int)std::max(1u, height >> i);
+		level.size = level.uncompressedSize = LevelSize(*format, level.width, level.height);
+		if (level.size == 0 || level.size > size - offset)
+		{
+			return false;
+		}
+		level.data = data + offset;
+		offset += level.size;
+		texture.levels.push_back(level);
+	}
+	return true;
+}
+
+bool ParseKTX2(const unsigned char* data, size_t size, ContainerTexture& texture)
+{
+	const size_t HEADER_SIZE = 80, LEVEL_SIZE = 24;
+	if (size < HEADER_SIZE)
+	{
+		return false;
+	}
+	uint32_t vkFormat = ReadU32(data + 12);
+	uint32_t width = ReadU32(data + 20);
+	uint32_t height = ReadU32(data + 24);
+	uint32_t depth = ReadU32(data + 28);
+	uint32_t layers = ReadU32(data + 32);
+	uint32_t faces = ReadU32(data + 36);
+	// No levels means the loader should generate them, so there's just one
+	uint32_t levels = std::max(1u, ReadU32(data + 40));
+	uint32_t supercompression = ReadU32(data + 44);
+	const ContainerFormat* format = FindFormat(KTX2_FORMATS, vkFormat);
+	if (!format || depth != 0 || layers != 0 || faces != 1 || !ValidLevels(width, height, levels) ||
+		(supercompression != KTX2_SUPERCOMPRESSION_NONE && supercompression != KTX2_SUPERCOMPRESSION_ZLIB) ||
+		(size - HEADER_SIZE) / LEVEL_SIZE < levels)
+	{
+		return false;
+	}
+
+	// The level index gives each level's place, largest first
+	SetFormat(texture, *format);
+	texture.supercompression = supercompression;
+	for (uint32_t i = 0; i < levels; i++)
+	{
+		const unsigned char* entry = data + HEADER_SIZE + i * LEVEL_SIZE;
+		uint64_t offset = ReadU64(entry);
+		uint64_t length = ReadU64(entry + 8);
+		uint64_t uncompressedLength = ReadU64(entry + 16);
+		ContainerTexture::Level level;
+		level.width = (int)std::max(1u, width >> i);
+		level.height = (int)std::max(1u, height >> i);
+		level.uncompressedSize = LevelSize(*format, level.width, level.height);
+		if (supercompression == KTX2_SUPERCOMPRESSION_NONE)
+		{
+			length = std::min<uint64_t>(length, level.uncompressedSize);
+			uncompressedLength = length;
+		}
+		if (level.uncompressedSize == 0 || uncompressedLength != level.uncompressedSize || offset > size || length > size - offset)
+		{
+			return false;
+		}
+		level.data = data + offset;
+		level.size = (size_t)length;
+		texture.levels.push_back(level);
+	}
+	return true;
+}
+
+bool IsContainerPath(const std::string& path)
+{
+	std::string extension = path.substr(std::min(path.size(), path.find_last_of('.')));
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+	return extension == ".dds" || extension == ".ktx2";
+}
+
+bool ParseContainer(const unsigned char* data, size_t size, ContainerTexture& texture)
+{
+	if (data && size >= sizeof(KTX2_IDENTIFIER) && memcmp(data, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) == 0)
+	{
+		return ParseKTX2(data, size, texture);
+	}
+	if (data && size >= 4 && ReadU32(data) == DDS_MAGIC)
+	{
+		return ParseDDS(data, size, texture);
+	}
+	return false;
+}
+
+bool InflateLevel(const ContainerTexture::Level& level, unsigned char* out)
+{
+	if (level.size > INT_MAX || level.uncompressedSize > INT_MAX)
+	{
+		return false;
+	}
+	int inflated = stbi_zlib_decode_buffer((char*)out, (int)level.uncompressedSize, (const char*)level.data, (int)level.size);
+	return inflated == (int)level.uncompressedSize;
+}
+
+GLuint LoadContainerTexture(const char* path)
+{
+	MappedFile file(path);
+	ContainerTexture container;
+	if (!ParseContainer(file.data(), file.size(), container) || container.supercompression != KTX2_SUPERCOMPRESSION_NONE)
+	{
+		return 0;
+	}
+	if (!TextureSupported(container.internalFormat, container.levels[0].width, container.levels[0].height))
+	{
+		std::cout << "Unsupported texture format: " << path << std::endl;
+		return 0;
+	}
+
+	// Rows are tightly packed in both containers
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	bool allocated = AllocateStorage(container.internalFormat, container.levels[0].width, container.levels[0].height, (int)container.levels.size());
+	for (size_t i = 0; i < container.levels.size(); i++)
+	{
+		const ContainerTexture::Level& level = container.levels[i];
+		UploadLevel(allocated, (GLint)i, container.internalFormat, level.width, level.height, container.format, container.type, level.data, level.size);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)container.levels.size() - 1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return texture;
+}
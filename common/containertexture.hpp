@@ -0,0 +1,52 @@
+﻿#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+
+// KTX2 supercompression schemes. Only zlib is inflated here
+const uint32_t KTX2_SUPERCOMPRESSION_NONE = 0;
+const uint32_t KTX2_SUPERCOMPRESSION_BASISLZ = 1;
+const uint32_t KTX2_SUPERCOMPRESSION_ZSTD = 2;
+const uint32_t KTX2_SUPERCOMPRESSION_ZLIB = 3;
+
+// A 2D texture in a DDS or KTX2 file, parsed in place from the file's bytes.
+// Both store the top row first, so unlike images loaded with
+// stbi_set_flip_vertically_on_load these come out upside down to OpenGL
+struct ContainerTexture
+{
+	struct Level
+	{
+		const unsigned char* data;
+		size_t size;
+		size_t uncompressedSize; // once inflated, if supercompressed
+		int width;
+		int height;
+	};
+
+	GLenum internalFormat;
+	GLenum format; // 0 for compressed levels
+	GLenum type;
+	uint32_t supercompression;
+	std::vector<Level> levels;
+};
+
+// Whether a path names a DDS or KTX2 file, going by its extension
+bool IsContainerPath(const std::string& path);
+
+// Reads the header and level index, checking every level lies inside the
+// data and is the size its format implies. Returns false for anything but a
+// 2D texture in one of the formats OpenGL can take as stored, or for KTX2
+// supercompressed with anything but zlib
+bool ParseContainer(const unsigned char* data, size_t size, ContainerTexture& texture);
+
+// Inflates a zlib supercompressed level into out, which holds its
+// uncompressedSize
+bool InflateLevel(const ContainerTexture::Level& level, unsigned char* out);
+
+// Creates a texture from a DDS or KTX2 file, uploading each level straight
+// from a mapping of it. Returns 0 if the file is missing, corrupt or in a
+// format the driver lacks, or if it's supercompressed, which TextureStreamer
+// inflates on its workers instead
+GLuint LoadContainerTexture(const char* path);
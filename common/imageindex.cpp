@@ -0,0 +1,244 @@
+﻿#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+#include "ImageIndex.hpp"
+#include "../stb_image.h"
+
+namespace fs = std::filesystem;
+
+// Bytes read to identify a file; enough for every header stb_image knows
+// except JPEGs carrying large metadata, which fall back to a stream
+const size_t PROBE_BYTES = 64 * 1024;
+const int INDEX_VERSION = 1;
+
+// Size and modification time for one directory entry. Windows fills these
+// in during the directory walk; elsewhere it takes exactly one stat
+bool StatFile(const fs::directory_entry& entry, int64_t& modified, uint64_t& size)
+{
+#ifdef _WIN32
+	std::error_code error;
+	size = entry.file_size(error);
+	if (error) return false;
+	modified = entry.last_write_time(error).time_since_epoch().count();
+	return !error;
+#else
+	struct stat st;
+	if (stat(entry.path().c_str(), &st) != 0) return false;
+	size = (uint64_t)st.st_size;
+#ifdef __APPLE__
+	modified = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+	modified = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+	return true;
+#endif
+}
+
+// stb_image callbacks reading from a std::istream
+int ReadStream(void* user, char* data, int size)
+{
+	std::istream* stream = (std::istream*)user;
+	stream->read(data, size);
+	return (int)stream->gcount();
+}
+
+void SkipStream(void* user, int n)
+{
+	std::istream* stream = (std::istream*)user;
+	stream->clear();
+	stream->seekg(n, std::ios::cur);
+}
+
+int StreamEof(void* user)
+{
+	std::istream* stream = (std::istream*)user;
+	return stream->peek() == std::istream::traits_type::eof();
+}
+
+// Identifies the file from a single read of its start, leaving it marked
+// as not an image if stb_image doesn't recognise it
+void ProbeFile(ImageInfo& info)
+{
+	info.width = info.height = info.channels = info.bitsPerChannel = 0;
+	info.hdr = false;
+
+	std::ifstream stream(fs::u8path(info.path), std::ios::binary);
+	if (!stream)
+	{
+		return;
+	}
+	std::vector<unsigned char> data((size_t)std::min<uint64_t>(info.size, PROBE_BYTES));
+	stream.read((char*)data.data(), data.size());
+	data.resize((size_t)stream.gcount());
+
+	int width, height, channels, bits, hdr;
+	int found = stbi_info_ex_from_memory(data.data(), (int)data.size(), &width, &height, &channels, &bits, &hdr);
+	if (!found && info.size > data.size())
+	{
+		// The header may be further in; let stb_image seek its way there
+		stbi_io_callbacks callbacks = { ReadStream, SkipStream, StreamEof };
+		stream.clear();
+		stream.seekg(0);
+		found = stbi_info_ex_from_callbacks(&callbacks, &stream, &width, &height, &channels, &bits, &hdr);
+	}
+	if (found)
+	{
+		info.width = width;
+		info.height = height;
+		info.channels = channels;
+		info.bitsPerChannel = bits;
+		info.hdr = hdr != 0;
+	}
+}
+
+ImageIndex::ImageIndex(const char* indexPath) : indexPath(indexPath)
+{
+	std::ifstream stream(indexPath);
+	std::string magic;
+	int version;
+	if (!(stream >> magic >> version) || magic != "ImageIndex" || version != INDEX_VERSION)
+	{
+		return;
+	}
+
+	ImageInfo info;
+	while (stream >> info.modified >> info.size >> info.width >> info.height >> info.channels >> info.bitsPerChannel >> info.hdr)
+	{
+		// The path is the rest of the line, after one separating space
+		stream.get();
+		if (!std::getline(stream, info.path)) break;
+		lookup[info.path] = entries.size();
+		entries.push_back(info);
+	}
+}
+
+int ImageIndex::scan(const char* directory, int numThreads)
+{
+	// Files outside this directory belong to other scans and are kept. The
+	// prefix ends in a separator, so that Resources isn't taken to be inside
+	// Res
+	std::string root = fs::path(directory).generic_u8string();
+	while (root.size() > 1 && root.back() == '/')
+	{
+		root.pop_back();
+	}
+	if (!root.empty() && root.back() != '/')
+	{
+		root += '/';
+	}
+	std::vector<ImageInfo> scanned;
+	for (const ImageInfo& info : entries)
+	{
+		if (info.path.compare(0, root.size(), root) != 0)
+		{
+			scanned.push_back(info);
+		}
+	}
+
+	// Stat everything, reusing what's known about files that haven't changed
+	std::vector<size_t> toProbe;
+	std::error_code error;
+	fs::recursive_directory_iterator it(directory, fs::directory_options::skip_permission_denied, error);
+	for (; !error && it != fs::recursive_directory_iterator(); it.increment(error))
+	{
+		std::error_code typeError;
+		if (!it->is_regular_file(typeError)) continue;
+
+		ImageInfo info;
+		info.path = it->path().generic_u8string();
+		if (!StatFile(*it, info.modified, info.size)) continue;
+
+		auto found = lookup.find(info.path);
+		if (found != lookup.end())
+		{
+			const ImageInfo& known = entries[found->second];
+			if (known.modified == info.modified && known.size == info.size)
+			{
+				scanned.push_back(known);
+				continue;
+			}
+		}
+		toProbe.push_back(scanned.size());
+		scanned.push_back(info);
+	}
+	if (error)
+	{
+		std::cout << "Failed to scan " << directory << ": " << error.message() << std::endl;
+	}
+
+	// Probe the new and changed files in parallel
+	if (numThreads <= 0)
+	{
+		numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	numThreads = (int)std::min<size_t>(numThreads, toProbe.size());
+	std::atomic<size_t> next(0);
+	auto probe = [&]()
+	{
+		for (size_t i = next++; i < toProbe.size(); i = next++)
+		{
+			ProbeFile(scanned[toProbe[i]]);
+		}
+	};
+	std::vector<std::thread> threads;
+	for (int i = 1; i < numThreads; i++)
+	{
+		threads.emplace_back(probe);
+	}
+	probe();
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	entries.swap(scanned);
+	lookup.clear();
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		lookup[entries[i].path] = i;
+	}
+	return (int)toProbe.size();
+}
+
+bool ImageIndex::save() const
+{
+	// Write a temporary file and rename it over the index, so a failed save
+	// leaves the old one intact
+	std::string tempPath = indexPath + ".tmp";
+	{
+		std::ofstream stream(tempPath, std::ios::trunc);
+		stream << "ImageIndex " << INDEX_VERSION << "\n";
+		for (const ImageInfo& info : entries)
+		{
+			stream << info.modified << " " << info.size << " " << info.width << " " << info.height << " "
+				<< info.channels << " " << info.bitsPerChannel << " " << info.hdr << " " << info.path << "\n";
+		}
+		if (!stream)
+		{
+			std::cout << "Failed to write " << tempPath << std::endl;
+			return false;
+		}
+	}
+
+	std::error_code error;
+	fs::rename(tempPath, indexPath, error);
+	if (error)
+	{
+		std::cout << "Failed to replace " << indexPath << ": " << error.message() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+const ImageInfo* ImageIndex::find(const std::string& path) const
+{
+	auto found = lookup.find(path);
+	return found == lookup.end() ? nullptr : &entries[found->second];
+}
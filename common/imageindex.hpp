@@ -0,0 +1,44 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// What a scan learned about one file. Files that aren't images are kept
+// too, with no channels, so that re-scans don't read them again
+struct ImageInfo
+{
+	std::string path;
+	int64_t modified = 0;
+	uint64_t size = 0;
+	int width = 0;
+	int height = 0;
+	int channels = 0;
+	int bitsPerChannel = 0;
+	bool hdr = false;
+
+	bool isImage() const { return channels > 0; }
+};
+
+// Image metadata for directory trees, saved to disk keyed by path,
+// modification time and size so that re-scans only stat unchanged files
+class ImageIndex
+{
+public:
+	// Loads the index at indexPath, if there is one
+	ImageIndex(const char* indexPath);
+
+	// Walks the directory recursively, probing new and changed files on
+	// numThreads threads (0 for one per core) and forgetting deleted ones.
+	// Returns the number of files probed
+	int scan(const char* directory, int numThreads = 0);
+	bool save() const;
+
+	const ImageInfo* find(const std::string& path) const;
+	const std::vector<ImageInfo>& files() const { return entries; }
+
+private:
+	std::string indexPath;
+	std::vector<ImageInfo> entries;
+	std::unordered_map<std::string, size_t> lookup;
+};
@@ -0,0 +1,183 @@
+﻿#include <iostream>
+#include <glad/glad.h>
+
+#include "JpegDecoder.hpp"
+#include "../stb_image.h"
+
+// Creates a texture without mipmaps for one of the passes to read or write
+GLuint CreatePassTexture(GLenum internalFormat, GLenum format, GLenum type, int width, int height, const void* data, GLint filter)
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, data);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	return texture;
+}
+
+JpegDecoder::JpegDecoder() :
+	rowPass("shaders/FullscreenVertexShader.glsl", "shaders/JpegRowIdctFragmentShader.glsl"),
+	columnPass("shaders/FullscreenVertexShader.glsl", "shaders/JpegColumnIdctFragmentShader.glsl"),
+	colorPass("shaders/FullscreenVertexShader.glsl", "shaders/JpegColorFragmentShader.glsl")
+{
+	// The fullscreen triangle has no attributes, but core profile still
+	// needs a vertex array bound to draw
+	glGenVertexArrays(1, &VAO);
+	glGenFramebuffers(1, &framebuffer);
+
+	rowPass.use();
+	rowPass.setInt("coefficients", 0);
+	columnPass.use();
+	columnPass.setInt("rows", 0);
+	colorPass.use();
+	colorPass.setInt("planeY", 0);
+	colorPass.setInt("planeCb", 1);
+	colorPass.setInt("planeCr", 2);
+	glUseProgram(0);
+}
+
+JpegDecoder::~JpegDecoder()
+{
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteVertexArrays(1, &VAO);
+	glDeleteProgram(rowPass.ID);
+	glDeleteProgram(columnPass.ID);
+	glDeleteProgram(colorPass.ID);
+}
+
+bool JpegDecoder::draw(GLuint target, int width, int height)
+{
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		return false;
+	}
+	glViewport(0, 0, width, height);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	return true;
+}
+
+GLuint JpegDecoder::load(const char* path)
+{
+	if (!rowPass.ID || !columnPass.ID || !colorPass.ID)
+	{
+		return 0;
+	}
+	stbi_jpeg_coefficients* jpeg = stbi_load_jpeg_coefficients(path);
+	if (!jpeg)
+	{
+		return 0;
+	}
+
+	// Everything the passes change is put back afterwards
+	GLint viewport[4], previousFramebuffer, previousProgram, previousVAO;
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVAO);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glBindVertexArray(VAO);
+
+	// A sampler bound to a unit the passes read from would override the
+	// filtering their textures set
+	GLint previousSamplers[3];
+	for (int i = 2; i >= 0; i--)
+	{
+		glActiveTexture(GL_TEXTURE0 + i);
+		glGetIntegerv(GL_SAMPLER_BINDING, &previousSamplers[i]);
+		glBindSampler(i, 0);
+	}
+
+	// Each plane goes through the IDCT at its stored resolution
+	bool success = true;
+	GLuint planes[3] = { 0, 0, 0 };
+	for (int i = 0; i < jpeg->n && success; i++)
+	{
+		const stbi_jpeg_plane& plane = jpeg->plane[i];
+		GLuint coefficients = CreatePassTexture(GL_R16I, GL_RED_INTEGER, GL_SHORT, plane.coeff_w, plane.coeff_h, plane.coeff, GL_NEAREST);
+		GLuint rows = CreatePassTexture(GL_R32F, GL_RED, GL_FLOAT, plane.coeff_w, plane.coeff_h, NULL, GL_NEAREST);
+		planes[i] = CreatePassTexture(GL_R8, GL_RED, GL_UNSIGNED_BYTE, plane.coeff_w, plane.coeff_h, NULL, GL_LINEAR);
+
+		float quant[64];
+		for (int j = 0; j < 64; j++)
+		{
+			quant[j] = plane.quant[j];
+		}
+		rowPass.use();
+		glUniform1fv(glGetUniformLocation(rowPass.ID, "quant"), 64, quant);
+		glBindTexture(GL_TEXTURE_2D, coefficients);
+		success = draw(rows, plane.coeff_w, plane.coeff_h);
+
+		columnPass.use();
+		glBindTexture(GL_TEXTURE_2D, rows);
+		success = success && draw(planes[i], plane.coeff_w, plane.coeff_h);
+
+		glDeleteTextures(1, &coefficients);
+		glDeleteTextures(1, &rows);
+	}
+
+	// Upsample, convert and write the image out
+	GLuint texture = 0;
+	if (success)
+	{
+		texture = CreatePassTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, jpeg->x, jpeg->y, NULL, GL_LINEAR);
+		colorPass.use();
+		float scales[6], sizes[6];
+		for (int i = 0; i < jpeg->n; i++)
+		{
+			scales[i * 2] = (float)jpeg->plane[i].h_samp / jpeg->h_max;
+			scales[i * 2 + 1] = (float)jpeg->plane[i].v_samp / jpeg->v_max;
+			sizes[i * 2] = (float)jpeg->plane[i].w;
+			sizes[i * 2 + 1] = (float)jpeg->plane[i].h;
+		}
+		glUniform2fv(glGetUniformLocation(colorPass.ID, "planeScale"), jpeg->n, scales);
+		glUniform2fv(glGetUniformLocation(colorPass.ID, "planeSize"), jpeg->n, sizes);
+		colorPass.setFloat("imageHeight", (float)jpeg->y);
+		colorPass.setBool("flip", jpeg->flip != 0);
+		colorPass.setBool("grayscale", jpeg->n == 1);
+		for (int i = 0; i < jpeg->n; i++)
+		{
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(GL_TEXTURE_2D, planes[i]);
+		}
+		success = draw(texture, jpeg->x, jpeg->y);
+		for (int i = jpeg->n - 1; i >= 0; i--)
+		{
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(GL_TEXTURE_2D, 0);
+		}
+	}
+	if (success)
+	{
+		// Mipmaps are made from the decoded image, with a mipmapped minifying
+		// filter for anything that samples it without a sampler bound
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
+		glGenerateMipmap(GL_TEXTURE_2D);
+	}
+	else
+	{
+		std::cout << "Failed to decode JPEG on the GPU: " << path << std::endl;
+		glDeleteTextures(1, &texture);
+		texture = 0;
+	}
+
+	// Cleanup
+	glDeleteTextures(3, planes);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+	glBindVertexArray(previousVAO);
+	glUseProgram(previousProgram);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	for (int i = 0; i < 3; i++)
+	{
+		glBindSampler(i, previousSamplers[i]);
+	}
+	stbi_image_free(jpeg);
+
+	return texture;
+}
@@ -0,0 +1,31 @@
+﻿#pragma once
+#include <glad/glad.h>
+
+#include "Shader.hpp"
+
+// Turns JPEGs into RGBA textures with only the entropy decoding done on the
+// CPU. The quantized coefficients are uploaded as integer textures and the
+// dequantization, IDCT, chroma upsampling and color conversion run as
+// fragment passes. Needs the OpenGL 3.3 context current whenever it's used
+class JpegDecoder
+{
+public:
+	JpegDecoder();
+	~JpegDecoder();
+	JpegDecoder(const JpegDecoder&) = delete;
+	JpegDecoder& operator=(const JpegDecoder&) = delete;
+
+	// Returns a mipmapped RGBA texture, flipped if stbi_set_flip_vertically_on_load
+	// is set, or 0 for anything that should go through TextureStreamer instead:
+	// other formats, RGB or CMYK JPEGs, and files that fail to decode
+	GLuint load(const char* path);
+
+private:
+	Shader rowPass;
+	Shader columnPass;
+	Shader colorPass;
+	GLuint VAO;
+	GLuint framebuffer;
+
+	bool draw(GLuint target, int width, int height);
+};
@@ -0,0 +1,24 @@
+﻿#pragma once
+#include <cstddef>
+
+// A whole file mapped read-only into memory, for as long as this lives
+class MappedFile
+{
+public:
+	MappedFile(const char* path);
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Null if the file couldn't be opened or is empty
+	const unsigned char* data() const { return bytes; }
+	size_t size() const { return length; }
+
+private:
+	const unsigned char* bytes = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#endif
+};
@@ -0,0 +1,315 @@
+﻿#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIP_SSE2
+#endif
+
+#include "MipGenerator.hpp"
+
+const double PI = 3.14159265358979323846;
+// Rows of the smaller level a thread takes at a time
+const int ROWS_PER_BAND = 16;
+
+double Sinc(double x)
+{
+	return x == 0.0 ? 1.0 : std::sin(PI * x) / (PI * x);
+}
+
+// Modified Bessel function of the first kind, order 0, by its power series
+double BesselI0(double x)
+{
+	double sum = 1.0, term = 1.0;
+	for (int k = 1; term > sum * 1e-12; k++)
+	{
+		double half = x / (2.0 * k);
+		term *= half * half;
+		sum += term;
+	}
+	return sum;
+}
+
+// How far the filter reaches, in texels of the smaller level
+double FilterRadius(MipFilter filter)
+{
+	return filter == MipFilter::Box ? 0.5 : 3.0;
+}
+
+double FilterWeight(MipFilter filter, double x)
+{
+	const double KAISER_ALPHA = 4.0;
+	x = std::fabs(x);
+	switch (filter)
+	{
+	case MipFilter::Box:
+		return x <= 0.5 ? 1.0 : 0.0;
+	case MipFilter::Kaiser:
+		if (x >= 3.0) return 0.0;
+		return Sinc(x) * BesselI0(KAISER_ALPHA * std::sqrt(1.0 - x * x / 9.0)) / BesselI0(KAISER_ALPHA);
+	default:
+		return x < 3.0 ? Sinc(x) * Sinc(x / 3.0) : 0.0;
+	}
+}
+
+// The texels along an axis of the larger level that each texel of the
+// smaller one is filtered from, clamped to the edge, and their weights.
+// Every texel has the same number of taps, padded with zero weights
+struct Taps
+{
+	int size;
+	std::vector<int> source;
+	std::vector<float> weights;
+};
+
+Taps BuildTaps(MipFilter filter, int srcSize, int dstSize)
+{
+	Taps taps;
+	double scale = (double)srcSize / dstSize;
+	double support = FilterRadius(filter) * scale;
+	taps.size = (int)std::ceil(support * 2.0) + 2;
+	taps.source.resize((size_t)dstSize * taps.size);
+	taps.weights.resize((size_t)dstSize * taps.size);
+	std::vector<double> weights(taps.size);
+	for (int x = 0; x < dstSize; x++)
+	{
+		double center = (x + 0.5) * scale;
+		int first = (int)std::floor(center - support);
+		double total = 0.0;
+		for (int k = 0; k < taps.size; k++)
+		{
+			weights[k] = FilterWeight(filter, (first + k + 0.5 - center) / scale);
+			total += weights[k];
+		}
+		for (int k = 0; k < taps.size; k++)
+		{
+			taps.source[(size_t)x * taps.size + k] = std::clamp(first + k, 0, srcSize - 1);
+			taps.weights[(size_t)x * taps.size + k] = (float)(weights[k] / total);
+		}
+	}
+	return taps;
+}
+
+// Bytes to linear values, and the linear values halfway between each sRGB
+// byte and the next, for encoding to whichever byte is nearest in linear
+// light
+struct ConversionTables
+{
+	float linear[256];
+	float srgbToLinear[256];
+	float srgbMidpoints[255];
+};
+
+const ConversionTables& Tables()
+{
+	static const ConversionTables tables = []()
+	{
+		ConversionTables t;
+		for (int i = 0; i < 256; i++)
+		{
+			double v = i / 255.0;
+			t.linear[i] = (float)v;
+			t.srgbToLinear[i] = (float)(v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4));
+		}
+		for (int i = 0; i < 255; i++)
+		{
+			t.srgbMidpoints[i] = (t.srgbToLinear[i] + t.srgbToLinear[i + 1]) * 0.5f;
+		}
+		return t;
+	}();
+	return tables;
+}
+
+unsigned char EncodeSRGB(float value, const float* midpoints)
+{
+	int lo = 0, hi = 255;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (value > midpoints[mid])
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	return (unsigned char)lo;
+}
+
+// Adds weight times 4 * count floats of src onto dst
+void Accumulate(float* dst, const float* src, float weight, size_t count)
+{
+#ifdef MIP_SSE2
+	__m128 w = _mm_set1_ps(weight);
+	for (size_t i = 0; i < count; i++)
+	{
+		_mm_storeu_ps(dst + i * 4, _mm_add_ps(_mm_loadu_ps(dst + i * 4), _mm_mul_ps(w, _mm_loadu_ps(src + i * 4))));
+	}
+#else
+	for (size_t i = 0; i < count * 4; i++)
+	{
+		dst[i] += weight * src[i];
+	}
+#endif
+}
+
+// Decodes a row of the larger level to four floats a texel and filters it
+// across into a row of the smaller one
+void FilterRow(const unsigned char* src, int channels, const float* const decode[4], const Taps& columns, int dstWidth,
+	std::vector<float>& decoded, float* out)
+{
+	size_t srcWidth = decoded.size() / 4;
+	for (size_t x = 0; x < srcWidth; x++)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			decoded[x * 4 + c] = c < channels ? decode[c][src[x * channels + c]] : 0.0f;
+		}
+	}
+	for (int x = 0; x < dstWidth; x++)
+	{
+		const int* source = &columns.source[(size_t)x * columns.size];
+		const float* weights = &columns.weights[(size_t)x * columns.size];
+#ifdef MIP_SSE2
+		__m128 sum = _mm_setzero_ps();
+		for (int k = 0; k < columns.size; k++)
+		{
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(&decoded[(size_t)source[k] * 4])));
+		}
+		_mm_storeu_ps(out + (size_t)x * 4, sum);
+#else
+		float sum[4] = {};
+		for (int k = 0; k < columns.size; k++)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				sum[c] += weights[k] * decoded[(size_t)source[k] * 4 + c];
+			}
+		}
+		std::copy(sum, sum + 4, out + (size_t)x * 4);
+#endif
+	}
+}
+
+// Filters one level down into the next, separably: rows of the larger
+// level are filtered across as they're needed and kept in a ring, then
+// summed down into each row of the smaller one
+void HalveLevel(const unsigned char* src, int srcWidth, int srcHeight, unsigned char* dst, int dstWidth, int dstHeight,
+	int channels, MipFilter filter, bool srgb, int numThreads)
+{
+	const ConversionTables& tables = Tables();
+	bool color = srgb && channels >= 3;
+	const float* decode[4] = {
+		color ? tables.srgbToLinear : tables.linear,
+		color ? tables.srgbToLinear : tables.linear,
+		color ? tables.srgbToLinear : tables.linear,
+		tables.linear,
+	};
+	Taps columns = BuildTaps(filter, srcWidth, dstWidth);
+	Taps rows = BuildTaps(filter, srcHeight, dstHeight);
+	int bands = (dstHeight + ROWS_PER_BAND - 1) / ROWS_PER_BAND;
+
+	std::atomic<int> next(0);
+	auto work = [&]()
+	{
+		// A row's taps are consecutive rows, so a ring as long as the taps
+		// holds them all without any overwriting another
+		std::vector<float> ring((size_t)rows.size * dstWidth * 4);
+		std::vector<int> ringRows(rows.size, -1);
+		std::vector<float> decoded((size_t)srcWidth * 4);
+		std::vector<float> sum((size_t)dstWidth * 4);
+		for (int band = next++; band < bands; band = next++)
+		{
+			int end = std::min(dstHeight, (band + 1) * ROWS_PER_BAND);
+			for (int y = band * ROWS_PER_BAND; y < end; y++)
+			{
+				std::fill(sum.begin(), sum.end(), 0.0f);
+				for (int k = 0; k < rows.size; k++)
+				{
+					float weight = rows.weights[(size_t)y * rows.size + k];
+					if (weight == 0.0f) continue;
+					int row = rows.source[(size_t)y * rows.size + k];
+					float* filtered = &ring[(size_t)(row % rows.size) * dstWidth * 4];
+					if (ringRows[row % rows.size] != row)
+					{
+						FilterRow(src + (size_t)row * srcWidth * channels, channels, decode, columns, dstWidth, decoded, filtered);
+						ringRows[row % rows.size] = row;
+					}
+					Accumulate(sum.data(), filtered, weight, dstWidth);
+				}
+
+				// Sharper filters can overshoot, so clamp before encoding
+				unsigned char* out = dst + (size_t)y * dstWidth * channels;
+				for (int x = 0; x < dstWidth; x++)
+				{
+					for (int c = 0; c < channels; c++)
+					{
+						float value = std::clamp(sum[(size_t)x * 4 + c], 0.0f, 1.0f);
+						out[(size_t)x * channels + c] = color && c < 3
+							? EncodeSRGB(value, tables.srgbMidpoints)
+							: (unsigned char)(value * 255.0f + 0.5f);
+					}
+				}
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int i = 1; i < std::min(numThreads, bands); i++)
+	{
+		threads.emplace_back(work);
+	}
+	work();
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+int MipLevels(int width, int height)
+{
+	int levels = 1;
+	while (width > 1 || height > 1)
+	{
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+		levels++;
+	}
+	return levels;
+}
+
+size_t MipChainSize(int width, int height, int channels)
+{
+	size_t size = 0;
+	for (;;)
+	{
+		size += (size_t)width * height * channels;
+		if (width == 1 && height == 1) break;
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+	}
+	return size;
+}
+
+void GenerateMips(unsigned char* chain, int width, int height, int channels, MipFilter filter, bool srgb, int numThreads)
+{
+	if (numThreads <= 0)
+	{
+		numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	unsigned char* level = chain;
+	while (width > 1 || height > 1)
+	{
+		int halfWidth = std::max(1, width / 2);
+		int halfHeight = std::max(1, height / 2);
+		unsigned char* half = level + (size_t)width * height * channels;
+		HalveLevel(level, width, height, half, halfWidth, halfHeight, channels, filter, srgb, numThreads);
+		level = half;
+		width = halfWidth;
+		height = halfHeight;
+	}
+}
@@ -0,0 +1,30 @@
+﻿#pragma once
+#include <cstddef>
+
+// Filters for halving a level. Box averages the texels each one covers,
+// Kaiser and Lanczos are windowed sincs over three texels of the smaller
+// level either side, which keep detail the box blurs at some risk of ringing
+enum class MipFilter
+{
+	Box,
+	Kaiser,
+	Lanczos,
+};
+
+// Levels in a full chain down to 1x1
+int MipLevels(int width, int height);
+
+// Bytes of a chain of tightly packed levels laid one after another
+size_t MipChainSize(int width, int height, int channels);
+
+// Fills in every level after the first of a chain that starts with level 0,
+// filtering each from the one before. With srgb set, RGB channels are
+// decoded to linear light before filtering and encoded after, while alpha
+// and images with fewer channels are filtered as they are. Rows of each
+// level are split across numThreads threads (0 for one per core)
+void GenerateMips(unsigned char* chain, int width, int height, int channels, MipFilter filter, bool srgb, int numThreads = 1);
+
+// Filters one level into the next, as GenerateMips does for each level, for
+// when the levels aren't laid out as a chain
+void HalveLevel(const unsigned char* src, int srcWidth, int srcHeight, unsigned char* dst, int dstWidth, int dstHeight,
+	int channels, MipFilter filter, bool srgb, int numThreads = 1);
@@ -0,0 +1,82 @@
+﻿#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "GLCaps.hpp"
+#include "SamplerCache.hpp"
+
+// Folds a 32 bit value into a running hash
+uint64_t HashCombine(uint64_t h, uint32_t value)
+{
+	h = (h ^ value) * 0x100000001b3ull;
+	return h ^ (h >> 29);
+}
+
+uint32_t FloatBits(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+bool SamplerDesc::operator==(const SamplerDesc& other) const
+{
+	return wrapS == other.wrapS && wrapT == other.wrapT && minFilter == other.minFilter && magFilter == other.magFilter &&
+		anisotropy == other.anisotropy && lodBias == other.lodBias && memcmp(borderColor, other.borderColor, sizeof(borderColor)) == 0;
+}
+
+size_t SamplerCache::Hash::operator()(const SamplerDesc& desc) const
+{
+	uint64_t h = 0xcbf29ce484222325ull;
+	h = HashCombine(h, desc.wrapS);
+	h = HashCombine(h, desc.wrapT);
+	h = HashCombine(h, desc.minFilter);
+	h = HashCombine(h, desc.magFilter);
+	h = HashCombine(h, FloatBits(desc.anisotropy));
+	h = HashCombine(h, FloatBits(desc.lodBias));
+	for (float channel : desc.borderColor)
+	{
+		h = HashCombine(h, FloatBits(channel));
+	}
+	return (size_t)h;
+}
+
+SamplerCache::SamplerCache()
+{
+	if (HasExtension("GL_EXT_texture_filter_anisotropic") || HasExtension("GL_ARB_texture_filter_anisotropic"))
+	{
+		glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAnisotropy);
+	}
+}
+
+SamplerCache::~SamplerCache()
+{
+	for (const auto& entry : samplers)
+	{
+		glDeleteSamplers(1, &entry.second);
+	}
+}
+
+GLuint SamplerCache::get(const SamplerDesc& desc)
+{
+	auto found = samplers.find(desc);
+	if (found != samplers.end())
+	{
+		return found->second;
+	}
+
+	GLuint sampler;
+	glGenSamplers(1, &sampler);
+	glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, desc.wrapS);
+	glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, desc.wrapT);
+	glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, desc.minFilter);
+	glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, desc.magFilter);
+	glSamplerParameterf(sampler, GL_TEXTURE_LOD_BIAS, desc.lodBias);
+	glSamplerParameterfv(sampler, GL_TEXTURE_BORDER_COLOR, desc.borderColor);
+	if (maxAnisotropy > 1.0f)
+	{
+		glSamplerParameterf(sampler, GL_TEXTURE_MAX_ANISOTROPY_EXT, std::min(std::max(desc.anisotropy, 1.0f), maxAnisotropy));
+	}
+	samplers[desc] = sampler;
+	return sampler;
+}
@@ -0,0 +1,53 @@
+﻿#pragma once
+#include <cstddef>
+#include <unordered_map>
+#include <glad/glad.h>
+
+// How a texture is sampled, kept apart from the texture so that any number
+// of textures can share the sampler object made for it
+struct SamplerDesc
+{
+	GLenum wrapS = GL_REPEAT;
+	GLenum wrapT = GL_REPEAT;
+	GLenum minFilter = GL_LINEAR_MIPMAP_LINEAR;
+	GLenum magFilter = GL_LINEAR;
+	float anisotropy = 1.0f;
+	float lodBias = 0.0f;
+	// Only used with GL_CLAMP_TO_BORDER
+	float borderColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+	bool operator==(const SamplerDesc& other) const;
+};
+
+// Makes one sampler object per distinct SamplerDesc and hands the same one
+// back every time it's asked for again. Binding a sampler to a unit
+// overrides the sampling state of whatever texture is bound there, so
+// switching samplers never needs a texture rebound. Needs the OpenGL 3.3
+// context current
+class SamplerCache
+{
+public:
+	SamplerCache();
+	~SamplerCache();
+	SamplerCache(const SamplerCache&) = delete;
+	SamplerCache& operator=(const SamplerCache&) = delete;
+
+	// The sampler for desc, made the first time it's asked for. Anisotropy
+	// is clamped to what the driver allows, and ignored without
+	// EXT_texture_filter_anisotropic
+	GLuint get(const SamplerDesc& desc);
+
+	// Binds the sampler for desc to a texture unit, counting from 0
+	void bind(GLuint unit, const SamplerDesc& desc) { glBindSampler(unit, get(desc)); }
+
+	size_t size() const { return samplers.size(); }
+
+private:
+	struct Hash
+	{
+		size_t operator()(const SamplerDesc& desc) const;
+	};
+
+	float maxAnisotropy = 1.0f;
+	std::unordered_map<SamplerDesc, GLuint, Hash> samplers;
+};
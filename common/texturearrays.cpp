@@ -0,0 +1,85 @@
+﻿#include <algorithm>
+#include <iostream>
+
+#include "MipGenerator.hpp"
+#include "TextureArrays.hpp"
+#include "TextureFormat.hpp"
+#include "../stb_image.h"
+
+TextureArrays::TextureArrays(int layersPerArray)
+{
+	GLint maxLayers = 0;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+	this->layersPerArray = std::max(1, std::min(layersPerArray, (int)maxLayers));
+}
+
+TextureArrays::~TextureArrays()
+{
+	for (const Array& array : arrays)
+	{
+		glDeleteTextures(1, &array.texture);
+	}
+}
+
+TextureArrays::Handle TextureArrays::add(const char* path, GLenum format)
+{
+	int width, height;
+	unsigned char* pixels = stbi_load(path, &width, &height, nullptr, FormatChannels(format));
+	if (!pixels)
+	{
+		std::cout << "Failed to load texture: " << path << std::endl;
+		return { 0, 0 };
+	}
+	Handle handle = add(pixels, width, height, format);
+	stbi_image_free(pixels);
+	return handle;
+}
+
+TextureArrays::Handle TextureArrays::add(const unsigned char* pixels, int width, int height, GLenum format)
+{
+	TextureFormat textureFormat = NegotiateFormat(FormatChannels(format));
+	uint64_t key = ((uint64_t)width << 40) | ((uint64_t)height << 16) | (format & 0xffff);
+	auto found = groups.find(key);
+	if (found == groups.end() || arrays[found->second].layers == layersPerArray)
+	{
+		Array array = { 0, 0, false };
+		int levels = MipLevels(width, height);
+		glGenTextures(1, &array.texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+		if (!AllocateArrayStorage(textureFormat.internalFormat, width, height, layersPerArray, levels))
+		{
+			for (int i = 0; i < levels; i++)
+			{
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, i, textureFormat.internalFormat, std::max(1, width >> i), std::max(1, height >> i),
+					layersPerArray, 0, textureFormat.format, textureFormat.type, nullptr);
+			}
+		}
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+		groups[key] = arrays.size();
+		arrays.push_back(array);
+		found = groups.find(key);
+	}
+
+	Array& array = arrays[found->second];
+	glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, UnpackAlignment((size_t)width * textureFormat.bytesPerPixel));
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, array.layers, width, height, 1, textureFormat.format, textureFormat.type, pixels);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	array.dirty = true;
+	return { array.texture, array.layers++ };
+}
+
+void TextureArrays::update()
+{
+	for (Array& array : arrays)
+	{
+		if (array.dirty)
+		{
+			glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+			glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+			array.dirty = false;
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
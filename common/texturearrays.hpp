@@ -0,0 +1,54 @@
+﻿#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <glad/glad.h>
+
+// Groups images of the same size and format into GL_TEXTURE_2D_ARRAY
+// textures, so that everything drawn from a group needs one bind and the
+// shader picks a layer by index instead (see
+// shaders/ArrayFragmentShader.glsl). A group gets another array once its
+// last one is full. Needs the OpenGL 3.3 context current
+class TextureArrays
+{
+public:
+	// Where an image ended up. An array of 0 means it failed to load
+	struct Handle
+	{
+		GLuint array;
+		int layer;
+	};
+
+	// Arrays hold up to layersPerArray layers, fewer if the driver's limit
+	// is lower. Each is allocated in full up front
+	TextureArrays(int layersPerArray = 16);
+	~TextureArrays();
+	TextureArrays(const TextureArrays&) = delete;
+	TextureArrays& operator=(const TextureArrays&) = delete;
+
+	// format is GL_RED, GL_RG, GL_RGB or GL_RGBA and picks the channels to
+	// decode. The image is flipped if stbi_set_flip_vertically_on_load is set
+	Handle add(const char* path, GLenum format);
+	// Adds tightly packed pixels with the channels format has, uploading
+	// them straight away
+	Handle add(const unsigned char* pixels, int width, int height, GLenum format);
+
+	// Rebuilds the mipmaps of arrays that have had layers added. Call it
+	// before drawing from them
+	void update();
+
+	// Array textures made so far, counting every group
+	size_t size() const { return arrays.size(); }
+
+private:
+	struct Array
+	{
+		GLuint texture;
+		int layers;
+		bool dirty;
+	};
+
+	int layersPerArray;
+	std::vector<Array> arrays;
+	std::unordered_map<uint64_t, size_t> groups; // the last array of each
+};
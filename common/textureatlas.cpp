@@ -0,0 +1,209 @@
+﻿#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <iostream>
+
+#include "TextureAtlas.hpp"
+#include "TextureFormat.hpp"
+#include "../stb_image.h"
+
+TextureAtlas::TextureAtlas(int pageSize, int padding) :
+	pageSize(pageSize)
+{
+	this->padding = 1;
+	levels = 1;
+	while (this->padding < padding)
+	{
+		this->padding *= 2;
+		levels++;
+	}
+}
+
+TextureAtlas::~TextureAtlas()
+{
+	for (const Page& page : pages)
+	{
+		glDeleteTextures(1, &page.texture);
+	}
+}
+
+int TextureAtlas::add(const char* path)
+{
+	int width, height;
+	unsigned char* pixels = stbi_load(path, &width, &height, nullptr, 4);
+	if (!pixels)
+	{
+		std::cout << "Failed to load texture: " << path << std::endl;
+		return -1;
+	}
+	int index = add(pixels, width, height);
+	stbi_image_free(pixels);
+	return index;
+}
+
+int TextureAtlas::add(const unsigned char* pixels, int width, int height)
+{
+	// Cells are rounded up to a multiple of the padding so the next one
+	// starts aligned too
+	int cellWidth = (width + 2 * padding + padding - 1) & ~(padding - 1);
+	int cellHeight = (height + 2 * padding + padding - 1) & ~(padding - 1);
+	if (cellWidth > pageSize || cellHeight > pageSize)
+	{
+		return -1;
+	}
+	int x, y;
+	size_t pageIndex = 0;
+	while (pageIndex < pages.size() && !place(pages[pageIndex], cellWidth, cellHeight, x, y))
+	{
+		pageIndex++;
+	}
+	if (pageIndex == pages.size())
+	{
+		addPage();
+		place(pages.back(), cellWidth, cellHeight, x, y);
+	}
+
+	// Every texel of the cell outside the image copies the nearest edge
+	std::vector<unsigned char> cell((size_t)cellWidth * cellHeight * 4);
+	for (int cy = 0; cy < cellHeight; cy++)
+	{
+		int sy = std::min(std::max(cy - padding, 0), height - 1);
+		const unsigned char* source = pixels + (size_t)sy * width * 4;
+		unsigned char* row = &cell[(size_t)cy * cellWidth * 4];
+		for (int cx = 0; cx < padding; cx++)
+		{
+			memcpy(row + cx * 4, source, 4);
+		}
+		memcpy(row + padding * 4, source, (size_t)width * 4);
+		for (int cx = padding + width; cx < cellWidth; cx++)
+		{
+			memcpy(row + cx * 4, source + (width - 1) * 4, 4);
+		}
+	}
+	Page& page = pages[pageIndex];
+	glBindTexture(GL_TEXTURE_2D, page.texture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, cellWidth, cellHeight, GL_RGBA, GL_UNSIGNED_BYTE, cell.data());
+	glBindTexture(GL_TEXTURE_2D, 0);
+	page.dirty = true;
+
+	Entry entry;
+	entry.page = (int)pageIndex;
+	entry.x = x + padding;
+	entry.y = y + padding;
+	entry.width = width;
+	entry.height = height;
+	entry.u0 = (float)entry.x / pageSize;
+	entry.v0 = (float)entry.y / pageSize;
+	entry.u1 = (float)(entry.x + width) / pageSize;
+	entry.v1 = (float)(entry.y + height) / pageSize;
+	entries.push_back(entry);
+	return (int)entries.size() - 1;
+}
+
+void TextureAtlas::update()
+{
+	for (Page& page : pages)
+	{
+		if (page.dirty)
+		{
+			glBindTexture(GL_TEXTURE_2D, page.texture);
+			glGenerateMipmap(GL_TEXTURE_2D);
+			page.dirty = false;
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Finds the lowest spot on a skyline for a width x height rect, breaking
+// ties on the narrowest node so gaps get filled. Returns the node it starts
+// at, or -1 if it doesn't fit
+int TextureAtlas::findPosition(const Page& page, int width, int height, int& bestY) const
+{
+	const std::vector<SkylineNode>& skyline = page.skyline;
+	int best = -1;
+	int bestWidth = INT_MAX;
+	bestY = INT_MAX;
+	for (size_t i = 0; i < skyline.size(); i++)
+	{
+		if (skyline[i].x + width > pageSize)
+		{
+			break;
+		}
+
+		// The rect rests on the highest node it spans
+		int y = 0;
+		for (size_t j = i, covered = 0; covered < (size_t)width; covered += skyline[j].width, j++)
+		{
+			y = std::max(y, skyline[j].y);
+		}
+		if (y + height <= pageSize && (y < bestY || (y == bestY && skyline[i].width < bestWidth)))
+		{
+			best = (int)i;
+			bestY = y;
+			bestWidth = skyline[i].width;
+		}
+	}
+	return best;
+}
+
+bool TextureAtlas::place(Page& page, int width, int height, int& x, int& y)
+{
+	int index = findPosition(page, width, height, y);
+	if (index < 0)
+	{
+		return false;
+	}
+	x = page.skyline[index].x;
+
+	// Raise the skyline over the cell, trimming the nodes it covers
+	SkylineNode node = { x, y + height, width };
+	page.skyline.insert(page.skyline.begin() + index, node);
+	for (size_t i = index + 1; i < page.skyline.size();)
+	{
+		int overlap = node.x + node.width - page.skyline[i].x;
+		if (overlap <= 0)
+		{
+			break;
+		}
+		page.skyline[i].x += overlap;
+		page.skyline[i].width -= overlap;
+		if (page.skyline[i].width > 0)
+		{
+			break;
+		}
+		page.skyline.erase(page.skyline.begin() + i);
+	}
+	for (size_t i = 0; i + 1 < page.skyline.size();)
+	{
+		if (page.skyline[i].y == page.skyline[i + 1].y)
+		{
+			page.skyline[i].width += page.skyline[i + 1].width;
+			page.skyline.erase(page.skyline.begin() + i + 1);
+		}
+		else
+		{
+			i++;
+		}
+	}
+	return true;
+}
+
+void TextureAtlas::addPage()
+{
+	Page page;
+	page.skyline.push_back({ 0, 0, pageSize });
+	TextureFormat format = NegotiateFormat(4);
+	glGenTextures(1, &page.texture);
+	glBindTexture(GL_TEXTURE_2D, page.texture);
+	if (!AllocateStorage(format.internalFormat, pageSize, pageSize, levels))
+	{
+		for (int i = 0; i < levels; i++)
+		{
+			int size = std::max(1, pageSize >> i);
+			UploadLevel(false, i, format.internalFormat, size, size, format.format, format.type, nullptr, 0);
+		}
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	pages.push_back(page);
+}
@@ -0,0 +1,76 @@
+﻿#pragma once
+#include <vector>
+#include <glad/glad.h>
+
+// Packs small images into shared RGBA pages so they can be drawn from one
+// texture. Each page is filled by a skyline packer, placing every image
+// where it rests lowest. Images sit in cells padded with copies of their
+// edge texels, and cells start on multiples of the padding, which keeps the
+// mipmaps of one image from bleeding into its neighbours for as many levels
+// as the padding allows. Needs the OpenGL 3.3 context current
+class TextureAtlas
+{
+public:
+	// Where an image ended up. UVs cover the image without its padding
+	struct Entry
+	{
+		int page;
+		int x;
+		int y;
+		int width;
+		int height;
+		float u0;
+		float v0;
+		float u1;
+		float v1;
+	};
+
+	// padding is rounded up to a power of two, and pages get mipmaps down
+	// to the level where it's a single texel
+	TextureAtlas(int pageSize = 1024, int padding = 4);
+	~TextureAtlas();
+	TextureAtlas(const TextureAtlas&) = delete;
+	TextureAtlas& operator=(const TextureAtlas&) = delete;
+
+	// Decodes the image at path, flipped if stbi_set_flip_vertically_on_load
+	// is set, and adds it. Returns its entry, or -1 if it fails to decode or
+	// is too big for a page
+	int add(const char* path);
+	// Adds tightly packed RGBA pixels, uploading them straight away
+	int add(const unsigned char* pixels, int width, int height);
+
+	// Rebuilds the mipmaps of pages that have had images added. Call it
+	// before drawing from them
+	void update();
+
+	const Entry& entry(int index) const { return entries[index]; }
+	int size() const { return (int)entries.size(); }
+	GLuint texture(int page) const { return pages[page].texture; }
+	int numPages() const { return (int)pages.size(); }
+
+private:
+	// The top edge of the packed area, from x for width texels
+	struct SkylineNode
+	{
+		int x;
+		int y;
+		int width;
+	};
+
+	struct Page
+	{
+		GLuint texture = 0;
+		std::vector<SkylineNode> skyline;
+		bool dirty = false;
+	};
+
+	int findPosition(const Page& page, int width, int height, int& y) const;
+	bool place(Page& page, int width, int height, int& x, int& y);
+	void addPage();
+
+	int pageSize;
+	int padding;
+	int levels;
+	std::vector<Page> pages;
+	std::vector<Entry> entries;
+};
@@ -0,0 +1,445 @@
+﻿#include <algorithm>
+#include <cctype>
+#include <filesystem>
+
+#include "TextureCache.hpp"
+#include "TextureFormat.hpp"
+
+namespace fs = std::filesystem;
+
+// At most this many textures are shrunk or evicted, and this many reloads
+// started, in one update, to spread the cost over frames
+const int MAX_EVICTIONS_PER_FRAME = 4;
+const int MAX_RELOADS_PER_FRAME = 2;
+// Textures that aren't being drawn are shrunk no smaller than this before
+// they're evicted
+const int MIN_DROPPED_WIDTH = 16;
+
+// Bytes of one level of the bound texture, 0 past the last
+size_t LevelBytes(GLint level)
+{
+	GLint width = 0, height = 0, compressed = 0, internalFormat = 0;
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &width);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &height);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED, &compressed);
+	if (width == 0)
+	{
+		return 0;
+	}
+	if (compressed)
+	{
+		GLint size = 0;
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+		return (size_t)size;
+	}
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+	TextureFormat format;
+	int bytesPerPixel = FormatFromInternal(internalFormat, format) ? format.bytesPerPixel : 4;
+	return (size_t)width * height * bytesPerPixel;
+}
+
+// Makes paths absolute and normal, so the same file is found however it's named
+std::string NormalizePath(const char* path)
+{
+	std::error_code error;
+	fs::path normal = fs::absolute(fs::u8path(path), error);
+	if (error)
+	{
+		normal = fs::u8path(path);
+	}
+	std::string key = normal.lexically_normal().generic_u8string();
+#ifdef _WIN32
+	std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+#endif
+	return key;
+}
+
+TextureCache::TextureCache(TextureStreamer& streamer) : streamer(streamer)
+{
+	streamer.setFilter([this](const TextureStreamer::Decoded& image) { return decoded(image); });
+}
+
+TextureCache::~TextureCache()
+{
+	streamer.setFilter(nullptr);
+	for (Entry& entry : entries)
+	{
+		if (entry.refs > 0 && entry.texture)
+		{
+			streamer.cancel(entry.texture);
+			glDeleteTextures(1, &entry.texture);
+		}
+		if (entry.refs > 0 && entry.reload)
+		{
+			streamer.cancel(entry.reload);
+			glDeleteTextures(1, &entry.reload);
+		}
+	}
+	glDeleteTextures(1, &placeholder);
+	glDeleteBuffers(1, &readback);
+}
+
+int TextureCache::acquire(const char* path, GLenum format)
+{
+	std::string key = NormalizePath(path) + "#" + std::to_string(format);
+	auto found = byPath.find(key);
+	if (found != byPath.end())
+	{
+		entries[found->second].refs++;
+		return found->second;
+	}
+
+	int handle;
+	if (unused.empty())
+	{
+		handle = (int)entries.size();
+		entries.emplace_back();
+	}
+	else
+	{
+		handle = unused.back();
+		unused.pop_back();
+		entries[handle] = Entry();
+	}
+	Entry& entry = entries[handle];
+	entry.key = key;
+	entry.refs = 1;
+	entry.path = path;
+	entry.format = format;
+	entry.texture = streamer.load(path, format);
+	byPath[key] = handle;
+	// Baked and container textures are complete already and never pass
+	// through decoded, so only decoding ones wait there to be hashed
+	if (streamer.loading(entry.texture))
+	{
+		byTexture[entry.texture] = handle;
+	}
+	return handle;
+}
+
+void TextureCache::retain(int handle)
+{
+	entries[handle].refs++;
+}
+
+void TextureCache::release(int handle)
+{
+	Entry& entry = entries[handle];
+	if (--entry.refs > 0) return;
+
+	byPath.erase(entry.key);
+	if (entry.shared >= 0)
+	{
+		release(entry.shared);
+	}
+	else
+	{
+		streamer.cancel(entry.texture);
+		byTexture.erase(entry.texture);
+		if (entry.hashed)
+		{
+			byContent.erase(entry.content);
+		}
+		glDeleteTextures(1, &entry.texture);
+		if (entry.reload)
+		{
+			streamer.cancel(entry.reload);
+			glDeleteTextures(1, &entry.reload);
+		}
+		resident -= entry.bytes + entry.reserved;
+	}
+	entry = Entry();
+	unused.push_back(handle);
+}
+
+size_t TextureCache::size() const
+{
+	size_t count = 0;
+	for (const Entry& entry : entries)
+	{
+		if (entry.refs > 0 && entry.shared < 0)
+		{
+			count++;
+		}
+	}
+	return count;
+}
+
+GLuint TextureCache::texture(int handle) const
+{
+	const Entry& entry = entries[handle].shared >= 0 ? entries[entries[handle].shared] : entries[handle];
+	if (entry.texture)
+	{
+		return entry.texture;
+	}
+	return entry.reload ? entry.reload : placeholder;
+}
+
+GLuint TextureCache::use(int handle, float screenSize)
+{
+	Entry& entry = entries[handle].shared >= 0 ? entries[entries[handle].shared] : entries[handle];
+	entry.screenSize = entry.lastUsed == frame ? std::max(entry.screenSize, screenSize) : screenSize;
+	entry.lastUsed = frame;
+	return texture(handle);
+}
+
+void TextureCache::update()
+{
+	// Swap in finished reloads and measure what's arrived
+	for (Entry& entry : entries)
+	{
+		if (entry.refs <= 0 || entry.shared >= 0)
+		{
+			continue;
+		}
+		if (entry.reload && !streamer.loading(entry.reload))
+		{
+			glDeleteTextures(1, &entry.texture);
+			resident -= entry.bytes + entry.reserved;
+			entry.texture = entry.reload;
+			entry.reload = 0;
+			entry.bytes = entry.reserved = 0;
+		}
+		if (entry.texture && !entry.bytes && !streamer.loading(entry.texture))
+		{
+			measure(entry);
+		}
+	}
+	if (budget)
+	{
+		// Anything drawn last frame at a bigger size than it has now is
+		// loaded again, biggest first, once room can be made without
+		// touching anything else that's being drawn
+		std::vector<int> wanted;
+		for (size_t i = 0; i < entries.size(); i++)
+		{
+			const Entry& entry = entries[i];
+			if (entry.refs > 0 && entry.shared < 0 && entry.lastUsed == frame && !entry.reload && entry.fullBytes &&
+				(!entry.texture || (entry.width < entry.fullWidth && entry.screenSize > entry.width)))
+			{
+				wanted.push_back((int)i);
+			}
+		}
+		std::sort(wanted.begin(), wanted.end(), [this](int a, int b) { return entries[a].screenSize > entries[b].screenSize; });
+		for (size_t i = 0; i < wanted.size() && (int)i < MAX_RELOADS_PER_FRAME; i++)
+		{
+			Entry& entry = entries[wanted[i]];
+			size_t needed = entry.fullBytes - entry.bytes;
+			makeRoom(budget > needed ? budget - needed : 0, true);
+			if (resident + needed > budget)
+			{
+				break;
+			}
+			entry.reload = streamer.load(entry.path.c_str(), entry.format);
+			entry.reserved = needed;
+			resident += needed;
+		}
+		makeRoom(budget, false);
+	}
+	frame++;
+}
+
+void TextureCache::measure(Entry& entry)
+{
+	GLint maxLevel = 0;
+	glBindTexture(GL_TEXTURE_2D, entry.texture);
+	glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &entry.width);
+	entry.bytes = 0;
+	for (GLint level = 0; level <= maxLevel; level++)
+	{
+		size_t bytes = LevelBytes(level);
+		if (!bytes)
+		{
+			break;
+		}
+		entry.bytes += bytes;
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	if (entry.bytes > entry.fullBytes)
+	{
+		entry.fullBytes = entry.bytes;
+		entry.fullWidth = entry.width;
+	}
+	resident += entry.bytes;
+}
+
+bool TextureCache::dropTopLevel(Entry& entry)
+{
+	GLint maxLevel = 0, internalFormat = 0, compressed = 0;
+	glBindTexture(GL_TEXTURE_2D, entry.texture);
+	glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+	TextureFormat format = {};
+	struct Level
+	{
+		size_t offset;
+		size_t size;
+		GLint width;
+		GLint height;
+	};
+	std::vector<Level> levels;
+	size_t size = 0;
+	for (GLint level = 1; level <= maxLevel; level++)
+	{
+		Level kept = { size, LevelBytes(level), 0, 0 };
+		if (!kept.size)
+		{
+			break;
+		}
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &kept.width);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &kept.height);
+		levels.push_back(kept);
+		size += kept.size;
+	}
+	if (levels.empty() || (!compressed && !FormatFromInternal(internalFormat, format)))
+	{
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return false;
+	}
+
+	// The levels that stay are copied through a buffer into a new texture
+	// a level shorter, without coming back to the CPU
+	if (!readback)
+	{
+		glGenBuffers(1, &readback);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback);
+	glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_COPY);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	for (size_t i = 0; i < levels.size(); i++)
+	{
+		if (compressed)
+		{
+			glGetCompressedTexImage(GL_TEXTURE_2D, (GLint)i + 1, (void*)levels[i].offset);
+		}
+		else
+		{
+			glGetTexImage(GL_TEXTURE_2D, (GLint)i + 1, format.format, format.type, (void*)levels[i].offset);
+		}
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, readback);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	bool allocated = AllocateStorage(internalFormat, levels[0].width, levels[0].height, (int)levels.size());
+	for (size_t i = 0; i < levels.size(); i++)
+	{
+		const Level& level = levels[i];
+		UploadLevel(allocated, (GLint)i, internalFormat, level.width, level.height, compressed ? 0 : format.format, format.type, (void*)level.offset, level.size);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glDeleteTextures(1, &entry.texture);
+	entry.texture = texture;
+	resident -= entry.bytes - size;
+	entry.bytes = size;
+	entry.width = levels[0].width;
+	return true;
+}
+
+void TextureCache::evict(Entry& entry)
+{
+	// Mid grey stands in until it's loaded again, as it does for the streamer
+	if (!placeholder)
+	{
+		const unsigned char grey[4] = { 128, 128, 128, 255 };
+		glGenTextures(1, &placeholder);
+		glBindTexture(GL_TEXTURE_2D, placeholder);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	glDeleteTextures(1, &entry.texture);
+	entry.texture = 0;
+	resident -= entry.bytes;
+	entry.bytes = 0;
+	entry.width = 0;
+}
+
+void TextureCache::makeRoom(size_t target, bool staleOnly)
+{
+	// Least recently drawn first, and of those the smallest on screen
+	std::vector<int> candidates;
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		const Entry& entry = entries[i];
+		if (entry.refs > 0 && entry.shared < 0 && entry.texture && entry.bytes && !entry.reload &&
+			(!staleOnly || entry.lastUsed < frame))
+		{
+			candidates.push_back((int)i);
+		}
+	}
+	std::sort(candidates.begin(), candidates.end(), [this](int a, int b)
+	{
+		const Entry& first = entries[a];
+		const Entry& second = entries[b];
+		return first.lastUsed != second.lastUsed ? first.lastUsed < second.lastUsed : first.screenSize < second.screenSize;
+	});
+
+	// Shrink first, keeping anything being drawn at least the size it's
+	// drawn at, then evict what isn't being drawn
+	int changes = 0;
+	for (int i : candidates)
+	{
+		Entry& entry = entries[i];
+		bool stale = entry.lastUsed < frame;
+		if (resident <= target || changes == MAX_EVICTIONS_PER_FRAME)
+		{
+			return;
+		}
+		if (entry.width / 2 >= (stale ? MIN_DROPPED_WIDTH : std::max(MIN_DROPPED_WIDTH, (int)entry.screenSize)) && dropTopLevel(entry))
+		{
+			changes++;
+		}
+	}
+	for (int i : candidates)
+	{
+		Entry& entry = entries[i];
+		if (resident <= target || changes == MAX_EVICTIONS_PER_FRAME)
+		{
+			return;
+		}
+		if (entry.lastUsed < frame && entry.texture)
+		{
+			evict(entry);
+			changes++;
+		}
+	}
+}
+
+bool TextureCache::decoded(const TextureStreamer::Decoded& image)
+{
+	auto found = byTexture.find(image.texture);
+	if (found == byTexture.end())
+	{
+		return true; // loaded by someone else
+	}
+	int handle = found->second;
+	byTexture.erase(found);
+
+	// The hash only stands for the pixels at the same size and format
+	uint64_t content = image.hash + (((uint64_t)image.width << 32) | (uint32_t)image.height) * 0x9e3779b97f4a7c15ull + image.format;
+	auto same = byContent.find(content);
+	if (same != byContent.end())
+	{
+		// Share the copy that's already resident, and drop this one's texture
+		Entry& entry = entries[handle];
+		entries[same->second].refs++;
+		entry.shared = same->second;
+		glDeleteTextures(1, &entry.texture);
+		entry.texture = 0;
+		return false;
+	}
+	entries[handle].content = content;
+	entries[handle].hashed = true;
+	byContent[content] = handle;
+	return true;
+}
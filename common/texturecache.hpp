@@ -0,0 +1,96 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glad/glad.h>
+
+#include "TextureStreamer.hpp"
+
+// Shares textures between everything that asks for the same image. Requests
+// are matched by normalized path and format, and once an image has decoded,
+// by a hash of its pixels, so that a copy under another name shares the
+// texture that's already resident instead of uploading its own. Handles are
+// refcounted, and a texture is deleted along with its last handle. With a
+// budget set, the cache also keeps the texture memory it holds under it,
+// first by dropping the top mip levels of textures that haven't been drawn
+// lately, then by evicting them, and loads them again when they're drawn
+// bigger than what's left. Used from the render thread, like the streamer
+// it loads through
+class TextureCache
+{
+public:
+	TextureCache(TextureStreamer& streamer);
+	~TextureCache();
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	// Returns a handle to the image at path in format, as for
+	// TextureStreamer::load, loading it if nothing holds it already. Every
+	// acquire needs a matching release
+	int acquire(const char* path, GLenum format);
+	// Adds a reference to a handle that's already held
+	void retain(int handle);
+	void release(int handle);
+
+	// The texture to bind for handle. It can change once the image has
+	// decoded, if its pixels match another texture's, so look it up to bind
+	GLuint texture(int handle) const;
+
+	// Caps the bytes of texture memory held, counting every mip level, or
+	// 0 for no cap. Enforced by update()
+	void setBudget(size_t bytes) { budget = bytes; }
+	// Marks handle as drawn this frame about screenSize pixels across, and
+	// returns the texture to bind for it, as texture() does. Anything evicted
+	// or shrunk that's drawn bigger than it now is gets loaded again, biggest
+	// on screen first
+	GLuint use(int handle, float screenSize);
+	// Measures newly loaded textures, finishes and starts reloads and makes
+	// room under the budget. Call it once a frame
+	void update();
+	size_t residentBytes() const { return resident; }
+
+	// Textures resident or loading, counting shared ones once
+	size_t size() const;
+
+private:
+	struct Entry
+	{
+		std::string key;
+		GLuint texture = 0;
+		int refs = 0;
+		int shared = -1; // the entry whose texture this uses instead
+		uint64_t content = 0;
+		bool hashed = false;
+		// Residency, for entries that own their texture
+		std::string path;
+		GLenum format = 0;
+		size_t bytes = 0; // 0 until measured
+		size_t fullBytes = 0;
+		int width = 0; // of the top level
+		int fullWidth = 0;
+		GLuint reload = 0; // loading to replace texture, or an evicted one
+		size_t reserved = 0; // counted for the reload until it's measured
+		uint64_t lastUsed = 0;
+		float screenSize = 0.0f;
+	};
+
+	bool decoded(const TextureStreamer::Decoded& image);
+	void measure(Entry& entry);
+	bool dropTopLevel(Entry& entry);
+	void evict(Entry& entry);
+	void makeRoom(size_t target, bool staleOnly);
+
+	TextureStreamer& streamer;
+	std::vector<Entry> entries;
+	std::vector<int> unused;
+	std::unordered_map<std::string, int> byPath;
+	std::unordered_map<GLuint, int> byTexture; // still decoding
+	std::unordered_map<uint64_t, int> byContent;
+
+	size_t budget = 0;
+	size_t resident = 0;
+	uint64_t frame = 1;
+	GLuint placeholder = 0; // stands in for evicted textures
+	GLuint readback = 0; // copies kept levels while dropping one
+};
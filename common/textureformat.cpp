@@ -0,0 +1,144 @@
+﻿#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include "GLCaps.hpp"
+#include "TextureFormat.hpp"
+
+// glTexStorage2D and 3D aren't in the 3.3 core loader, so they're looked
+// up by hand
+typedef void (APIENTRYP TexStorage2DProc)(GLenum target, GLsizei levels, GLenum internalFormat, GLsizei width, GLsizei height);
+typedef void (APIENTRYP TexStorage3DProc)(GLenum target, GLsizei levels, GLenum internalFormat, GLsizei width, GLsizei height, GLsizei depth);
+
+GLFWglproc LoadTexStorage(const char* name)
+{
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	if (major > 4 || (major == 4 && minor >= 2) || HasExtension("GL_ARB_texture_storage"))
+	{
+		return glfwGetProcAddress(name);
+	}
+	return nullptr;
+}
+
+TextureFormat NegotiateFormat(int channels, bool srgb, bool hdr)
+{
+	if (hdr)
+	{
+		return { GL_RGBA16F, GL_RGBA, GL_FLOAT, 8 };
+	}
+	switch (channels)
+	{
+	case 1: return { GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1 };
+	case 2: return { GL_RG8, GL_RG, GL_UNSIGNED_BYTE, 2 };
+	case 3: return { srgb ? (GLenum)GL_SRGB8 : (GLenum)GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE, 3 };
+	default: return { srgb ? (GLenum)GL_SRGB8_ALPHA8 : (GLenum)GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4 };
+	}
+}
+
+bool FormatFromInternal(GLenum internalFormat, TextureFormat& format)
+{
+	for (int channels = 1; channels <= 4; channels++)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			format = NegotiateFormat(channels, i == 1, i == 2);
+			if (format.internalFormat == internalFormat)
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+int FormatChannels(GLenum format)
+{
+	switch (format)
+	{
+	case GL_RED: return 1;
+	case GL_RG: return 2;
+	case GL_RGB: return 3;
+	default: return 4;
+	}
+}
+
+GLenum ChannelsFormat(int channels)
+{
+	switch (channels)
+	{
+	case 1: return GL_RED;
+	case 2: return GL_RG;
+	case 3: return GL_RGB;
+	default: return GL_RGBA;
+	}
+}
+
+GLint UnpackAlignment(size_t rowBytes)
+{
+	for (GLint alignment = 8; alignment > 1; alignment /= 2)
+	{
+		if (rowBytes % alignment == 0)
+		{
+			return alignment;
+		}
+	}
+	return 1;
+}
+
+size_t TextureSize(const TextureFormat& format, int width, int height)
+{
+	size_t size = 0;
+	for (;;)
+	{
+		size += (size_t)width * height * format.bytesPerPixel;
+		if (width == 1 && height == 1)
+		{
+			return size;
+		}
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+}
+
+bool AllocateStorage(GLenum internalFormat, int width, int height, int levels)
+{
+	static TexStorage2DProc texStorage2D = (TexStorage2DProc)LoadTexStorage("glTexStorage2D");
+	if (!texStorage2D)
+	{
+		return false;
+	}
+	texStorage2D(GL_TEXTURE_2D, levels, internalFormat, width, height);
+	return true;
+}
+
+bool AllocateArrayStorage(GLenum internalFormat, int width, int height, int layers, int levels)
+{
+	static TexStorage3DProc texStorage3D = (TexStorage3DProc)LoadTexStorage("glTexStorage3D");
+	if (!texStorage3D)
+	{
+		return false;
+	}
+	texStorage3D(GL_TEXTURE_2D_ARRAY, levels, internalFormat, width, height, layers);
+	return true;
+}
+
+void UploadLevel(bool allocated, GLint level, GLenum internalFormat, int width, int height, GLenum format, GLenum type, const void* data, size_t size)
+{
+	if (allocated && format)
+	{
+		glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height, format, type, data);
+	}
+	else if (allocated)
+	{
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height, internalFormat, (GLsizei)size, data);
+	}
+	else if (format)
+	{
+		glTexImage2D(GL_TEXTURE_2D, level, internalFormat, width, height, 0, format, type, data);
+	}
+	else
+	{
+		glCompressedTexImage2D(GL_TEXTURE_2D, level, internalFormat, width, height, 0, (GLsizei)size, data);
+	}
+}
@@ -0,0 +1,51 @@
+﻿#pragma once
+#include <cstddef>
+#include <glad/glad.h>
+
+// How a texture is stored on the GPU, and the pixel format and type its
+// data is handed over in. The two match, so the driver copies the pixels
+// as they are rather than converting them
+struct TextureFormat
+{
+	GLenum internalFormat;
+	GLenum format;
+	GLenum type;
+	int bytesPerPixel;
+};
+
+// Picks the sized format for an image with 1 to 4 channels as stb_image
+// decodes it. 8 bit images go to R8, RG8, RGB8 or RGBA8, or with srgb set,
+// RGB and RGBA go to SRGB8 and SRGB8_ALPHA8. Float images (stbi_loadf, with
+// 4 channels) go to RGBA16F, the one case the driver has to convert
+TextureFormat NegotiateFormat(int channels, bool srgb = false, bool hdr = false);
+
+// Finds the format NegotiateFormat hands out with this internal format.
+// False for compressed formats and anything else it never picks
+bool FormatFromInternal(GLenum internalFormat, TextureFormat& format);
+
+// Channels for GL_RED, GL_RG, GL_RGB or GL_RGBA, and the other way round
+int FormatChannels(GLenum format);
+GLenum ChannelsFormat(int channels);
+
+// The largest GL_UNPACK_ALIGNMENT, up to 8, that rows this many bytes long
+// meet, so that tightly packed rows upload without any repacking
+GLint UnpackAlignment(size_t rowBytes);
+
+// Bytes a texture takes up on the GPU with every level down to 1x1, not
+// counting any padding the driver adds
+size_t TextureSize(const TextureFormat& format, int width, int height);
+
+// Allocates levels of the bound 2D texture in one go with glTexStorage2D,
+// from OpenGL 4.2 or ARB_texture_storage, leaving them to be filled with
+// UploadLevel. The storage is immutable, so the driver can skip checking
+// the levels are complete and consistent when it's used. Returns false
+// without doing anything when the driver has neither
+bool AllocateStorage(GLenum internalFormat, int width, int height, int levels);
+
+// The same for the bound 2D array texture, with every layer the same size
+bool AllocateArrayStorage(GLenum internalFormat, int width, int height, int layers, int levels);
+
+// Fills in a level of the bound 2D texture, specifying it as well unless
+// it was allocated with AllocateStorage. A format of 0 means data holds size
+// bytes of a compressed format
+void UploadLevel(bool allocated, GLint level, GLenum internalFormat, int width, int height, GLenum format, GLenum type, const void* data, size_t size);
@@ -0,0 +1,758 @@
+﻿#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include "BakedTexture.hpp"
+#include "BlockCompressor.hpp"
+#include "ContainerTexture.hpp"
+#include "GLCaps.hpp"
+#include "MappedFile.hpp"
+#include "MipGenerator.hpp"
+#include "TextureFormat.hpp"
+#include "TextureStreamer.hpp"
+#include "../stb_image.h"
+
+BlockFormat CompressedBlockFormat(GLenum compressedFormat)
+{
+	return compressedFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ? BlockFormat::BC3 : BlockFormat::BC1;
+}
+
+// Timings of sliced uploads smaller than this are mostly fixed costs, and
+// say little about what a byte costs
+const size_t MIN_TIMED_BYTES = 64 * 1024;
+const int NUM_TIMINGS = 4;
+
+uint64_t MixHash(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+// A 64 bit hash of a row, a word at a time
+uint64_t HashRow(const unsigned char* row, size_t size)
+{
+	uint64_t h = 0x9e3779b97f4a7c15ull ^ size;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, row + i, 8);
+		h = (h ^ word) * 0x100000001b3ull;
+		h ^= h >> 29;
+	}
+	for (; i < size; i++)
+	{
+		h = (h ^ row[i]) * 0x100000001b3ull;
+	}
+	return MixHash(h);
+}
+
+TextureStreamer::TextureStreamer(int numThreads, int numBuffers, int uploadsPerFrame) :
+	uploadsPerFrame(uploadsPerFrame), buffers(std::max(1, numBuffers))
+{
+	for (Buffer& buffer : buffers)
+	{
+		glGenBuffers(1, &buffer.PBO);
+	}
+	s3tc = HasExtension("GL_EXT_texture_compression_s3tc");
+	if (numThreads <= 0)
+	{
+		numThreads = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+	}
+	for (int i = 0; i < numThreads; i++)
+	{
+		threads.emplace_back(&TextureStreamer::work, this);
+	}
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	// Decodes cut short can leave buffers mapped
+	for (Buffer& buffer : buffers)
+	{
+		if (buffer.mapped)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.PBO);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		}
+		if (buffer.fence)
+		{
+			glDeleteSync(buffer.fence);
+		}
+		glDeleteBuffers(1, &buffer.PBO);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	for (Timing& timing : timings)
+	{
+		glDeleteQueries(1, &timing.query);
+	}
+}
+
+GLuint TextureStreamer::load(const char* path, GLenum format)
+{
+	GLuint texture = LoadBakedTexture(BakedPath(path).c_str(), format);
+	if (!texture && IsContainerPath(path))
+	{
+		texture = LoadContainerTexture(path);
+	}
+	if (texture)
+	{
+		return texture;
+	}
+
+	// Mid grey stands in until the image arrives
+	const unsigned char placeholder[4] = { 128, 128, 128, 255 };
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, NegotiateFormat(FormatChannels(format)).internalFormat, 1, 1, 0, format, GL_UNSIGNED_BYTE, placeholder);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	enqueue(path, texture, format, false);
+	return texture;
+}
+
+bool TextureStreamer::setCompression(bool enabled, int quality)
+{
+	compress = enabled && s3tc;
+	compressionQuality = quality;
+	return compress;
+}
+
+void TextureStreamer::setCpuMipmaps(bool enabled, MipFilter filter)
+{
+	cpuMipmaps = enabled;
+	mipFilter = filter;
+}
+
+void TextureStreamer::setUploadBudget(size_t bytesPerFrame, float milliseconds)
+{
+	uploadBytes = bytesPerFrame;
+	uploadMilliseconds = milliseconds;
+	if (timings.empty() && milliseconds > 0.0f)
+	{
+		timings.resize(NUM_TIMINGS);
+		for (Timing& timing : timings)
+		{
+			glGenQueries(1, &timing.query);
+		}
+	}
+}
+
+void TextureStreamer::cancel(GLuint texture)
+{
+	auto found = active.find(texture);
+	if (found == active.end()) return;
+	found->second->cancelled = true;
+	active.erase(found);
+	// Wakes its worker if it's waiting on a buffer
+	std::lock_guard<std::mutex> lock(mutex);
+	wake.notify_all();
+}
+
+void TextureStreamer::enqueue(const std::string& path, GLuint texture, GLenum format, bool filtered)
+{
+	std::unique_ptr<Job> job(new Job());
+	job->owner = this;
+	job->path = path;
+	job->texture = texture;
+	job->format = format;
+	job->channels = FormatChannels(format);
+	job->container = IsContainerPath(path);
+	if (compress && !job->container && (format == GL_RGB || format == GL_RGBA))
+	{
+		// Blocks are compressed from RGBA either way
+		job->compressedFormat = format == GL_RGBA ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		job->quality = compressionQuality;
+		job->channels = 4;
+	}
+	job->cpuMipmaps = cpuMipmaps && !job->container;
+	job->mipFilter = mipFilter;
+	job->filtered = filtered;
+	active[texture] = job.get();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queued.push_back(std::move(job));
+	}
+	wake.notify_all();
+	inFlight++;
+}
+
+void TextureStreamer::update()
+{
+	// Buffers come back once the GPU has finished the uploads reading them
+	for (Buffer& buffer : buffers)
+	{
+		if (buffer.fence && glClientWaitSync(buffer.fence, 0, 0) != GL_TIMEOUT_EXPIRED)
+		{
+			glDeleteSync(buffer.fence);
+			buffer.fence = nullptr;
+			buffer.busy = false;
+		}
+	}
+
+	std::vector<std::unique_ptr<Job>> finished;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		bool mapped = false;
+		for (size_t i = 0; i < buffers.size() && !waiting.empty(); i++)
+		{
+			if (buffers[i].busy) continue;
+			Job* job = waiting.front();
+			waiting.pop_front();
+			job->pixels = map(buffers[i], job->size);
+			if (job->pixels)
+			{
+				job->buffer = (int)i;
+			}
+			else
+			{
+				job->failed = true;
+			}
+			mapped = true;
+		}
+		if (mapped)
+		{
+			wake.notify_all();
+		}
+		while ((int)finished.size() < uploadsPerFrame && !decoded.empty())
+		{
+			finished.push_back(std::move(decoded.front()));
+			decoded.pop_front();
+		}
+	}
+
+	if (uploadBytes || uploadMilliseconds > 0.0f || !uploading.empty())
+	{
+		uploadSlices(finished);
+		return;
+	}
+	for (std::unique_ptr<Job>& job : finished)
+	{
+		upload(*job);
+	}
+}
+
+unsigned char* TextureStreamer::map(Buffer& buffer, size_t size)
+{
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.PBO);
+	if (buffer.capacity < size)
+	{
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)size, nullptr, GL_STREAM_DRAW);
+		buffer.capacity = size;
+	}
+	// The fence has passed, so there's nothing to synchronize with
+	void* pixels = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	buffer.mapped = buffer.busy = pixels != nullptr;
+	return (unsigned char*)pixels;
+}
+
+void TextureStreamer::upload(Job& job)
+{
+	if (!unmap(job))
+	{
+		return;
+	}
+
+	// The texture already exists for the placeholder, so it's respecified
+	// rather than given immutable storage
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[job.buffer].PBO);
+	glBindTexture(GL_TEXTURE_2D, job.texture);
+	if (!job.levels.empty())
+	{
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (size_t i = 0; i < job.levels.size(); i++)
+		{
+			const Level& level = job.levels[i];
+			UploadLevel(false, (GLint)i, job.internalFormat, level.width, level.height, job.type ? job.pixelFormat : 0, job.type, (void*)level.offset, level.size);
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)job.levels.size() - 1);
+	}
+	else
+	{
+		TextureFormat format = NegotiateFormat(job.channels);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, UnpackAlignment((size_t)job.width * format.bytesPerPixel));
+		glTexImage2D(GL_TEXTURE_2D, 0, format.internalFormat, job.width, job.height, 0, format.format, format.type, (void*)0);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glGenerateMipmap(GL_TEXTURE_2D);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	buffers[job.buffer].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	finish(job);
+}
+
+// Unmaps the buffer job decoded into, and returns whether its pixels are to
+// go in the texture. If not, the load is over, and the buffer free
+bool TextureStreamer::unmap(Job& job)
+{
+	bool upload = !job.failed && !job.cancelled;
+	if (upload && job.container && !TextureSupported(job.internalFormat, job.width, job.height))
+	{
+		job.failed = true;
+		upload = false;
+	}
+	if (upload && filter && !job.filtered)
+	{
+		Decoded image = { job.texture, job.format, job.width, job.height, job.hash };
+		job.filtered = true;
+		upload = filter(image);
+	}
+	if (job.buffer < 0)
+	{
+		finish(job);
+		if (!job.cancelled)
+		{
+			std::cout << "Failed to load texture: " << job.path << std::endl;
+		}
+		return false;
+	}
+
+	Buffer& buffer = buffers[job.buffer];
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.PBO);
+	buffer.mapped = false;
+	// A mapped buffer's contents can be lost, e.g. on a display mode change
+	bool intact = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	if (upload && intact)
+	{
+		return true;
+	}
+	buffer.busy = false;
+	finish(job);
+
+	if (job.failed && !job.cancelled)
+	{
+		std::cout << "Failed to load texture: " << job.path << std::endl;
+	}
+	else if (upload && !intact)
+	{
+		// Decode it again
+		enqueue(job.path, job.texture, job.format, true);
+	}
+	return false;
+}
+
+void TextureStreamer::finish(Job& job)
+{
+	inFlight--;
+	auto found = active.find(job.texture);
+	if (found != active.end() && found->second == &job)
+	{
+		active.erase(found);
+	}
+}
+
+// Limits sampling to the texture's smallest level and puts that in, ready
+// for the rest to go in a band at a time. Levels are allocated as they're
+// reached, which the texture being mutable allows, so that allocating them
+// is spread over frames too
+void TextureStreamer::beginSlices(Job& job)
+{
+	glBindTexture(GL_TEXTURE_2D, job.texture);
+	int smallest;
+	if (!job.levels.empty())
+	{
+		// Put in straight away, being tiny, unless it's the only level
+		smallest = (int)job.levels.size() - 1;
+		job.level = smallest;
+		if (smallest > 0)
+		{
+			const Level& level = job.levels[smallest];
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[job.buffer].PBO);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			UploadLevel(false, smallest, job.internalFormat, level.width, level.height, job.type ? job.pixelFormat : 0, job.type, (void*)level.offset, level.size);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			job.level--;
+		}
+	}
+	else
+	{
+		// glGenerateMipmap makes the rest once level 0 is in, so until then
+		// the smallest level holds the placeholder's grey
+		const unsigned char placeholder[4] = { 128, 128, 128, 255 };
+		smallest = MipLevels(job.width, job.height) - 1;
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, smallest, NegotiateFormat(job.channels).internalFormat, 1, 1, 0, job.format, GL_UNSIGNED_BYTE, placeholder);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		job.level = 0;
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, smallest);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, smallest);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	job.row = 0;
+}
+
+// Uploads as many rows of the level job is on as fit in bytes, though at
+// least one band, and has the level sampled once it's all in. Returns the
+// bytes uploaded
+size_t TextureStreamer::uploadSlice(Job& job, size_t bytes)
+{
+	Level level = job.levels.empty() ? Level{ 0, job.size, job.width, job.height } : job.levels[job.level];
+	bool compressed = !job.levels.empty() && !job.type;
+	// Compressed rows go in a row of 4x4 blocks at a time
+	int step = compressed ? 4 : 1;
+	int numBands = (level.height + step - 1) / step;
+	size_t bandBytes = level.size / numBands;
+	size_t bands = std::min(std::max(bytes / bandBytes, (size_t)1), (size_t)(numBands - job.row / step));
+	int rows = std::min((int)bands * step, level.height - job.row);
+	size_t offset = level.offset + (size_t)(job.row / step) * bandBytes;
+	size_t size = bands * bandBytes;
+	TextureFormat format = NegotiateFormat(job.channels);
+
+	glBindTexture(GL_TEXTURE_2D, job.texture);
+	if (job.row == 0 && job.levels.empty())
+	{
+		glTexImage2D(GL_TEXTURE_2D, 0, format.internalFormat, level.width, level.height, 0, format.format, format.type, nullptr);
+	}
+	else if (job.row == 0)
+	{
+		UploadLevel(false, job.level, job.internalFormat, level.width, level.height, job.type ? job.pixelFormat : 0, job.type, nullptr, level.size);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[job.buffer].PBO);
+	if (compressed)
+	{
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, job.level, 0, job.row, level.width, rows, job.internalFormat, (GLsizei)size, (void*)offset);
+	}
+	else if (!job.levels.empty())
+	{
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage2D(GL_TEXTURE_2D, job.level, 0, job.row, level.width, rows, job.pixelFormat, job.type, (void*)offset);
+	}
+	else
+	{
+		glPixelStorei(GL_UNPACK_ALIGNMENT, UnpackAlignment(bandBytes));
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, job.row, level.width, rows, format.format, format.type, (void*)offset);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	job.row += rows;
+	if (job.row == level.height)
+	{
+		if (job.levels.empty())
+		{
+			// Counted as a third of level 0 more, what the rest of the chain
+			// adds up to
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+			glGenerateMipmap(GL_TEXTURE_2D);
+			size += level.size / 3;
+		}
+		else
+		{
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, job.level);
+		}
+		job.level--;
+		job.row = 0;
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return size;
+}
+
+void TextureStreamer::uploadSlices(std::vector<std::unique_ptr<Job>>& started)
+{
+	// What a byte costs is learnt from the timings that are ready
+	for (Timing& timing : timings)
+	{
+		GLint available = 0;
+		if (timing.pending)
+		{
+			glGetQueryObjectiv(timing.query, GL_QUERY_RESULT_AVAILABLE, &available);
+		}
+		if (!available)
+		{
+			continue;
+		}
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(timing.query, GL_QUERY_RESULT, &elapsed);
+		timing.pending = false;
+		if (timing.bytes >= MIN_TIMED_BYTES)
+		{
+			double cost = (double)elapsed / timing.bytes;
+			nanosecondsPerByte = nanosecondsPerByte * 0.75 + cost * 0.25;
+		}
+	}
+	size_t allowance = uploadBytes ? uploadBytes : SIZE_MAX;
+	if (uploadMilliseconds > 0.0f)
+	{
+		allowance = std::min(allowance, (size_t)(uploadMilliseconds * 1e6 / nanosecondsPerByte));
+	}
+
+	// A frame goes untimed if every query is still in flight
+	Timing* timing = nullptr;
+	if (!timings.empty() && !timings[nextTiming].pending)
+	{
+		timing = &timings[nextTiming];
+		nextTiming = (nextTiming + 1) % (int)timings.size();
+		glBeginQuery(GL_TIME_ELAPSED, timing->query);
+	}
+	auto start = std::chrono::steady_clock::now();
+
+	for (std::unique_ptr<Job>& job : started)
+	{
+		if (unmap(*job))
+		{
+			beginSlices(*job);
+			uploading.push_back(std::move(job));
+		}
+	}
+	// The GPU may still be reading bands of cancelled uploads, so their
+	// buffers wait on a fence like any other
+	for (size_t i = 0; i < uploading.size();)
+	{
+		if (uploading[i]->cancelled)
+		{
+			buffers[uploading[i]->buffer].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			finish(*uploading[i]);
+			uploading.erase(uploading.begin() + i);
+		}
+		else
+		{
+			i++;
+		}
+	}
+
+	// Always the upload on the smallest level next, the first to arrive of
+	// those on the same level, so that levels are finished in order across
+	// every texture. At least one band goes in each frame, so that nothing
+	// stalls on a budget smaller than a band
+	size_t spent = 0;
+	while (!uploading.empty() && (spent == 0 || spent < allowance))
+	{
+		if (uploadMilliseconds > 0.0f && spent > 0 &&
+			std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count() >= uploadMilliseconds)
+		{
+			break;
+		}
+		size_t next = 0;
+		for (size_t i = 1; i < uploading.size(); i++)
+		{
+			if (uploading[i]->level > uploading[next]->level)
+			{
+				next = i;
+			}
+		}
+		Job& job = *uploading[next];
+		spent += uploadSlice(job, spent < allowance ? allowance - spent : 0);
+		if (job.level < 0)
+		{
+			buffers[job.buffer].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			finish(job);
+			uploading.erase(uploading.begin() + next);
+		}
+	}
+
+	if (timing)
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		timing->bytes = spent;
+		timing->pending = true;
+	}
+}
+
+int TextureStreamer::receiveRows(void* user, unsigned char* rows, int y, int numRows)
+{
+	Job* job = (Job*)user;
+	if (job->cancelled)
+	{
+		return 0;
+	}
+	size_t stride = (size_t)job->width * job->channels;
+	unsigned char* pixels;
+	if (job->compressedFormat || job->cpuMipmaps)
+	{
+		// Mipmaps and blocks need the whole image, so it's gathered, with
+		// room for the rest of the chain, before any of it goes in a buffer
+		if (job->image.empty())
+		{
+			job->image.resize(MipChainSize(job->width, job->height, job->channels));
+		}
+		pixels = job->image.data();
+	}
+	else
+	{
+		// The size is known by the first band, so now the render thread can
+		// map a buffer for it
+		if (!job->pixels && !waitForBuffer(job, stride * job->height))
+		{
+			return 0;
+		}
+		pixels = job->pixels;
+	}
+
+	// Row hashes are summed so that the order the bands arrive in, which
+	// flipping reverses, doesn't matter
+	for (int i = 0; i < numRows; i++)
+	{
+		const unsigned char* row = rows + i * stride;
+		memcpy(pixels + (y + i) * stride, row, stride);
+		job->hash += MixHash(HashRow(row, stride) + (uint64_t)(y + i));
+	}
+	return 1;
+}
+
+bool TextureStreamer::waitForBuffer(Job* job, size_t size)
+{
+	TextureStreamer* streamer = job->owner;
+	std::unique_lock<std::mutex> lock(streamer->mutex);
+	job->size = size;
+	streamer->waiting.push_back(job);
+	streamer->wake.wait(lock, [&]() { return job->pixels || job->failed || job->cancelled || streamer->stopping; });
+	if (!job->pixels)
+	{
+		auto found = std::find(streamer->waiting.begin(), streamer->waiting.end(), job);
+		if (found != streamer->waiting.end())
+		{
+			streamer->waiting.erase(found);
+		}
+		return false;
+	}
+	return true;
+}
+
+bool TextureStreamer::buildLevels(Job* job)
+{
+	// Compressed mipmaps can't be generated, so the whole chain is made here
+	// before waiting on a buffer. Other workers are busy with other images,
+	// so this one keeps to itself
+	GenerateMips(job->image.data(), job->width, job->height, job->channels, job->mipFilter, job->channels >= 3, 1);
+	BlockFormat blockFormat = CompressedBlockFormat(job->compressedFormat);
+	if (job->compressedFormat)
+	{
+		job->internalFormat = job->compressedFormat;
+	}
+	else
+	{
+		TextureFormat format = NegotiateFormat(job->channels);
+		job->internalFormat = format.internalFormat;
+		job->pixelFormat = format.format;
+		job->type = format.type;
+	}
+	size_t size = 0;
+	for (int i = 0; i < MipLevels(job->width, job->height); i++)
+	{
+		Level level = { size, 0, std::max(1, job->width >> i), std::max(1, job->height >> i) };
+		level.size = job->compressedFormat ? CompressedSize(blockFormat, level.width, level.height) : (size_t)level.width * level.height * job->channels;
+		job->levels.push_back(level);
+		size += level.size;
+	}
+	if (!waitForBuffer(job, size))
+	{
+		return false;
+	}
+
+	// Each level goes straight into the buffer, compressed or as it is
+	const unsigned char* source = job->image.data();
+	for (const Level& level : job->levels)
+	{
+		if (job->cancelled)
+		{
+			return false;
+		}
+		if (job->compressedFormat)
+		{
+			CompressBlocks(blockFormat, source, level.width, level.height, job->pixels + level.offset, job->quality, 1);
+		}
+		else
+		{
+			memcpy(job->pixels + level.offset, source, level.size);
+		}
+		source += (size_t)level.width * level.height * job->channels;
+	}
+	job->image = std::vector<unsigned char>();
+	return true;
+}
+
+bool TextureStreamer::inflateContainer(Job* job)
+{
+	// Anything that isn't supercompressed was already tried by load()
+	MappedFile file(job->path.c_str());
+	ContainerTexture container;
+	if (!ParseContainer(file.data(), file.size(), container) || container.supercompression != KTX2_SUPERCOMPRESSION_ZLIB)
+	{
+		return false;
+	}
+	job->internalFormat = container.internalFormat;
+	job->pixelFormat = container.format;
+	job->type = container.type;
+	job->width = container.levels[0].width;
+	job->height = container.levels[0].height;
+
+	// Levels are 16 byte aligned in the buffer, so each starts on a pixel.
+	// The hash is of the stored bytes, as inflating goes straight into the
+	// buffer, which is no place to read back from
+	size_t size = 0;
+	for (const ContainerTexture::Level& level : container.levels)
+	{
+		job->levels.push_back({ size, level.uncompressedSize, level.width, level.height });
+		size = (size + level.uncompressedSize + 15) & ~(size_t)15;
+		job->hash += MixHash(HashRow(level.data, level.size) + job->levels.size());
+	}
+	if (!waitForBuffer(job, size))
+	{
+		return false;
+	}
+	for (size_t i = 0; i < container.levels.size(); i++)
+	{
+		if (job->cancelled || !InflateLevel(container.levels[i], job->pixels + job->levels[i].offset))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void TextureStreamer::work()
+{
+	for (;;)
+	{
+		std::unique_ptr<Job> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this]() { return stopping || !queued.empty(); });
+			if (stopping) return;
+			job = std::move(queued.front());
+			queued.pop_front();
+		}
+
+		int channelsInFile;
+		if (job->cancelled)
+		{
+			job->failed = true;
+		}
+		else if (job->container)
+		{
+			job->failed = !inflateContainer(job.get());
+		}
+		else if (!stbi_load_rows(job->path.c_str(), &job->width, &job->height, &channelsInFile, job->channels, receiveRows, job.get()) ||
+			((job->compressedFormat || job->cpuMipmaps) && !buildLevels(job.get())))
+		{
+			job->failed = true;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		decoded.push_back(std::move(job));
+	}
+}
@@ -0,0 +1,195 @@
+﻿#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <glad/glad.h>
+
+#include "MipGenerator.hpp"
+
+// Loads textures without holding up the render loop. load() hands back a
+// texture straight away, holding a 1x1 placeholder until the image arrives.
+// Worker threads decode straight into pixel unpack buffers from a small ring,
+// each mapped only while its image is written, and update() uploads a few
+// finished images a frame, reusing a buffer once the fence after its upload
+// has passed. Images that have been baked (see BakeTextures), and DDS and
+// KTX2 files, skip all that and upload straight away, except for KTX2 that's
+// supercompressed, which is inflated on the workers. The workers can also
+// make the mipmaps, and with compression on they make them and then block
+// compress every level for glCompressedTexImage2D. With an upload budget
+// set, images go in a band of rows at a time instead, spread over as many
+// frames as the budget needs. All but the decoding needs the OpenGL 3.3
+// context current
+class TextureStreamer
+{
+public:
+	// An image that's been decoded and is about to be uploaded. The hash is
+	// of the decoded pixels
+	struct Decoded
+	{
+		GLuint texture;
+		GLenum format;
+		int width;
+		int height;
+		uint64_t hash;
+	};
+
+	// numThreads of 0 means one per core, less one for the render thread
+	TextureStreamer(int numThreads = 0, int numBuffers = 4, int uploadsPerFrame = 2);
+	~TextureStreamer();
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	// format is GL_RED, GL_RG, GL_RGB or GL_RGBA and picks the channels to
+	// decode. The image is flipped if stbi_set_flip_vertically_on_load is set.
+	// DDS and KTX2 files keep the format they're stored in and aren't flipped
+	GLuint load(const char* path, GLenum format);
+
+	// Recycles buffers the GPU is done with, maps buffers for decodes that
+	// are waiting on one and uploads up to uploadsPerFrame images. Call it
+	// once a frame
+	void update();
+
+	// Stops loading into texture, for when it's about to be deleted. Any
+	// decode still running for it is abandoned and nothing more is uploaded
+	void cancel(GLuint texture);
+
+	// Block compresses RGB images to BC1 and RGBA to BC3 from the next load
+	// on, at a quality from 0 to 2 (see CompressBlocks). Does nothing if the
+	// driver lacks S3TC. Returns whether compression is on
+	bool setCompression(bool enabled, int quality = 1);
+
+	// Makes mipmaps on the workers from the next load on, treating RGB and
+	// RGBA as sRGB color, rather than with glGenerateMipmap on the render
+	// thread. Compressed images always have theirs made there, with this
+	// filter
+	void setCpuMipmaps(bool enabled, MipFilter filter = MipFilter::Kaiser);
+
+	// Spreads uploads over frames so that none spends more than bytesPerFrame
+	// or milliseconds on them, the time measured on the GPU with timer
+	// queries. Every texture loading gets its smaller mip levels before any
+	// gets its biggest, and is sampled from the levels it has while the rest
+	// go in. 0 for either leaves it unlimited, and both 0, the default,
+	// uploads each image whole
+	void setUploadBudget(size_t bytesPerFrame, float milliseconds);
+
+	// Called on the render thread with each image before it's uploaded;
+	// returning false skips the upload and leaves the texture alone
+	void setFilter(std::function<bool(const Decoded&)> filter) { this->filter = filter; }
+
+	// Loads that haven't been uploaded or given up on yet
+	int pending() const { return inFlight; }
+	// Whether texture is still waiting on its image
+	bool loading(GLuint texture) const { return active.count(texture) > 0; }
+
+private:
+	struct Level
+	{
+		size_t offset;
+		size_t size;
+		int width;
+		int height;
+	};
+
+	struct Job
+	{
+		TextureStreamer* owner;
+		std::string path;
+		GLuint texture;
+		GLenum format;
+		int channels;
+		GLenum compressedFormat = 0;
+		int quality = 1;
+		bool cpuMipmaps = false;
+		MipFilter mipFilter = MipFilter::Kaiser;
+		int width = 0;
+		int height = 0;
+		int buffer = -1;
+		size_t size = 0;
+		unsigned char* pixels = nullptr;
+		std::vector<unsigned char> image; // the mip chain, when made here
+		// Levels made on the worker, which lie one after another in the
+		// buffer. A type of 0 means they're compressed
+		bool container = false;
+		GLenum internalFormat = 0;
+		GLenum pixelFormat = 0;
+		GLenum type = 0;
+		std::vector<Level> levels;
+		uint64_t hash = 0;
+		// Where a sliced upload is up to: the level going in, and the rows of
+		// it that are done
+		int level = -1;
+		int row = 0;
+		bool failed = false;
+		bool filtered = false;
+		std::atomic<bool> cancelled{ false };
+	};
+
+	struct Buffer
+	{
+		GLuint PBO = 0;
+		size_t capacity = 0;
+		GLsync fence = nullptr;
+		bool mapped = false;
+		bool busy = false;
+	};
+
+	struct Timing
+	{
+		GLuint query = 0;
+		size_t bytes = 0;
+		bool pending = false;
+	};
+
+	static int receiveRows(void* user, unsigned char* rows, int y, int numRows);
+	static bool waitForBuffer(Job* job, size_t size);
+	static bool buildLevels(Job* job);
+	static bool inflateContainer(Job* job);
+	void enqueue(const std::string& path, GLuint texture, GLenum format, bool filtered);
+	void work();
+	unsigned char* map(Buffer& buffer, size_t size);
+	void upload(Job& job);
+	bool unmap(Job& job);
+	void finish(Job& job);
+	void beginSlices(Job& job);
+	size_t uploadSlice(Job& job, size_t bytes);
+	void uploadSlices(std::vector<std::unique_ptr<Job>>& started);
+
+	int uploadsPerFrame;
+	int inFlight = 0;
+	bool compress = false;
+	bool s3tc = false;
+	int compressionQuality = 1;
+	bool cpuMipmaps = false;
+	MipFilter mipFilter = MipFilter::Kaiser;
+	std::function<bool(const Decoded&)> filter;
+	std::vector<Buffer> buffers;
+	std::vector<std::thread> threads;
+	std::unordered_map<GLuint, Job*> active;
+
+	// Sliced uploads. Timings of the last few frames' uploads are read back
+	// once they're ready, so nothing waits on them, and give what a byte
+	// costs, starting from a guess of a gigabyte a second
+	size_t uploadBytes = 0;
+	float uploadMilliseconds = 0.0f;
+	std::vector<std::unique_ptr<Job>> uploading;
+	std::vector<Timing> timings;
+	int nextTiming = 0;
+	double nanosecondsPerByte = 1.0;
+
+	// Workers wait on wake for new jobs, for a buffer to decode into, or for
+	// the streamer to stop
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<std::unique_ptr<Job>> queued;
+	std::deque<Job*> waiting;
+	std::deque<std::unique_ptr<Job>> decoded;
+	bool stopping = false;
+};
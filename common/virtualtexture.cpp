@@ -0,0 +1,619 @@
+﻿#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "MipGenerator.hpp"
+#include "TextureFormat.hpp"
+#include "VirtualTexture.hpp"
+#include "../stb_image.h"
+
+namespace fs = std::filesystem;
+
+// How many feedback passes can be waiting on the GPU before one is skipped
+const int FEEDBACK_READBACKS = 3;
+// Slots seen this recently are kept, as the feedback that would show them
+// still in use can be a few frames behind
+const uint64_t EVICT_AFTER_FRAMES = 4;
+
+uint64_t TileKey(int level, int x, int y)
+{
+	return ((uint64_t)level << 48) | ((uint64_t)y << 24) | (uint64_t)x;
+}
+
+// Bakes one level of a virtual texture from strips of rows a tile high,
+// bottom first, which can arrive in either order. A strip's tiles are
+// written once the strips either side have arrived, for their borders, and
+// each pair of strips is filtered down into a strip of the next level, so a
+// level holds no more than three at once. Coarser levels are box filtered,
+// which, unlike the wider filters, needs nothing from outside the pair
+class VirtualLevelBaker
+{
+public:
+	VirtualLevelBaker(std::ofstream& stream, const VirtualHeader& header, const VirtualLevel& level, int width, int height,
+		VirtualLevelBaker* next) :
+		stream(stream), tileSize((int)header.tileSize), level(level), width(width), height(height), next(next)
+	{
+	}
+
+	void add(int strip, std::vector<unsigned char>&& pixels)
+	{
+		strips[strip] = std::move(pixels);
+		received++;
+		if (last >= 0)
+		{
+			write(last);
+		}
+		for (auto it = strips.begin(); it != strips.end();)
+		{
+			it = (it->first == strip || it->first == last) ? std::next(it) : strips.erase(it);
+		}
+		int partner = strip ^ 1;
+		if (next && (partner >= (int)level.tilesY || strips.count(partner)))
+		{
+			halve(std::min(strip, partner));
+		}
+		last = strip;
+	}
+
+	// Writes the strip that arrived last. False unless every strip did
+	bool finish()
+	{
+		if (last >= 0)
+		{
+			write(last);
+		}
+		strips.clear();
+		return received == (int)level.tilesY && (!next || next->finish());
+	}
+
+private:
+	int rows(int strip) const
+	{
+		return std::min(tileSize, height - strip * tileSize);
+	}
+
+	// The border and anything past the image's edge repeat the nearest texel
+	void write(int strip)
+	{
+		int tileSide = tileSize + 2 * VIRTUAL_BORDER;
+		std::vector<unsigned char> tile((size_t)tileSide * tileSide * 4);
+		for (uint32_t tx = 0; tx < level.tilesX; tx++)
+		{
+			for (int y = 0; y < tileSide; y++)
+			{
+				int sy = std::min(std::max(strip * tileSize + y - (int)VIRTUAL_BORDER, 0), height - 1);
+				const unsigned char* row = strips[sy / tileSize].data() + (size_t)(sy % tileSize) * width * 4;
+				for (int x = 0; x < tileSide; x++)
+				{
+					int sx = std::min(std::max((int)tx * tileSize + x - (int)VIRTUAL_BORDER, 0), width - 1);
+					memcpy(&tile[((size_t)y * tileSide + x) * 4], row + (size_t)sx * 4, 4);
+				}
+			}
+			stream.seekp((std::streamoff)(level.offset + ((uint64_t)strip * level.tilesX + tx) * tile.size()));
+			stream.write((const char*)tile.data(), tile.size());
+		}
+	}
+
+	void halve(int first)
+	{
+		std::vector<unsigned char> block(strips[first]);
+		if (strips.count(first + 1))
+		{
+			block.insert(block.end(), strips[first + 1].begin(), strips[first + 1].end());
+		}
+		int strip = first / 2;
+		std::vector<unsigned char> half((size_t)next->width * next->rows(strip) * 4);
+		HalveLevel(block.data(), width, (int)(block.size() / ((size_t)width * 4)), half.data(), next->width, next->rows(strip),
+			4, MipFilter::Box, true, 0);
+		next->add(strip, std::move(half));
+	}
+
+	std::ofstream& stream;
+	int tileSize;
+	VirtualLevel level;
+	int width;
+	int height;
+	VirtualLevelBaker* next;
+	std::map<int, std::vector<unsigned char>> strips;
+	int last = -1;
+	int received = 0;
+};
+
+// Strips span the whole width, so they always start at x 0
+int ReceiveVirtualStrip(void* user, unsigned char* strip, int /*tx*/, int ty, int w, int h)
+{
+	VirtualLevelBaker* baker = (VirtualLevelBaker*)user;
+	baker->add(ty, std::vector<unsigned char>(strip, strip + (size_t)w * h * 4));
+	return 1;
+}
+
+bool BakeVirtualTexture(const char* imagePath, const char* virtualPath, int tileSize)
+{
+	int width, height;
+	if (!stbi_info(imagePath, &width, &height, nullptr) || tileSize < 1)
+	{
+		return false;
+	}
+
+	VirtualHeader header = {};
+	header.magic = VIRTUAL_MAGIC;
+	header.version = VIRTUAL_VERSION;
+	header.width = (uint32_t)width;
+	header.height = (uint32_t)height;
+	header.tileSize = (uint32_t)tileSize;
+	header.border = VIRTUAL_BORDER;
+	header.levels = 1;
+	header.pageTableSize = 1;
+	uint32_t across = ((uint32_t)std::max(width, height) + tileSize - 1) / tileSize;
+	while (header.pageTableSize < across)
+	{
+		header.pageTableSize *= 2;
+		header.levels++;
+	}
+	if (header.levels > VIRTUAL_MAX_LEVELS)
+	{
+		std::cout << "Too many tiles across for a virtual texture, use bigger ones: " << imagePath << std::endl;
+		return false;
+	}
+
+	int tileSide = tileSize + 2 * VIRTUAL_BORDER;
+	size_t tileBytes = (size_t)tileSide * tileSide * 4;
+	std::vector<VirtualLevel> levels(header.levels);
+	uint64_t offset = sizeof(header) + sizeof(VirtualLevel) * levels.size();
+	for (uint32_t i = 0; i < header.levels; i++)
+	{
+		levels[i].offset = offset;
+		levels[i].tilesX = ((uint32_t)std::max(1, width >> i) + tileSize - 1) / tileSize;
+		levels[i].tilesY = ((uint32_t)std::max(1, height >> i) + tileSize - 1) / tileSize;
+		offset += (uint64_t)levels[i].tilesX * levels[i].tilesY * tileBytes;
+	}
+
+	// Write a temporary file and rename it into place, as for baked textures.
+	// Level 0 arrives from the decoder a strip at a time, flipped so that it's
+	// bottom row first, and every level after it from the one before. Past
+	// the 1x1 level, each level is the 1x1 one again
+	std::string tempPath = std::string(virtualPath) + ".tmp";
+	bool baked;
+	{
+		std::ofstream stream(fs::u8path(tempPath), std::ios::binary | std::ios::trunc);
+		stream.write((const char*)&header, sizeof(header));
+		stream.write((const char*)levels.data(), sizeof(VirtualLevel) * levels.size());
+		std::vector<std::unique_ptr<VirtualLevelBaker>> bakers(header.levels);
+		for (int i = (int)header.levels - 1; i >= 0; i--)
+		{
+			bakers[i].reset(new VirtualLevelBaker(stream, header, levels[i], std::max(1, width >> i), std::max(1, height >> i),
+				i + 1 < (int)header.levels ? bakers[i + 1].get() : nullptr));
+		}
+		stbi_set_flip_vertically_on_load_thread(1);
+		baked = stbi_load_tiles(imagePath, &width, &height, nullptr, 4, width, tileSize, ReceiveVirtualStrip, bakers[0].get()) &&
+			bakers[0]->finish() && stream;
+		stbi_clear_flip_vertically_on_load_thread();
+	}
+	std::error_code error;
+	if (!baked)
+	{
+		fs::remove(fs::u8path(tempPath), error);
+		return false;
+	}
+	fs::rename(fs::u8path(tempPath), fs::u8path(virtualPath), error);
+	return !error;
+}
+
+VirtualTexture::VirtualTexture(const char* path, int cacheTiles, int tilesPerFrame) :
+	file(path), tilesPerFrame(tilesPerFrame)
+{
+	// Check the levels and their tiles all lie inside the file before using
+	// any of it
+	if (!file.data() || file.size() < sizeof(header))
+	{
+		return;
+	}
+	memcpy(&header, file.data(), sizeof(header));
+	if (header.magic != VIRTUAL_MAGIC || header.version != VIRTUAL_VERSION || header.tileSize == 0 || header.tileSize > 4096 ||
+		header.border > 16 || header.levels == 0 || header.levels > VIRTUAL_MAX_LEVELS || header.pageTableSize != 1u << (header.levels - 1) ||
+		(file.size() - sizeof(header)) / sizeof(VirtualLevel) < header.levels)
+	{
+		std::cout << "Corrupt virtual texture: " << path << std::endl;
+		return;
+	}
+	levels.resize(header.levels);
+	memcpy(levels.data(), file.data() + sizeof(header), sizeof(VirtualLevel) * levels.size());
+	tileSide = (int)(header.tileSize + 2 * header.border);
+	tileBytes = (size_t)tileSide * tileSide * 4;
+	for (uint32_t i = 0; i < header.levels; i++)
+	{
+		const VirtualLevel& level = levels[i];
+		uint32_t across = header.pageTableSize >> i;
+		if (level.tilesX == 0 || level.tilesY == 0 || level.tilesX > across || level.tilesY > across || level.offset > file.size() ||
+			(file.size() - level.offset) / tileBytes < (uint64_t)level.tilesX * level.tilesY)
+		{
+			std::cout << "Corrupt virtual texture: " << path << std::endl;
+			return;
+		}
+		resident.emplace_back((size_t)level.tilesX * level.tilesY, -1);
+	}
+
+	// Slots are addressed by a byte each way in the page table
+	GLint maxSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	this->cacheTiles = std::min(std::min(cacheTiles, 256), maxSize / tileSide);
+	if (this->cacheTiles < 1)
+	{
+		std::cout << "Virtual texture tiles are too big: " << path << std::endl;
+		return;
+	}
+	slots.resize((size_t)this->cacheTiles * this->cacheTiles);
+
+	TextureFormat format = NegotiateFormat(4);
+	int physicalSize = this->cacheTiles * tileSide;
+	glGenTextures(1, &physical);
+	glBindTexture(GL_TEXTURE_2D, physical);
+	if (!AllocateStorage(format.internalFormat, physicalSize, physicalSize, 1))
+	{
+		UploadLevel(false, 0, format.internalFormat, physicalSize, physicalSize, format.format, format.type, nullptr, 0);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glGenTextures(1, &pageTable);
+	glBindTexture(GL_TEXTURE_2D, pageTable);
+	if (!AllocateStorage(format.internalFormat, header.pageTableSize, header.pageTableSize, header.levels))
+	{
+		for (uint32_t i = 0; i < header.levels; i++)
+		{
+			int size = header.pageTableSize >> i;
+			UploadLevel(false, i, format.internalFormat, size, size, format.format, format.type, nullptr, 0);
+		}
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.levels - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// The coarsest level is a single tile that stays in the first slot, so
+	// every lookup has something to fall back on
+	Tile top = { (int)header.levels - 1, 0, 0, {} };
+	const unsigned char* data = tileData(top.level, 0, 0);
+	top.pixels.assign(data, data + tileBytes);
+	upload(0, top);
+	rebuildPageTable();
+
+	readbacks.resize(FEEDBACK_READBACKS);
+	for (Readback& readback : readbacks)
+	{
+		glGenBuffers(1, &readback.PBO);
+	}
+	thread = std::thread(&VirtualTexture::work, this);
+}
+
+VirtualTexture::~VirtualTexture()
+{
+	if (thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		thread.join();
+	}
+	for (Readback& readback : readbacks)
+	{
+		if (readback.fence)
+		{
+			glDeleteSync(readback.fence);
+		}
+		glDeleteBuffers(1, &readback.PBO);
+	}
+	glDeleteFramebuffers(1, &feedbackFramebuffer);
+	glDeleteRenderbuffers(1, &feedbackColor);
+	glDeleteRenderbuffers(1, &feedbackDepth);
+	glDeleteTextures(1, &pageTable);
+	glDeleteTextures(1, &physical);
+}
+
+void VirtualTexture::bind(Shader& shader, GLuint pageTableUnit, GLuint physicalUnit) const
+{
+	// The lookups pick their own filtering, which a sampler would override
+	glActiveTexture(GL_TEXTURE0 + pageTableUnit);
+	glBindTexture(GL_TEXTURE_2D, pageTable);
+	glBindSampler(pageTableUnit, 0);
+	glActiveTexture(GL_TEXTURE0 + physicalUnit);
+	glBindTexture(GL_TEXTURE_2D, physical);
+	glBindSampler(physicalUnit, 0);
+	glActiveTexture(GL_TEXTURE0);
+
+	shader.use();
+	shader.setInt("pageTable", (int)pageTableUnit);
+	shader.setInt("physical", (int)physicalUnit);
+	glUniform2f(glGetUniformLocation(shader.ID, "virtualSize"), (float)header.width, (float)header.height);
+	shader.setFloat("tileSize", (float)header.tileSize);
+	shader.setFloat("border", (float)header.border);
+	shader.setFloat("physicalSize", (float)(cacheTiles * tileSide));
+	shader.setFloat("maxLevel", (float)(header.levels - 1));
+	shader.setFloat("feedbackBias", -std::log2((float)FEEDBACK_SCALE));
+}
+
+void VirtualTexture::beginFeedback(int width, int height)
+{
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+	glGetIntegerv(GL_VIEWPORT, previousViewport);
+
+	// Made again whenever the screen changes size
+	width = std::max(1, width / FEEDBACK_SCALE);
+	height = std::max(1, height / FEEDBACK_SCALE);
+	if (!feedbackFramebuffer)
+	{
+		glGenFramebuffers(1, &feedbackFramebuffer);
+		glGenRenderbuffers(1, &feedbackColor);
+		glGenRenderbuffers(1, &feedbackDepth);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+	if (width != feedbackWidth || height != feedbackHeight)
+	{
+		feedbackWidth = width;
+		feedbackHeight = height;
+		glBindRenderbuffer(GL_RENDERBUFFER, feedbackColor);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, feedbackColor);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+	}
+	glViewport(0, 0, feedbackWidth, feedbackHeight);
+	// An alpha of 0 marks pixels nothing was drawn to
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void VirtualTexture::endFeedback()
+{
+	// Rather than wait on the GPU, a pass is dropped when every readback is
+	// still in flight
+	Readback& readback = readbacks[nextReadback];
+	if (!readback.fence)
+	{
+		nextReadback = (nextReadback + 1) % readbacks.size();
+		size_t size = (size_t)feedbackWidth * feedbackHeight * 4;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.PBO);
+		if (readback.size != size)
+		{
+			glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+			readback.size = size;
+		}
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+	glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+}
+
+void VirtualTexture::update()
+{
+	if (!valid())
+	{
+		return;
+	}
+	frame++;
+
+	for (Readback& readback : readbacks)
+	{
+		if (!readback.fence)
+		{
+			continue;
+		}
+		GLenum status = glClientWaitSync(readback.fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		{
+			continue;
+		}
+		glDeleteSync(readback.fence);
+		readback.fence = nullptr;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.PBO);
+		const unsigned char* pixels = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, readback.size, GL_MAP_READ_BIT);
+		if (pixels)
+		{
+			readFeedback(pixels, readback.size / 4);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	for (int i = 0; i < tilesPerFrame; i++)
+	{
+		Tile tile;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (loaded.empty())
+			{
+				break;
+			}
+			tile = std::move(loaded.front());
+			loaded.pop_front();
+		}
+		requested.erase(TileKey(tile.level, tile.x, tile.y));
+
+		// Take a free slot, or else the one seen longest ago. The first slot
+		// holds the coarsest level and is never given up
+		int best = -1;
+		for (size_t j = 1; j < slots.size(); j++)
+		{
+			if (slots[j].level < 0)
+			{
+				best = (int)j;
+				break;
+			}
+			if (slots[j].lastUsed + EVICT_AFTER_FRAMES < frame && (best < 0 || slots[j].lastUsed < slots[best].lastUsed))
+			{
+				best = (int)j;
+			}
+		}
+		if (best < 0)
+		{
+			// Everything is in use, so it waits until feedback asks again
+			continue;
+		}
+		Slot& slot = slots[best];
+		if (slot.level >= 0)
+		{
+			resident[slot.level][(size_t)slot.y * levels[slot.level].tilesX + slot.x] = -1;
+		}
+		upload(best, tile);
+	}
+
+	if (pageTableDirty)
+	{
+		rebuildPageTable();
+	}
+}
+
+int VirtualTexture::residentTiles() const
+{
+	int count = 0;
+	for (const Slot& slot : slots)
+	{
+		count += slot.level >= 0;
+	}
+	return count;
+}
+
+const unsigned char* VirtualTexture::tileData(int level, int x, int y) const
+{
+	return file.data() + levels[level].offset + ((size_t)y * levels[level].tilesX + x) * tileBytes;
+}
+
+void VirtualTexture::upload(int slot, const Tile& tile)
+{
+	glBindTexture(GL_TEXTURE_2D, physical);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % cacheTiles) * tileSide, (slot / cacheTiles) * tileSide, tileSide, tileSide,
+		GL_RGBA, GL_UNSIGNED_BYTE, tile.pixels.data());
+	glBindTexture(GL_TEXTURE_2D, 0);
+	slots[slot] = { tile.level, tile.x, tile.y, frame };
+	resident[tile.level][(size_t)tile.y * levels[tile.level].tilesX + tile.x] = slot;
+	pageTableDirty = true;
+}
+
+void VirtualTexture::readFeedback(const unsigned char* pixels, size_t count)
+{
+	// Feedback pixels hold the low bytes of the tile's x and y in R and G,
+	// their high nibbles in B and the level plus one in A
+	std::unordered_set<uint64_t> seen;
+	std::vector<Tile> missing;
+	for (size_t i = 0; i < count; i++)
+	{
+		const unsigned char* pixel = pixels + i * 4;
+		int level = pixel[3] - 1;
+		int x = pixel[0] | ((pixel[2] & 15) << 8);
+		int y = pixel[1] | ((pixel[2] >> 4) << 8);
+		if (level < 0 || level >= (int)header.levels || x >= (int)levels[level].tilesX || y >= (int)levels[level].tilesY ||
+			!seen.insert(TileKey(level, x, y)).second)
+		{
+			continue;
+		}
+
+		// Whatever stands in for a missing tile is in use too. The coarsest
+		// level is always resident, so there's always something
+		int l = level, lx = x, ly = y;
+		while (resident[l][(size_t)ly * levels[l].tilesX + lx] < 0)
+		{
+			l++;
+			lx = std::min(lx / 2, (int)levels[l].tilesX - 1);
+			ly = std::min(ly / 2, (int)levels[l].tilesY - 1);
+		}
+		slots[resident[l][(size_t)ly * levels[l].tilesX + lx]].lastUsed = frame;
+		if (l != level && !requested.count(TileKey(level, x, y)))
+		{
+			missing.push_back({ level, x, y, {} });
+		}
+	}
+
+	// Coarse tiles first, since each covers more of the screen, and no more
+	// than a few frames' uploads so the queue doesn't fall behind the view
+	std::sort(missing.begin(), missing.end(), [](const Tile& a, const Tile& b) { return a.level > b.level; });
+	missing.resize(std::min(missing.size(), (size_t)tilesPerFrame * 4));
+	if (missing.empty())
+	{
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (Tile& tile : missing)
+		{
+			requested.insert(TileKey(tile.level, tile.x, tile.y));
+			queued.push_back(std::move(tile));
+		}
+	}
+	wake.notify_one();
+}
+
+void VirtualTexture::rebuildPageTable()
+{
+	// Top down, so a tile that isn't resident can copy its parent's entry
+	std::vector<unsigned char> parent, entries;
+	glBindTexture(GL_TEXTURE_2D, pageTable);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	for (int level = (int)header.levels - 1; level >= 0; level--)
+	{
+		int across = (int)header.pageTableSize >> level;
+		entries.assign((size_t)across * across * 4, 0);
+		for (int y = 0; y < across; y++)
+		{
+			for (int x = 0; x < across; x++)
+			{
+				unsigned char* entry = &entries[((size_t)y * across + x) * 4];
+				bool inside = x < (int)levels[level].tilesX && y < (int)levels[level].tilesY;
+				int slot = inside ? resident[level][(size_t)y * levels[level].tilesX + x] : -1;
+				if (slot >= 0)
+				{
+					entry[0] = (unsigned char)(slot % cacheTiles);
+					entry[1] = (unsigned char)(slot / cacheTiles);
+					entry[2] = (unsigned char)level;
+					entry[3] = 255;
+				}
+				else if (!parent.empty())
+				{
+					memcpy(entry, &parent[((size_t)(y / 2) * (across / 2) + x / 2) * 4], 4);
+				}
+			}
+		}
+		glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, across, across, GL_RGBA, GL_UNSIGNED_BYTE, entries.data());
+		parent.swap(entries);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	pageTableDirty = false;
+}
+
+void VirtualTexture::work()
+{
+	for (;;)
+	{
+		Tile tile;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this]() { return stopping || !queued.empty(); });
+			if (stopping) return;
+			tile = std::move(queued.front());
+			queued.pop_front();
+		}
+
+		// Copying the tile out is what faults its pages in from disk
+		const unsigned char* data = tileData(tile.level, tile.x, tile.y);
+		tile.pixels.assign(data, data + tileBytes);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		loaded.push_back(std::move(tile));
+	}
+}
@@ -0,0 +1,155 @@
+﻿#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <glad/glad.h>
+
+#include "MappedFile.hpp"
+#include "Shader.hpp"
+
+// A virtual texture file holds an image cut into square RGBA8 tiles at
+// every mip level, down to the level that fits in one tile. Each tile has a
+// border copied from its neighbours so that it can be filtered on its own,
+// and is stored bottom row first. The file is this header, a VirtualLevel
+// per level and then each level's tiles row by row, little endian
+const uint32_t VIRTUAL_MAGIC = 0x58455456; // "VTEX"
+const uint32_t VIRTUAL_VERSION = 1;
+const uint32_t VIRTUAL_BORDER = 1;
+// The feedback pass writes tile coordinates in 12 bits, so level 0 is at
+// most 4096 tiles across
+const uint32_t VIRTUAL_MAX_LEVELS = 13;
+
+struct VirtualHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t tileSize; // not counting the border
+	uint32_t border;
+	uint32_t levels;
+	uint32_t pageTableSize; // tiles across level 0, a power of two
+};
+
+struct VirtualLevel
+{
+	uint64_t offset; // of the first tile, from the start of the file
+	uint32_t tilesX;
+	uint32_t tilesY;
+};
+
+// Cuts an image up into a virtual texture file. The image is decoded a strip
+// of tiles at a time and each coarser level filtered down from strips of the
+// one before, so memory use is a few strips of level 0 however big the image.
+// Fails if the image is more than 4096 tiles across, see VIRTUAL_MAX_LEVELS
+bool BakeVirtualTexture(const char* imagePath, const char* virtualPath, int tileSize = 128);
+
+// Draws from an image far bigger than VRAM with a fixed amount of it
+// resident. A physical texture caches tiles in slots, and a page table
+// texture with a texel per tile at every level points each one at its slot,
+// or at the slot of the nearest coarser tile that is resident. The feedback
+// pass draws the scene small with shaders/VirtualFeedbackFragmentShader.glsl,
+// writing out the tile each pixel wants, and is read back a few frames
+// later without stalling. A worker reads missing tiles from a mapping of
+// the file and update() uploads a few a frame over the least recently seen.
+// shaders/VirtualFragmentShader.glsl does the lookup when drawing. Needs
+// the OpenGL 3.3 context current
+class VirtualTexture
+{
+public:
+	// The feedback pass renders at this fraction of the screen's size
+	static const int FEEDBACK_SCALE = 8;
+
+	// cacheTiles is how many tiles across the physical texture is, and
+	// tilesPerFrame how many update() uploads at most
+	VirtualTexture(const char* path, int cacheTiles = 16, int tilesPerFrame = 4);
+	~VirtualTexture();
+	VirtualTexture(const VirtualTexture&) = delete;
+	VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+	// False if the file was missing or corrupt
+	bool valid() const { return physical != 0; }
+
+	// Binds the page table and physical textures to two units and sets the
+	// shader's uniforms to match, for both the feedback and drawing shaders
+	void bind(Shader& shader, GLuint pageTableUnit, GLuint physicalUnit) const;
+
+	// Draw the scene with the feedback shader between these. width and height
+	// are the size of the screen
+	void beginFeedback(int width, int height);
+	void endFeedback();
+
+	// Reads back feedback that's ready, asks the worker for tiles that are
+	// missing and uploads ones it has read. Call it once a frame
+	void update();
+
+	int residentTiles() const;
+
+private:
+	struct Slot
+	{
+		int level = -1; // free
+		int x = 0;
+		int y = 0;
+		uint64_t lastUsed = 0;
+	};
+
+	struct Tile
+	{
+		int level;
+		int x;
+		int y;
+		std::vector<unsigned char> pixels;
+	};
+
+	struct Readback
+	{
+		GLuint PBO = 0;
+		GLsync fence = nullptr;
+		size_t size = 0;
+	};
+
+	const unsigned char* tileData(int level, int x, int y) const;
+	void upload(int slot, const Tile& tile);
+	void readFeedback(const unsigned char* pixels, size_t count);
+	void rebuildPageTable();
+	void work();
+
+	MappedFile file;
+	VirtualHeader header = {};
+	std::vector<VirtualLevel> levels;
+	int tileSide = 0; // with the border
+	size_t tileBytes = 0;
+	int cacheTiles = 0;
+	int tilesPerFrame;
+	uint64_t frame = 1;
+
+	GLuint physical = 0;
+	GLuint pageTable = 0;
+	std::vector<Slot> slots;
+	std::vector<std::vector<int>> resident; // slot of each tile, or -1
+	std::unordered_set<uint64_t> requested;
+	bool pageTableDirty = false;
+
+	GLuint feedbackFramebuffer = 0;
+	GLuint feedbackColor = 0;
+	GLuint feedbackDepth = 0;
+	int feedbackWidth = 0;
+	int feedbackHeight = 0;
+	GLint previousFramebuffer = 0;
+	GLint previousViewport[4] = {};
+	std::vector<Readback> readbacks;
+	size_t nextReadback = 0;
+
+	// The worker waits on wake for tiles to read, or to stop
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<Tile> queued;
+	std::deque<Tile> loaded;
+	bool stopping = false;
+	std::thread thread;
+};
@@ -3,9 +3,18 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <cstring>
 #include <iostream>
 
+#include "common/BakedTexture.hpp"
+#include "common/JpegDecoder.hpp"
+#include "common/MipGenerator.hpp"
+#include "common/SamplerCache.hpp"
 #include "common/Shader.hpp"
+#include "common/TextureCache.hpp"
+#include "common/TextureFormat.hpp"
+#include "common/VirtualTexture.hpp"
+#include "common/TextureStreamer.hpp"
 #include "stb_image.h"
 
 
@@ -74,34 +83,65 @@ GLuint LoadVAO(
 	return VAO;
 }
 
-GLuint LoadImage(const char* path, GLenum format)
+// Uploads a JPEG's Y, Cb and Cr planes as three single channel textures at
+// their stored resolution, leaving chroma upsampling and color conversion to
+// the fragment shader. Returns false without creating anything if the image
+// isn't stored as YCbCr.
+bool LoadImageYCbCr(const char* path, GLuint textures[3])
 {
-	GLuint texture;
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
-
-	// Load data into the texture
-	int width, height, numChannels;
-	unsigned char* data = stbi_load(path, &width, &height, &numChannels, 0);
-	if (data)
+	int width, height, planeWidths[3], planeHeights[3];
+	unsigned char* data = stbi_load_ycbcr(path, &width, &height, planeWidths, planeHeights);
+	if (!data)
 	{
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
+		return false;
 	}
-	else
+
+	// Plane rows are tightly packed, so rarely 4 byte aligned
+	TextureFormat format = NegotiateFormat(1);
+	glGenTextures(3, textures);
+	unsigned char* plane = data;
+	for (int i = 0; i < 3; i++)
 	{
-		std::cout << "Faile to load texture: " << path << std::endl;
+		glBindTexture(GL_TEXTURE_2D, textures[i]);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, UnpackAlignment(planeWidths[i]));
+		bool allocated = AllocateStorage(format.internalFormat, planeWidths[i], planeHeights[i], MipLevels(planeWidths[i], planeHeights[i]));
+		UploadLevel(allocated, 0, format.internalFormat, planeWidths[i], planeHeights[i], format.format, format.type, plane, 0);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		plane += (size_t)planeWidths[i] * planeHeights[i];
 	}
-	
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
 	// Cleanup
 	stbi_image_free(data);
 	glBindTexture(GL_TEXTURE_2D, 0);
 
-	return texture;
+	return true;
 }
 
-int main()
+int main(int argc, char** argv)
 {
+	// Run as a build step, bakes the images under a directory and exits
+	if (argc == 3 && strcmp(argv[1], "--bake") == 0)
+	{
+		int baked = BakeTextures(argv[2]);
+		if (baked < 0)
+		{
+			return 1;
+		}
+		std::cout << "Baked " << baked << " textures" << std::endl;
+		return 0;
+	}
+	// Cuts an image too big to load whole into tiles for VirtualTexture
+	if (argc == 4 && strcmp(argv[1], "--bake-virtual") == 0)
+	{
+		if (!BakeVirtualTexture(argv[2], argv[3]))
+		{
+			std::cout << "Failed to bake " << argv[2] << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
 	// Initialise cross-platform window support using core profile
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -147,55 +187,119 @@ int main()
 	};
 	GLuint VAO = LoadVAO(vertices, 4, indices, 6, true, true);
 
-	// Shaders
-	Shader shader = Shader("shaders/SimpleVertexShader.glsl", "shaders/SimpleFragmentShader.glsl");
-	stbi_set_flip_vertically_on_load(true);
-	GLuint texture1 = LoadImage("Resources/container.jpg", GL_RGB);
-	GLuint texture2 = LoadImage("Resources/awesomeface.png", GL_RGBA);
-	shader.use();
-	shader.setInt("texture1", 0);
-	shader.setInt("texture2", 1);
-
-	// How to sample textures outside of the texture size
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-	// If using GL_CLAMP_TO_BORDER, a border color needs to be defined
-	/*float borderColor[]{ 1.0f, 1.0f, 0.0f, 1.0f };
-	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);*/
-	// How to sample textures dependening on minifying or magnifiying
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	// ========================================================================
-	// Render loop
-	while (!glfwWindowShouldClose(window))
+	// The streamer, cache, decoder and samplers free GL objects as they're
+	// destroyed, so they're scoped to go before glfwTerminate takes the context
 	{
-		// Initialise new frame
-		glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT);
-
-		// Transform
-		glm::mat4 trans = glm::mat4(1.0f);
-		trans = glm::translate(trans, glm::vec3(0.5f, -0.5f, 0.0f));
-		trans = glm::rotate(trans, (float)glfwGetTime(), glm::vec3(0.0f, 0.0f, 1.0f));
-		//trans = glm::scale(trans, glm::vec3(0.5f, 0.5f, 0.5f));
-		GLuint location = glGetUniformLocation(shader.ID, "transform");
-		glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(trans));
-
-		// Draw
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, texture1);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, texture2);
-		//glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-
-		// Display and interaction
-		glfwSwapBuffers(window);
-		glfwPollEvents();
-		processInput(window);
+		// Textures. The container is decoded on the GPU when possible, otherwise
+		// its YCbCr planes are uploaded as they are, with texture1 holding luma
+		// and the shader converting to RGB. Anything else streams in through the
+		// cache, showing a placeholder until it's ready, with gamma-correct
+		// mipmaps made on the workers and block compressed when the driver
+		// supports it
+		stbi_set_flip_vertically_on_load(true);
+		TextureStreamer textureStreamer;
+		textureStreamer.setCompression(true);
+		textureStreamer.setCpuMipmaps(true);
+		// Uploads take no more than about 2ms of a frame, smallest mip levels
+		// first, so a big image streaming in doesn't hitch the loop
+		textureStreamer.setUploadBudget(4 * 1024 * 1024, 2.0f);
+		TextureCache textureCache(textureStreamer);
+		// Past this, textures that haven't been drawn lately lose mip levels,
+		// then are evicted
+		textureCache.setBudget(64 * 1024 * 1024);
+		JpegDecoder jpegDecoder;
+		GLuint texture1 = jpegDecoder.load("Resources/container.jpg");
+		GLuint planes[3];
+		bool planar = !texture1 && LoadImageYCbCr("Resources/container.jpg", planes);
+		int container = -1;
+		if (!texture1 && !planar)
+		{
+			container = textureCache.acquire("Resources/container.jpg", GL_RGB);
+		}
+		else if (planar)
+		{
+			texture1 = planes[0];
+		}
+		int face = textureCache.acquire("Resources/awesomeface.png", GL_RGBA);
+
+		// Shaders
+		const char* fragmentShader = planar ? "shaders/YCbCrFragmentShader.glsl" : "shaders/SimpleFragmentShader.glsl";
+		Shader shader = Shader("shaders/SimpleVertexShader.glsl", fragmentShader);
+		shader.use();
+		shader.setInt("texture1", 0);
+		shader.setInt("texture2", 1);
+		if (planar)
+		{
+			shader.setInt("textureCb", 2);
+			shader.setInt("textureCr", 3);
+		}
+
+		// Sampling state lives in a sampler bound to each unit alongside the
+		// textures, so it reaches every texture whatever loaded it
+		SamplerCache samplerCache;
+		SamplerDesc sampling;
+		// How to sample textures outside of the texture size
+		sampling.wrapS = GL_MIRRORED_REPEAT;
+		sampling.wrapT = GL_MIRRORED_REPEAT;
+		// If using GL_CLAMP_TO_BORDER, a border color needs to be defined
+		/*sampling.borderColor[0] = sampling.borderColor[1] = sampling.borderColor[3] = 1.0f;*/
+		// How to sample textures dependening on minifying or magnifiying
+		sampling.minFilter = GL_LINEAR_MIPMAP_LINEAR;
+		sampling.magFilter = GL_LINEAR;
+		GLuint sampler = samplerCache.get(sampling);
+
+		// ========================================================================
+		// Render loop
+		while (!glfwWindowShouldClose(window))
+		{
+			// Initialise new frame
+			textureStreamer.update();
+			textureCache.update();
+			glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+			glClear(GL_COLOR_BUFFER_BIT);
+
+			// Transform
+			glm::mat4 trans = glm::mat4(1.0f);
+			trans = glm::translate(trans, glm::vec3(0.5f, -0.5f, 0.0f));
+			trans = glm::rotate(trans, (float)glfwGetTime(), glm::vec3(0.0f, 0.0f, 1.0f));
+			//trans = glm::scale(trans, glm::vec3(0.5f, 0.5f, 0.5f));
+			GLuint location = glGetUniformLocation(shader.ID, "transform");
+			glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(trans));
+
+			// Draw. The quad covers half the screen's height, which is the most
+			// detail the cache needs to keep for its textures
+			float quadSize = SCREEN_HEIGHT * 0.5f;
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, container < 0 ? texture1 : textureCache.use(container, quadSize));
+			glBindSampler(0, sampler);
+			glActiveTexture(GL_TEXTURE1);
+			glBindTexture(GL_TEXTURE_2D, textureCache.use(face, quadSize));
+			glBindSampler(1, sampler);
+			if (planar)
+			{
+				glActiveTexture(GL_TEXTURE2);
+				glBindTexture(GL_TEXTURE_2D, planes[1]);
+				glBindSampler(2, sampler);
+				glActiveTexture(GL_TEXTURE3);
+				glBindTexture(GL_TEXTURE_2D, planes[2]);
+				glBindSampler(3, sampler);
+			}
+			//glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+			glBindVertexArray(VAO);
+			glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+			glBindVertexArray(0);
+
+			// Display and interaction
+			glfwSwapBuffers(window);
+			glfwPollEvents();
+			processInput(window);
+		}
+
+		textureCache.release(face);
+		if (container >= 0)
+		{
+			textureCache.release(container);
+		}
 	}
 
 	glfwTerminate();
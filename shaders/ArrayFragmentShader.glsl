@@ -0,0 +1,16 @@
+#version 330 core
+in vec3 color;
+in vec2 UV;
+
+// Both images are layers of one array texture
+uniform sampler2DArray textures;
+uniform int layer1;
+uniform int layer2;
+
+out vec4 fragColor;
+
+void main()
+{
+	// mix(A, B, val) = A * (1-val) + B * val
+	fragColor = mix(texture(textures, vec3(UV, layer1)), texture(textures, vec3(UV, layer2)), 0.2) * vec4(color, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,50 @@
+#version 330 core
+
+// Last JPEG pass, writing each image pixel from the decoded planes
+uniform sampler2D planeY;
+uniform sampler2D planeCb;
+uniform sampler2D planeCr;
+
+// Plane samples per image pixel, and how many of each plane's samples are
+// real rather than padding out the last block
+uniform vec2 planeScale[3];
+uniform vec2 planeSize[3];
+
+uniform float imageHeight;
+uniform bool flip;
+uniform bool grayscale;
+
+out vec4 fragColor;
+
+// Bilinear filtering between the samples around a pixel matches the 2x
+// chroma upsampling stb_image does, and clamping repeats the edge samples
+float SamplePlane(sampler2D plane, int index, vec2 pixel)
+{
+	vec2 position = clamp(pixel * planeScale[index], vec2(0.5), planeSize[index] - 0.5);
+	return texture(plane, position / vec2(textureSize(plane, 0))).r;
+}
+
+// JFIF full range conversion, as done on the CPU by stb_image
+vec3 YCbCrToRGB(float y, float cb, float cr)
+{
+	cb -= 128.0 / 255.0;
+	cr -= 128.0 / 255.0;
+	return clamp(vec3(y + 1.402 * cr, y - 0.344136 * cb - 0.714136 * cr, y + 1.772 * cb), 0.0, 1.0);
+}
+
+void main()
+{
+	vec2 pixel = gl_FragCoord.xy;
+	if (flip)
+	{
+		pixel.y = imageHeight - pixel.y;
+	}
+
+	float y = SamplePlane(planeY, 0, pixel);
+	if (grayscale)
+	{
+		fragColor = vec4(y, y, y, 1.0);
+		return;
+	}
+	fragColor = vec4(YCbCrToRGB(y, SamplePlane(planeCb, 1, pixel), SamplePlane(planeCr, 2, pixel)), 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+#version 330 core
+
+// Second half of the separable IDCT, transforming the columns of the row
+// pass's output into level shifted 8 bit samples
+uniform sampler2D rows;
+
+out float value;
+
+const float PI = 3.14159265358979;
+
+void main()
+{
+	ivec2 texel = ivec2(gl_FragCoord.xy);
+	int blockY = texel.y & ~7;
+	int y = texel.y & 7;
+
+	float sum = 0.0;
+	for (int v = 0; v < 8; v++)
+	{
+		float scale = v == 0 ? sqrt(0.125) : 0.5;
+		sum += scale * texelFetch(rows, ivec2(texel.x, blockY + v), 0).r * cos(float((2 * y + 1) * v) * PI / 16.0);
+	}
+	value = clamp((sum + 128.0) / 255.0, 0.0, 1.0);
+}
\ No newline at end of file
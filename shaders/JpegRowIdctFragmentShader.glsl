@@ -0,0 +1,28 @@
+#version 330 core
+
+// First half of the separable IDCT. Dequantizes each 8x8 block of
+// coefficients and transforms its rows, so texel (x, v) of a block holds
+// vertical frequency v at horizontal sample x
+uniform isampler2D coefficients;
+uniform float quant[64];
+
+out float value;
+
+const float PI = 3.14159265358979;
+
+void main()
+{
+	ivec2 texel = ivec2(gl_FragCoord.xy);
+	int blockX = texel.x & ~7;
+	int x = texel.x & 7;
+	int v = texel.y & 7;
+
+	float sum = 0.0;
+	for (int u = 0; u < 8; u++)
+	{
+		float coefficient = float(texelFetch(coefficients, ivec2(blockX + u, texel.y), 0).r) * quant[v * 8 + u];
+		float scale = u == 0 ? sqrt(0.125) : 0.5;
+		sum += scale * coefficient * cos(float((2 * x + 1) * u) * PI / 16.0);
+	}
+	value = sum;
+}
\ No newline at end of file
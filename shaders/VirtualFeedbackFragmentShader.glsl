@@ -0,0 +1,23 @@
+#version 330 core
+in vec2 UV;
+
+uniform vec2 virtualSize;
+uniform float tileSize;
+uniform float maxLevel;
+// The pass is drawn small, which makes the derivatives bigger
+uniform float feedbackBias;
+
+out vec4 fragColor;
+
+void main()
+{
+	// The same level VirtualFragmentShader picks at full size
+	vec2 texels = clamp(UV, 0.0, 0.99999) * virtualSize;
+	vec2 dx = dFdx(texels);
+	vec2 dy = dFdy(texels);
+	float level = clamp(floor(0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + feedbackBias), 0.0, maxLevel);
+	ivec2 tile = ivec2(texels / (tileSize * exp2(level)));
+
+	// The low bytes of x and y, their high nibbles, and the level plus one
+	fragColor = vec4(tile.x & 255, tile.y & 255, (tile.x >> 8) | ((tile.y >> 8) << 4), level + 1.0) / 255.0;
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#version 330 core
+in vec3 color;
+in vec2 UV;
+
+// Page table texels hold a tile's slot in the physical texture in R and G,
+// and the level of the tile that's actually there in B
+uniform sampler2D pageTable;
+uniform sampler2D physical;
+uniform vec2 virtualSize;
+uniform float tileSize;
+uniform float border;
+uniform float physicalSize;
+uniform float maxLevel;
+
+out vec4 fragColor;
+
+void main()
+{
+	vec2 texels = clamp(UV, 0.0, 0.99999) * virtualSize;
+	vec2 dx = dFdx(texels);
+	vec2 dy = dFdy(texels);
+	float level = clamp(floor(0.5 * log2(max(dot(dx, dx), dot(dy, dy)))), 0.0, maxLevel);
+	ivec2 tile = ivec2(texels / (tileSize * exp2(level)));
+	vec3 entry = floor(texelFetch(pageTable, tile, int(level)).rgb * 255.0 + 0.5);
+
+	// Where the texel falls within the tile at the level that's resident
+	vec2 levelTexels = texels / exp2(entry.b);
+	vec2 inTile = levelTexels - floor(levelTexels / tileSize) * tileSize;
+	vec2 position = entry.rg * (tileSize + 2.0 * border) + border + inTile;
+	fragColor = textureLod(physical, position / physicalSize, 0.0) * vec4(color, 1.0);
+}
\ No newline at end of file
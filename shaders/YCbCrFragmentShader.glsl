@@ -0,0 +1,27 @@
+#version 330 core
+in vec3 color;
+in vec2 UV;
+
+// texture1 holds luma, sampled alongside the chroma planes at the same UV
+// whatever their resolution, so bilinear filtering does the upsampling
+uniform sampler2D texture1;
+uniform sampler2D textureCb;
+uniform sampler2D textureCr;
+uniform sampler2D texture2;
+
+out vec4 fragColor;
+
+// JFIF full range conversion, as done on the CPU by stb_image
+vec3 YCbCrToRGB(float y, float cb, float cr)
+{
+	cb -= 128.0 / 255.0;
+	cr -= 128.0 / 255.0;
+	return clamp(vec3(y + 1.402 * cr, y - 0.344136 * cb - 0.714136 * cr, y + 1.772 * cb), 0.0, 1.0);
+}
+
+void main()
+{
+	vec4 base = vec4(YCbCrToRGB(texture(texture1, UV).r, texture(textureCb, UV).r, texture(textureCr, UV).r), 1.0);
+	// mix(A, B, val) = A * (1-val) + B * val
+	fragColor = mix(base, texture(texture2, UV), 0.2) * vec4(color, 1.0);
+}
\ No newline at end of file
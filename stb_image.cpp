@@ -1,2 +1,3 @@
 #define STB_IMAGE_IMPLEMENTATION
+#define STBI_PARALLEL_INFLATE
 #include "stb_image.h"
@@ -327,6 +327,10 @@ RECENT REVISION HISTORY:
 //   - If you use STBI_NO_PNG (or _ONLY_ without PNG), and you still
 //     want the zlib decoder to be available, #define STBI_SUPPORT_ZLIB
 //
+//  - If you define STBI_PARALLEL_INFLATE, large zlib streams (such as the
+//    image data of big PNGs) are inflated on several threads, using
+//    pthreads or Win32 threads. See stbi_set_inflate_threads().
+//
 //  - If you define STBI_MAX_DIMENSIONS, stb_image will reject images greater
 //    than that size (in either width or height) without further processing.
 //    This is to let programs in the wild set an upper bound to prevent
@@ -335,6 +339,11 @@ RECENT REVISION HISTORY:
 //    huge block of memory and spend disproportionate time decoding it. By
 //    default this is set to (1 << 24), which is 16777216, but that's still
 //    very big.
+//
+//  - Where size_t is 64 bits, a JPEG or PNG can be loaded into more than 2GB
+//    (an interlaced PNG, or a 16-bit one loaded with stbi_load_16, still
+//    stops at 1GB); other formats stop at what an int can count. Images too
+//    big to hold at all can go through stbi_load_tiles() a strip at a time.
 
 #ifndef STBI_NO_STDIO
 #include <stdio.h>
@@ -402,6 +411,163 @@ STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp);
 #endif
 
+////////////////////////////////////
+//
+// row streaming interface
+//
+// decodes into 'callback' a band of rows at a time instead of returning the
+// whole image. non-interlaced PNGs and JPEGs are decoded incrementally, so
+// memory use stays bounded by a few rows plus the inflate window (or for
+// progressive and multi-scan JPEGs, the undecoded image) however big the
+// image is; other images are decoded whole and then handed over in bands.
+//
+// rows are 8-bit, tightly packed (x*channels bytes each), and 'y' is the
+// image row of the first one. with vertical flipping on, each band arrives
+// already flipped and the bands arrive from the bottom of the image up.
+// x, y and channels_in_file are written before the first callback. the
+// callback returns 0 to stop decoding; all functions return 1 on success.
+typedef int stbi_rows_callback(void *user, stbi_uc *rows, int y, int num_rows);
+
+STBIDEF int stbi_load_rows_from_memory   (stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_rows_callback *callback, void *callback_user);
+STBIDEF int stbi_load_rows_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *channels_in_file, int desired_channels, stbi_rows_callback *callback, void *callback_user);
+
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_rows          (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, stbi_rows_callback *callback, void *callback_user);
+STBIDEF int stbi_load_rows_from_file(FILE *f, int *x, int *y, int *channels_in_file, int desired_channels, stbi_rows_callback *callback, void *callback_user);
+// for stbi_load_rows_from_file, the file position afterwards is unspecified
+#endif
+
+////////////////////////////////////
+//
+// tiled interface
+//
+// decodes into 'callback' tiles of tile_w*tile_h pixels, for images too big
+// to hold at once. the rows come from stbi_load_rows and are gathered a
+// strip of tiles at a time, so on top of what that needs memory use is one
+// strip (x*tile_h pixels). each tile is tightly packed and those on the
+// right and bottom edges are cut short; (tx,ty) is its place in tiles and
+// w,h its size. with vertical flipping on, tiles are in flipped coordinates
+// and the strips arrive bottom up. the callback returns 0 to stop decoding;
+// all functions return 1 on success.
+typedef int stbi_tile_callback(void *user, stbi_uc *tile, int tx, int ty, int w, int h);
+
+STBIDEF int stbi_load_tiles_from_memory   (stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, int tile_w, int tile_h, stbi_tile_callback *callback, void *callback_user);
+STBIDEF int stbi_load_tiles_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *channels_in_file, int desired_channels, int tile_w, int tile_h, stbi_tile_callback *callback, void *callback_user);
+
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_tiles          (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, int tile_w, int tile_h, stbi_tile_callback *callback, void *callback_user);
+STBIDEF int stbi_load_tiles_from_file(FILE *f, int *x, int *y, int *channels_in_file, int desired_channels, int tile_w, int tile_h, stbi_tile_callback *callback, void *callback_user);
+#endif
+
+////////////////////////////////////
+//
+// push decoding interface
+//
+// for data that arrives a piece at a time, e.g. from a pipe or a chunked
+// archive. stbi_push_feed takes whatever bytes are available, decodes as far
+// as they go and hands any rows that are done to 'callback', as for
+// stbi_load_rows; it never waits for more. non-interlaced PNGs and baseline
+// JPEGs are decoded like this, so decoding overlaps with I/O. progressive
+// and multi-scan JPEGs and other formats are collected and decoded by
+// stbi_push_end, which is how the caller says there's no more data.
+//
+// vertical flipping follows the setting when decoding starts: when the
+// header arrives, or at stbi_push_end for what's decoded there. feed and end
+// return 0 on failure, after which the decoder ignores everything. poll
+// returns one of the STBI_PUSH_ states, the image size once known (0
+// before) and how many rows have been delivered. stbi_push_free is needed
+// in every case.
+typedef struct stbi__push stbi_push;
+
+enum
+{
+   STBI_PUSH_error = -1,
+   STBI_PUSH_waiting,  // for the image header
+   STBI_PUSH_decoding,
+   STBI_PUSH_done      // every row delivered
+};
+
+STBIDEF stbi_push *stbi_push_begin(int desired_channels, stbi_rows_callback *callback, void *callback_user);
+STBIDEF int        stbi_push_feed (stbi_push *p, stbi_uc const *data, int len);
+STBIDEF int        stbi_push_end  (stbi_push *p);
+STBIDEF int        stbi_push_poll (stbi_push *p, int *x, int *y, int *channels_in_file, int *rows_done);
+STBIDEF void       stbi_push_free (stbi_push *p);
+
+////////////////////////////////////
+//
+// region interface
+//
+// decodes only the rw*rh rectangle at (rx,ry) into 'out', whose rows are
+// 'out_stride' bytes apart (0 for tightly packed). for JPEG the work done
+// follows the rectangle: entropy decoding stops after its last row, restart
+// intervals that miss it are skipped without decoding, and only the blocks
+// around it are IDCTed and color-converted. other formats are decoded
+// whole and cropped. with vertical flipping on, (rx,ry) is in flipped
+// coordinates. 'out' must hold the whole region; nothing is allocated for
+// you. all functions return 1 on success, and 0 if 'out' is NULL.
+STBIDEF int stbi_load_region_from_memory   (stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, int rx, int ry, int rw, int rh, stbi_uc *out, int out_stride);
+STBIDEF int stbi_load_region_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *channels_in_file, int desired_channels, int rx, int ry, int rw, int rh, stbi_uc *out, int out_stride);
+
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_region          (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, int rx, int ry, int rw, int rh, stbi_uc *out, int out_stride);
+STBIDEF int stbi_load_region_from_file(FILE *f, int *x, int *y, int *channels_in_file, int desired_channels, int rx, int ry, int rw, int rh, stbi_uc *out, int out_stride);
+#endif
+
+////////////////////////////////////
+//
+// planar YCbCr interface
+//
+// returns the Y, Cb and Cr planes of a JPEG at their stored resolution,
+// skipping chroma upsampling and color conversion so they can be done on
+// the GPU. the planes are tightly packed one after another in a single
+// allocation freed with stbi_image_free; plane_w[3] and plane_h[3] receive
+// their dimensions (chroma planes are smaller when subsampled). fails with
+// "not YCbCr" for non-JPEGs and for grayscale, RGB or CMYK JPEGs.
+STBIDEF stbi_uc *stbi_load_ycbcr_from_memory   (stbi_uc const *buffer, int len, int *x, int *y, int *plane_w, int *plane_h);
+STBIDEF stbi_uc *stbi_load_ycbcr_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *plane_w, int *plane_h);
+
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_load_ycbcr          (char const *filename, int *x, int *y, int *plane_w, int *plane_h);
+STBIDEF stbi_uc *stbi_load_ycbcr_from_file(FILE *f, int *x, int *y, int *plane_w, int *plane_h);
+#endif
+
+////////////////////////////////////
+//
+// JPEG coefficient interface
+//
+// entropy decodes a JPEG and stops there, returning each plane's quantized
+// DCT coefficients with its quantization table so dequantization, IDCT,
+// upsampling and color conversion can be done elsewhere (e.g. on the GPU).
+// the result is a single allocation freed with stbi_image_free. fails for
+// non-JPEGs and for RGB or CMYK JPEGs; baseline and progressive both work.
+typedef struct
+{
+   int w, h;                 // samples in the plane, before upsampling
+   int coeff_w, coeff_h;     // size of the coefficient grid, multiples of 8 covering w x h
+   int h_samp, v_samp;       // sampling factors; the plane has w = ceil(x * h_samp / h_max)
+   stbi_us quant[64];        // quantization table, in natural (not zigzag) order
+   short *coeff;             // coeff_w * coeff_h quantized coefficients laid out as the plane:
+                             // frequency (u,v) of block (i,j) is at [(j*8+v) * coeff_w + i*8+u]
+} stbi_jpeg_plane;
+
+typedef struct
+{
+   int x, y;                 // image size
+   int n;                    // 1 for grayscale (plane 0), 3 for Y, Cb, Cr
+   int h_max, v_max;         // largest sampling factors
+   int flip;                 // stbi_set_flip_vertically_on_load was set; the coefficients are
+                             // always top down, so whoever reconstructs the pixels should flip
+   stbi_jpeg_plane plane[3];
+} stbi_jpeg_coefficients;
+
+STBIDEF stbi_jpeg_coefficients *stbi_load_jpeg_coefficients_from_memory   (stbi_uc const *buffer, int len);
+STBIDEF stbi_jpeg_coefficients *stbi_load_jpeg_coefficients_from_callbacks(stbi_io_callbacks const *clbk, void *user);
+
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_jpeg_coefficients *stbi_load_jpeg_coefficients          (char const *filename);
+STBIDEF stbi_jpeg_coefficients *stbi_load_jpeg_coefficients_from_file(FILE *f);
+#endif
+
 #ifdef STBI_WINDOWS_UTF8
 STBIDEF int stbi_convert_wchar_to_utf8(char *buffer, size_t bufferlen, const wchar_t* input);
 #endif
@@ -472,6 +638,17 @@ STBIDEF int      stbi_is_16_bit          (char const *filename);
 STBIDEF int      stbi_is_16_bit_from_file(FILE *f);
 #endif
 
+// stbi_info, stbi_is_16_bit and stbi_is_hdr in one pass, picking the format
+// from its magic bytes instead of trying each in turn (TGA, which has none,
+// still falls back to that). bits_per_channel is 8, 16, or 32 for HDR
+STBIDEF int      stbi_info_ex_from_memory   (stbi_uc const *buffer, int len, int *x, int *y, int *comp, int *bits_per_channel, int *is_hdr);
+STBIDEF int      stbi_info_ex_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int *bits_per_channel, int *is_hdr);
+
+#ifndef STBI_NO_STDIO
+STBIDEF int      stbi_info_ex          (char const *filename, int *x, int *y, int *comp, int *bits_per_channel, int *is_hdr);
+STBIDEF int      stbi_info_ex_from_file(FILE *f,              int *x, int *y, int *comp, int *bits_per_channel, int *is_hdr);
+#endif
+
 
 
 // for image formats that explicitly notate that they have premultiplied alpha,
@@ -490,6 +667,8 @@ STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 // this function is only available if your compiler supports thread-local variables;
 // calling it will fail to link if your compiler doesn't
 STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
+// undoes the above, so the thread follows stbi_set_flip_vertically_on_load again
+STBIDEF void stbi_clear_flip_vertically_on_load_thread(void);
 
 // ZLIB client - used by PNG, available for other purposes
 
@@ -501,6 +680,13 @@ STBIDEF int   stbi_zlib_decode_buffer(char *obuffer, int olen, const char *ibuff
 STBIDEF char *stbi_zlib_decode_noheader_malloc(const char *buffer, int len, int *outlen);
 STBIDEF int   stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const char *ibuffer, int ilen);
 
+// when the implementation is built with STBI_PARALLEL_INFLATE, the malloc
+// decoders above split streams of at least STBI_PARALLEL_INFLATE_MIN
+// compressed bytes per thread (1MB by default) across up to this many
+// threads. 0, the default, means one per core; 1 turns it off. PNGs get the
+// same treatment when their IDATs are big enough to be worth collecting
+STBIDEF void  stbi_set_inflate_threads(int num_threads);
+
 
 #ifdef __cplusplus
 }
@@ -717,7 +903,7 @@ static int stbi__cpuid3(void)
 
 #define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG) || !defined(STBI_NO_BMP)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    int info3 = stbi__cpuid3();
@@ -728,7 +914,7 @@ static int stbi__sse2_available(void)
 #else // assume GCC-style if not VC++
 #define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG) || !defined(STBI_NO_BMP)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    // If we're even attempting to compile this on GCC/Clang, that means
@@ -764,6 +950,18 @@ static int stbi__sse2_available(void)
 //
 //  stbi__context struct and start_xxx functions
 
+// a stbi_load_rows request, for loaders that can deliver rows as they go
+typedef struct
+{
+   stbi_rows_callback *callback;
+   void *user;
+   int *x, *y, *comp;
+   int streamed; // set once a loader has delivered every row itself
+   void *resume; // push decoding: where a loader that can stop early leaves its state
+} stbi__rows;
+
+#define STBI__ROWS_BAND_BYTES  65536  // target size of each callback's band
+
 // stbi__context structure is our basic context used by all images, so it
 // contains all the IO context, plus some basic image information
 typedef struct
@@ -781,6 +979,8 @@ typedef struct
 
    stbi_uc *img_buffer, *img_buffer_end;
    stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+   stbi__rows *rows; // non-NULL for stbi_load_rows
 } stbi__context;
 
 
@@ -794,6 +994,7 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
    s->callback_already_read = 0;
    s->img_buffer = s->img_buffer_original = (stbi_uc *) buffer;
    s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *) buffer+len;
+   s->rows = NULL;
 }
 
 // initialize a callback-based context
@@ -805,6 +1006,7 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
    s->read_from_callbacks = 1;
    s->callback_already_read = 0;
    s->img_buffer = s->img_buffer_original = s->buffer_start;
+   s->rows = NULL;
    stbi__refill_buffer(s);
    s->img_buffer_original_end = s->img_buffer_end;
 }
@@ -867,17 +1069,21 @@ typedef struct
    int bits_per_channel;
    int num_channels;
    int channel_order;
+   int vertically_flipped; // loader already honored stbi__vertically_flip_on_load
 } stbi__result_info;
 
 #ifndef STBI_NO_JPEG
 static int      stbi__jpeg_test(stbi__context *s);
 static void    *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri);
 static int      stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp);
+static int      stbi__jpeg_load_region(stbi__context *s, int *x, int *y, int *comp, int req_comp, int rx, int ry, int rw, int rh, stbi_uc *out, int out_stride);
+static stbi_uc *stbi__jpeg_load_ycbcr(stbi__context *s, int *x, int *y, int *plane_w, int *plane_h);
+static stbi_jpeg_coefficients *stbi__jpeg_load_coefficients(stbi__context *s);
 #endif
 
 #ifndef STBI_NO_PNG
 static int      stbi__png_test(stbi__context *s);
-static void    *stbi__png_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri);
+static void    *stbi__png_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc);
 static int      stbi__png_info(stbi__context *s, int *x, int *y, int *comp);
 static int      stbi__png_is16(stbi__context *s);
 #endif
@@ -1029,6 +1235,24 @@ static void *stbi__malloc_mad4(int a, int b, int c, int d, int add)
 }
 #endif
 
+// the same for image buffers that are only ever indexed with size_t, which
+// can be bigger than 2GB where size_t is 64 bits. the limit is half of
+// size_t's range so that differences between pointers into them still fit
+static int stbi__mad3sizes_valid_wide(int a, int b, int c, int add)
+{
+   size_t limit = ((size_t) -1) >> 1;
+   if (a < 0 || b < 0 || c < 0 || add < 0) return 0;
+   if (b && (size_t) a > limit / b) return 0;
+   if (c && (size_t) a * b > limit / c) return 0;
+   return (size_t) a * b * c <= limit - add;
+}
+
+static void *stbi__malloc_mad3_wide(int a, int b, int c, int add)
+{
+   if (!stbi__mad3sizes_valid_wide(a, b, c, add)) return NULL;
+   return stbi__malloc((size_t) a * b * c + add);
+}
+
 // stbi__err - error
 // stbi__errpf - error returning pointer to float
 // stbi__errpuc - error returning pointer to unsigned char
@@ -1075,6 +1299,11 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
    stbi__vertically_flip_on_load_set = 1;
 }
 
+STBIDEF void stbi_clear_flip_vertically_on_load_thread(void)
+{
+   stbi__vertically_flip_on_load_set = 0;
+}
+
 #define stbi__vertically_flip_on_load  (stbi__vertically_flip_on_load_set       \
                                          ? stbi__vertically_flip_on_load_local  \
                                          : stbi__vertically_flip_on_load_global)
@@ -1091,7 +1320,7 @@ static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int re
    if (stbi__jpeg_test(s)) return stbi__jpeg_load(s,x,y,comp,req_comp, ri);
    #endif
    #ifndef STBI_NO_PNG
-   if (stbi__png_test(s))  return stbi__png_load(s,x,y,comp,req_comp, ri);
+   if (stbi__png_test(s))  return stbi__png_load(s,x,y,comp,req_comp, ri, bpc);
    #endif
    #ifndef STBI_NO_BMP
    if (stbi__bmp_test(s))  return stbi__bmp_load(s,x,y,comp,req_comp, ri);
@@ -1129,8 +1358,8 @@ static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int re
 
 static stbi_uc *stbi__convert_16_to_8(stbi__uint16 *orig, int w, int h, int channels)
 {
-   int i;
-   int img_len = w * h * channels;
+   size_t i;
+   size_t img_len = (size_t) w * h * channels;
    stbi_uc *reduced;
 
    reduced = (stbi_uc *) stbi__malloc(img_len);
@@ -1145,10 +1374,11 @@ static stbi_uc *stbi__convert_16_to_8(stbi__uint16 *orig, int w, int h, int chan
 
 static stbi__uint16 *stbi__convert_8_to_16(stbi_uc *orig, int w, int h, int channels)
 {
-   int i;
-   int img_len = w * h * channels;
+   size_t i;
+   size_t img_len = (size_t) w * h * channels;
    stbi__uint16 *enlarged;
 
+   if (img_len > (((size_t) -1) >> 2)) return (stbi__uint16 *) stbi__errpuc("too large", "Image too large to decode");
    enlarged = (stbi__uint16 *) stbi__malloc(img_len*2);
    if (enlarged == NULL) return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory");
 
@@ -1215,7 +1445,7 @@ static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x,
 
    // @TODO: move stbi__convert_format to here
 
-   if (stbi__vertically_flip_on_load) {
+   if (stbi__vertically_flip_on_load && !ri.vertically_flipped) {
       int channels = req_comp ? req_comp : *comp;
       stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi_uc));
    }
@@ -1242,7 +1472,7 @@ static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x,
    // @TODO: move stbi__convert_format16 to here
    // @TODO: special case RGB-to-Y (and RGBA-to-YA) for 8-bit-to-16-bit case to keep more precision
 
-   if (stbi__vertically_flip_on_load) {
+   if (stbi__vertically_flip_on_load && !ri.vertically_flipped) {
       int channels = req_comp ? req_comp : *comp;
       stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi__uint16));
    }
@@ -1380,167 +1610,555 @@ STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *u
    return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
 }
 
-#ifndef STBI_NO_GIF
-STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp)
+// rows collected for a stbi_rows_callback, stored bottom up when flipping so
+// that every callback gets its rows in output order
+typedef struct
 {
-   unsigned char *result;
-   stbi__context s;
-   stbi__start_mem(&s,buffer,len);
+   stbi_uc *data;
+   size_t stride;
+   stbi__uint32 y;      // image height
+   stbi__uint32 j0;     // first row of the band
+   stbi__uint32 n;      // rows the band will hold when full
+   stbi__uint32 max_n;  // rows there's room for
+   int flip;
+} stbi__band;
 
-   result = (unsigned char*) stbi__load_gif_main(&s, delays, x, y, z, comp, req_comp);
-   if (stbi__vertically_flip_on_load) {
-      stbi__vertical_flip_slices( result, *x, *y, *z, *comp );
-   }
+static void stbi__band_begin(stbi__band *b, stbi_uc *data, size_t stride, stbi__uint32 y, stbi__uint32 max_n)
+{
+   b->data = data;
+   b->stride = stride;
+   b->y = y;
+   b->j0 = 0;
+   b->max_n = max_n;
+   b->n = y < max_n ? y : max_n;
+   b->flip = stbi__vertically_flip_on_load;
+}
 
-   return result;
+static stbi_uc *stbi__band_row(stbi__band *b, stbi__uint32 j)
+{
+   return b->data + b->stride * (b->flip ? b->n-1 - (j - b->j0) : j - b->j0);
 }
-#endif
 
-#ifndef STBI_NO_LINEAR
-static float *stbi__loadf_main(stbi__context *s, int *x, int *y, int *comp, int req_comp)
+static int stbi__band_full(stbi__band *b, stbi__uint32 j)
 {
-   unsigned char *data;
-   #ifndef STBI_NO_HDR
-   if (stbi__hdr_test(s)) {
-      stbi__result_info ri;
-      float *hdr_data = stbi__hdr_load(s,x,y,comp,req_comp, &ri);
-      if (hdr_data)
-         stbi__float_postprocess(hdr_data,x,y,comp,req_comp);
-      return hdr_data;
+   return j - b->j0 == b->n;
+}
+
+// hands rows j0..j-1 to the callback, which needn't be a full band
+static int stbi__band_flush(stbi__band *b, stbi__rows *rows, stbi__uint32 j)
+{
+   stbi__uint32 num = j - b->j0;
+   if (num) {
+      stbi_uc *first = b->flip ? b->data + b->stride * (b->n - num) : b->data;
+      int first_y = b->flip ? (int) (b->y - b->j0 - num) : (int) b->j0;
+      if (!rows->callback(rows->user, first, first_y, (int) num))
+         return stbi__err("callback abort", "Row callback stopped decoding");
    }
-   #endif
-   data = stbi__load_and_postprocess_8bit(s, x, y, comp, req_comp);
-   if (data)
-      return stbi__ldr_to_hdr(data, *x, *y, req_comp ? req_comp : *comp);
-   return stbi__errpf("unknown image type", "Image not of any known type, or corrupt");
+   b->j0 = j;
+   b->n = b->y - j < b->max_n ? b->y - j : b->max_n;
+   return 1;
 }
 
-STBIDEF float *stbi_loadf_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
+static int stbi__load_rows_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi_rows_callback *callback, void *user)
+{
+   stbi__rows rows;
+   stbi_uc *result;
+   int n, j, stride, band_rows, ok = 1;
+
+   rows.callback = callback;
+   rows.user = user;
+   rows.x = x;
+   rows.y = y;
+   rows.comp = comp;
+   rows.streamed = 0;
+   rows.resume = NULL;
+   s->rows = &rows;
+   result = stbi__load_and_postprocess_8bit(s, x, y, &n, req_comp);
+   s->rows = NULL;
+   if (rows.streamed) return 1;
+   if (result == NULL) return 0;
+
+   // no incremental decoder for this one, so hand over the whole image in
+   // the same bands; it's already flipped if need be
+   if (comp) *comp = n;
+   stride = *x * (req_comp ? req_comp : n);
+   if (stride <= 0) { // some loaders let an empty image through
+      STBI_FREE(result);
+      return stbi__err("bad size", "Corrupt image");
+   }
+   band_rows = STBI__ROWS_BAND_BYTES / stride;
+   if (band_rows < 1) band_rows = 1;
+   for (j=0; j < *y; j += band_rows) {
+      int num = (*y - j < band_rows) ? *y - j : band_rows;
+      if (!callback(user, result + (size_t) j * stride, j, num)) {
+         ok = stbi__err("callback abort", "Row callback stopped decoding");
+         break;
+      }
+   }
+   STBI_FREE(result);
+   return ok;
+}
+
+STBIDEF int stbi_load_rows_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_rows_callback *callback, void *callback_user)
 {
    stbi__context s;
    stbi__start_mem(&s,buffer,len);
-   return stbi__loadf_main(&s,x,y,comp,req_comp);
+   return stbi__load_rows_main(&s,x,y,comp,req_comp,callback,callback_user);
 }
 
-STBIDEF float *stbi_loadf_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
+STBIDEF int stbi_load_rows_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp, stbi_rows_callback *callback, void *callback_user)
 {
    stbi__context s;
    stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
-   return stbi__loadf_main(&s,x,y,comp,req_comp);
+   return stbi__load_rows_main(&s,x,y,comp,req_comp,callback,callback_user);
 }
 
 #ifndef STBI_NO_STDIO
-STBIDEF float *stbi_loadf(char const *filename, int *x, int *y, int *comp, int req_comp)
+STBIDEF int stbi_load_rows(char const *filename, int *x, int *y, int *comp, int req_comp, stbi_rows_callback *callback, void *callback_user)
 {
-   float *result;
    FILE *f = stbi__fopen(filename, "rb");
-   if (!f) return stbi__errpf("can't fopen", "Unable to open file");
-   result = stbi_loadf_from_file(f,x,y,comp,req_comp);
+   int result;
+   if (!f) return stbi__err("can't fopen", "Unable to open file");
+   result = stbi_load_rows_from_file(f,x,y,comp,req_comp,callback,callback_user);
    fclose(f);
    return result;
 }
 
-STBIDEF float *stbi_loadf_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
+STBIDEF int stbi_load_rows_from_file(FILE *f, int *x, int *y, int *comp, int req_comp, stbi_rows_callback *callback, void *callback_user)
 {
    stbi__context s;
    stbi__start_file(&s,f);
-   return stbi__loadf_main(&s,x,y,comp,req_comp);
+   return stbi__load_rows_main(&s,x,y,comp,req_comp,callback,callback_user);
 }
 #endif // !STBI_NO_STDIO
 
-#endif // !STBI_NO_LINEAR
+// a stbi_load_tiles request, fed by stbi_load_rows. the strip holds the rows
+// of one row of tiles; bands arrive in order, up or down, so going through
+// each one the same way only ever leaves one strip partly filled
+typedef struct
+{
+   stbi_tile_callback *callback;
+   void *user;
+   int x, y, comp, req_comp;
+   int tile_w, tile_h;
+   stbi_uc *strip, *tile;
+   size_t stride;
+   int strip_y;  // first row of the strip, or -1 before the first
+   int filled;   // rows of it there are so far
+   int failed;   // out of memory rather than stopped by the callback
+   int up;       // bands are coming bottom up
+} stbi__tiles;
+
+static int stbi__tiles_flush(stbi__tiles *t)
+{
+   int tx, r, h = t->y - t->strip_y < t->tile_h ? t->y - t->strip_y : t->tile_h;
+   int n = t->req_comp ? t->req_comp : t->comp;
+   for (tx=0; tx <= (t->x - 1) / t->tile_w; ++tx) {
+      int w = t->x - tx * t->tile_w < t->tile_w ? t->x - tx * t->tile_w : t->tile_w;
+      stbi_uc *tile = t->strip;
+      if ((size_t) w * n != t->stride) { // a single column of tiles is the strip itself
+         tile = t->tile;
+         for (r=0; r < h; ++r)
+            memcpy(tile + (size_t) r * w * n, t->strip + r * t->stride + (size_t) tx * t->tile_w * n, (size_t) w * n);
+      }
+      if (!t->callback(t->user, tile, tx, t->strip_y / t->tile_h, w, h)) return 0;
+   }
+   return 1;
+}
 
-// these is-hdr-or-not is defined independent of whether STBI_NO_LINEAR is
-// defined, for API simplicity; if STBI_NO_LINEAR is defined, it always
-// reports false!
+static int stbi__tiles_rows(void *user, stbi_uc *rows, int y, int num_rows)
+{
+   stbi__tiles *t = (stbi__tiles *) user;
+   int i;
+   if (!t->strip) { // x and comp are known by the first band
+      int n = t->req_comp ? t->req_comp : t->comp;
+      t->stride = (size_t) t->x * n;
+      t->strip = (stbi_uc *) stbi__malloc_mad3_wide(t->x, n, t->tile_h < t->y ? t->tile_h : t->y, 0);
+      t->tile = (stbi_uc *) stbi__malloc_mad3(t->tile_w < t->x ? t->tile_w : t->x, n, t->tile_h < t->y ? t->tile_h : t->y, 0);
+      if (!t->strip || !t->tile) {
+         t->failed = 1;
+         return 0;
+      }
+      t->up = y != 0;
+   }
+   for (i=0; i < num_rows; ++i) {
+      int k = t->up ? num_rows-1 - i : i;
+      int j = y + k;
+      if (j - j % t->tile_h != t->strip_y) {
+         t->strip_y = j - j % t->tile_h;
+         t->filled = 0;
+      }
+      memcpy(t->strip + (size_t) (j - t->strip_y) * t->stride, rows + (size_t) k * t->stride, t->stride);
+      if (++t->filled == (t->y - t->strip_y < t->tile_h ? t->y - t->strip_y : t->tile_h))
+         if (!stbi__tiles_flush(t)) return 0;
+   }
+   return 1;
+}
 
-STBIDEF int stbi_is_hdr_from_memory(stbi_uc const *buffer, int len)
+static int stbi__load_tiles_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, int tile_w, int tile_h, stbi_tile_callback *callback, void *user)
+{
+   stbi__tiles t;
+   int ok;
+   if (tile_w <= 0 || tile_h <= 0) return stbi__err("bad tile size", "Tiles must be at least 1x1");
+   t.callback = callback;
+   t.user = user;
+   t.req_comp = req_comp;
+   t.tile_w = tile_w;
+   t.tile_h = tile_h;
+   t.strip = t.tile = NULL;
+   t.strip_y = -1;
+   t.filled = t.failed = 0;
+   t.comp = 0;
+   ok = stbi__load_rows_main(s, &t.x, &t.y, &t.comp, req_comp, stbi__tiles_rows, &t);
+   STBI_FREE(t.strip);
+   STBI_FREE(t.tile);
+   if (t.failed) return stbi__err("outofmem", "Out of memory");
+   if (!ok) return 0;
+   *x = t.x;
+   *y = t.y;
+   if (comp) *comp = t.comp;
+   return 1;
+}
+
+STBIDEF int stbi_load_tiles_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int tile_w, int tile_h, stbi_tile_callback *callback, void *callback_user)
 {
-   #ifndef STBI_NO_HDR
    stbi__context s;
    stbi__start_mem(&s,buffer,len);
-   return stbi__hdr_test(&s);
-   #else
-   STBI_NOTUSED(buffer);
-   STBI_NOTUSED(len);
-   return 0;
-   #endif
+   return stbi__load_tiles_main(&s,x,y,comp,req_comp,tile_w,tile_h,callback,callback_user);
+}
+
+STBIDEF int stbi_load_tiles_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp, int tile_w, int tile_h, stbi_tile_callback *callback, void *callback_user)
+{
+   stbi__context s;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+   return stbi__load_tiles_main(&s,x,y,comp,req_comp,tile_w,tile_h,callback,callback_user);
 }
 
 #ifndef STBI_NO_STDIO
-STBIDEF int      stbi_is_hdr          (char const *filename)
+STBIDEF int stbi_load_tiles(char const *filename, int *x, int *y, int *comp, int req_comp, int tile_w, int tile_h, stbi_tile_callback *callback, void *callback_user)
 {
    FILE *f = stbi__fopen(filename, "rb");
-   int result=0;
-   if (f) {
-      result = stbi_is_hdr_from_file(f);
-      fclose(f);
-   }
+   int result;
+   if (!f) return stbi__err("can't fopen", "Unable to open file");
+   result = stbi_load_tiles_from_file(f,x,y,comp,req_comp,tile_w,tile_h,callback,callback_user);
+   fclose(f);
    return result;
 }
 
-STBIDEF int stbi_is_hdr_from_file(FILE *f)
+STBIDEF int stbi_load_tiles_from_file(FILE *f, int *x, int *y, int *comp, int req_comp, int tile_w, int tile_h, stbi_tile_callback *callback, void *callback_user)
 {
-   #ifndef STBI_NO_HDR
-   long pos = ftell(f);
-   int res;
    stbi__context s;
    stbi__start_file(&s,f);
-   res = stbi__hdr_test(&s);
-   fseek(f, pos, SEEK_SET);
-   return res;
-   #else
-   STBI_NOTUSED(f);
-   return 0;
-   #endif
+   return stbi__load_tiles_main(&s,x,y,comp,req_comp,tile_w,tile_h,callback,callback_user);
 }
 #endif // !STBI_NO_STDIO
 
-STBIDEF int      stbi_is_hdr_from_callbacks(stbi_io_callbacks const *clbk, void *user)
+static int stbi__load_region_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, int rx, int ry, int rw, int rh, stbi_uc *out, int out_stride)
 {
-   #ifndef STBI_NO_HDR
-   stbi__context s;
-   stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
-   return stbi__hdr_test(&s);
-   #else
-   STBI_NOTUSED(clbk);
-   STBI_NOTUSED(user);
-   return 0;
+   stbi_uc *result;
+   int n, j;
+
+   if (req_comp < 0 || req_comp > 4) return stbi__err("bad req_comp", "Internal error");
+   if (out == NULL) return stbi__err("bad out", "Output buffer is NULL");
+   #ifndef STBI_NO_JPEG
+   if (stbi__jpeg_test(s)) return stbi__jpeg_load_region(s,x,y,comp,req_comp,rx,ry,rw,rh,out,out_stride);
    #endif
+
+   result = stbi__load_and_postprocess_8bit(s, x, y, &n, req_comp);
+   if (result == NULL) return 0;
+   if (comp) *comp = n;
+   if (rw <= 0 || rh <= 0 || rx < 0 || ry < 0 || rw > *x - rx || rh > *y - ry) {
+      STBI_FREE(result);
+      return stbi__err("bad region", "Region is outside the image");
+   }
+   if (req_comp) n = req_comp;
+   if (!out_stride) out_stride = rw * n;
+   for (j=0; j < rh; ++j)
+      memcpy(out + (size_t) j * out_stride, result + ((size_t) (ry+j) * *x + rx) * n, (size_t) rw * n);
+   STBI_FREE(result);
+   return 1;
 }
 
-#ifndef STBI_NO_LINEAR
-static float stbi__l2h_gamma=2.2f, stbi__l2h_scale=1.0f;
+STBIDEF int stbi_load_region_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int rx, int ry, int rw, int rh, stbi_uc *out, int out_stride)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__load_region_main(&s,x,y,comp,req_comp,rx,ry,rw,rh,out,out_stride);
+}
 
-STBIDEF void   stbi_ldr_to_hdr_gamma(float gamma) { stbi__l2h_gamma = gamma; }
-STBIDEF void   stbi_ldr_to_hdr_scale(float scale) { stbi__l2h_scale = scale; }
-#endif
+STBIDEF int stbi_load_region_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp, int rx, int ry, int rw, int rh, stbi_uc *out, int out_stride)
+{
+   stbi__context s;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+   return stbi__load_region_main(&s,x,y,comp,req_comp,rx,ry,rw,rh,out,out_stride);
+}
 
-static float stbi__h2l_gamma_i=1.0f/2.2f, stbi__h2l_scale_i=1.0f;
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_region(char const *filename, int *x, int *y, int *comp, int req_comp, int rx, int ry, int rw, int rh, stbi_uc *out, int out_stride)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   int result;
+   if (!f) return stbi__err("can't fopen", "Unable to open file");
+   result = stbi_load_region_from_file(f,x,y,comp,req_comp,rx,ry,rw,rh,out,out_stride);
+   fclose(f);
+   return result;
+}
 
-STBIDEF void   stbi_hdr_to_ldr_gamma(float gamma) { stbi__h2l_gamma_i = 1/gamma; }
-STBIDEF void   stbi_hdr_to_ldr_scale(float scale) { stbi__h2l_scale_i = 1/scale; }
+STBIDEF int stbi_load_region_from_file(FILE *f, int *x, int *y, int *comp, int req_comp, int rx, int ry, int rw, int rh, stbi_uc *out, int out_stride)
+{
+   stbi__context s;
+   stbi__start_file(&s,f);
+   return stbi__load_region_main(&s,x,y,comp,req_comp,rx,ry,rw,rh,out,out_stride);
+}
+#endif // !STBI_NO_STDIO
 
+static stbi_uc *stbi__load_ycbcr_main(stbi__context *s, int *x, int *y, int *plane_w, int *plane_h)
+{
+   #ifndef STBI_NO_JPEG
+   if (stbi__jpeg_test(s)) return stbi__jpeg_load_ycbcr(s,x,y,plane_w,plane_h);
+   #else
+   STBI_NOTUSED(s); STBI_NOTUSED(x); STBI_NOTUSED(y); STBI_NOTUSED(plane_w); STBI_NOTUSED(plane_h);
+   #endif
+   return stbi__errpuc("not YCbCr", "Only JPEG images have YCbCr planes");
+}
 
-//////////////////////////////////////////////////////////////////////////////
-//
-// Common code used by all image loaders
-//
+STBIDEF stbi_uc *stbi_load_ycbcr_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *plane_w, int *plane_h)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__load_ycbcr_main(&s,x,y,plane_w,plane_h);
+}
 
-enum
+STBIDEF stbi_uc *stbi_load_ycbcr_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *plane_w, int *plane_h)
 {
-   STBI__SCAN_load=0,
-   STBI__SCAN_type,
-   STBI__SCAN_header
-};
+   stbi__context s;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+   return stbi__load_ycbcr_main(&s,x,y,plane_w,plane_h);
+}
 
-static void stbi__refill_buffer(stbi__context *s)
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_load_ycbcr(char const *filename, int *x, int *y, int *plane_w, int *plane_h)
 {
-   int n = (s->io.read)(s->io_user_data,(char*)s->buffer_start,s->buflen);
-   s->callback_already_read += (int) (s->img_buffer - s->img_buffer_original);
-   if (n == 0) {
-      // at end of file, treat same as if from memory, but need to handle case
-      // where s->img_buffer isn't pointing to safe memory, e.g. 0-byte file
+   FILE *f = stbi__fopen(filename, "rb");
+   stbi_uc *result;
+   if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+   result = stbi_load_ycbcr_from_file(f,x,y,plane_w,plane_h);
+   fclose(f);
+   return result;
+}
+
+STBIDEF stbi_uc *stbi_load_ycbcr_from_file(FILE *f, int *x, int *y, int *plane_w, int *plane_h)
+{
+   stbi__context s;
+   stbi__start_file(&s,f);
+   return stbi__load_ycbcr_main(&s,x,y,plane_w,plane_h);
+}
+#endif // !STBI_NO_STDIO
+
+static stbi_jpeg_coefficients *stbi__load_jpeg_coefficients_main(stbi__context *s)
+{
+   #ifndef STBI_NO_JPEG
+   if (stbi__jpeg_test(s)) return stbi__jpeg_load_coefficients(s);
+   #else
+   STBI_NOTUSED(s);
+   #endif
+   return (stbi_jpeg_coefficients *) stbi__errpuc("not JPEG", "Only JPEG images have DCT coefficients");
+}
+
+STBIDEF stbi_jpeg_coefficients *stbi_load_jpeg_coefficients_from_memory(stbi_uc const *buffer, int len)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__load_jpeg_coefficients_main(&s);
+}
+
+STBIDEF stbi_jpeg_coefficients *stbi_load_jpeg_coefficients_from_callbacks(stbi_io_callbacks const *clbk, void *user)
+{
+   stbi__context s;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+   return stbi__load_jpeg_coefficients_main(&s);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_jpeg_coefficients *stbi_load_jpeg_coefficients(char const *filename)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   stbi_jpeg_coefficients *result;
+   if (!f) return (stbi_jpeg_coefficients *) stbi__errpuc("can't fopen", "Unable to open file");
+   result = stbi_load_jpeg_coefficients_from_file(f);
+   fclose(f);
+   return result;
+}
+
+STBIDEF stbi_jpeg_coefficients *stbi_load_jpeg_coefficients_from_file(FILE *f)
+{
+   stbi__context s;
+   stbi__start_file(&s,f);
+   return stbi__load_jpeg_coefficients_main(&s);
+}
+#endif // !STBI_NO_STDIO
+
+#ifndef STBI_NO_GIF
+STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp)
+{
+   unsigned char *result;
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+
+   result = (unsigned char*) stbi__load_gif_main(&s, delays, x, y, z, comp, req_comp);
+   if (stbi__vertically_flip_on_load) {
+      stbi__vertical_flip_slices( result, *x, *y, *z, *comp );
+   }
+
+   return result;
+}
+#endif
+
+#ifndef STBI_NO_LINEAR
+static float *stbi__loadf_main(stbi__context *s, int *x, int *y, int *comp, int req_comp)
+{
+   unsigned char *data;
+   #ifndef STBI_NO_HDR
+   if (stbi__hdr_test(s)) {
+      stbi__result_info ri;
+      float *hdr_data = stbi__hdr_load(s,x,y,comp,req_comp, &ri);
+      if (hdr_data)
+         stbi__float_postprocess(hdr_data,x,y,comp,req_comp);
+      return hdr_data;
+   }
+   #endif
+   data = stbi__load_and_postprocess_8bit(s, x, y, comp, req_comp);
+   if (data)
+      return stbi__ldr_to_hdr(data, *x, *y, req_comp ? req_comp : *comp);
+   return stbi__errpf("unknown image type", "Image not of any known type, or corrupt");
+}
+
+STBIDEF float *stbi_loadf_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__loadf_main(&s,x,y,comp,req_comp);
+}
+
+STBIDEF float *stbi_loadf_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__context s;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+   return stbi__loadf_main(&s,x,y,comp,req_comp);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF float *stbi_loadf(char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+   float *result;
+   FILE *f = stbi__fopen(filename, "rb");
+   if (!f) return stbi__errpf("can't fopen", "Unable to open file");
+   result = stbi_loadf_from_file(f,x,y,comp,req_comp);
+   fclose(f);
+   return result;
+}
+
+STBIDEF float *stbi_loadf_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__context s;
+   stbi__start_file(&s,f);
+   return stbi__loadf_main(&s,x,y,comp,req_comp);
+}
+#endif // !STBI_NO_STDIO
+
+#endif // !STBI_NO_LINEAR
+
+// these is-hdr-or-not is defined independent of whether STBI_NO_LINEAR is
+// defined, for API simplicity; if STBI_NO_LINEAR is defined, it always
+// reports false!
+
+STBIDEF int stbi_is_hdr_from_memory(stbi_uc const *buffer, int len)
+{
+   #ifndef STBI_NO_HDR
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__hdr_test(&s);
+   #else
+   STBI_NOTUSED(buffer);
+   STBI_NOTUSED(len);
+   return 0;
+   #endif
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF int      stbi_is_hdr          (char const *filename)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   int result=0;
+   if (f) {
+      result = stbi_is_hdr_from_file(f);
+      fclose(f);
+   }
+   return result;
+}
+
+STBIDEF int stbi_is_hdr_from_file(FILE *f)
+{
+   #ifndef STBI_NO_HDR
+   long pos = ftell(f);
+   int res;
+   stbi__context s;
+   stbi__start_file(&s,f);
+   res = stbi__hdr_test(&s);
+   fseek(f, pos, SEEK_SET);
+   return res;
+   #else
+   STBI_NOTUSED(f);
+   return 0;
+   #endif
+}
+#endif // !STBI_NO_STDIO
+
+STBIDEF int      stbi_is_hdr_from_callbacks(stbi_io_callbacks const *clbk, void *user)
+{
+   #ifndef STBI_NO_HDR
+   stbi__context s;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+   return stbi__hdr_test(&s);
+   #else
+   STBI_NOTUSED(clbk);
+   STBI_NOTUSED(user);
+   return 0;
+   #endif
+}
+
+#ifndef STBI_NO_LINEAR
+static float stbi__l2h_gamma=2.2f, stbi__l2h_scale=1.0f;
+
+STBIDEF void   stbi_ldr_to_hdr_gamma(float gamma) { stbi__l2h_gamma = gamma; }
+STBIDEF void   stbi_ldr_to_hdr_scale(float scale) { stbi__l2h_scale = scale; }
+#endif
+
+static float stbi__h2l_gamma_i=1.0f/2.2f, stbi__h2l_scale_i=1.0f;
+
+STBIDEF void   stbi_hdr_to_ldr_gamma(float gamma) { stbi__h2l_gamma_i = 1/gamma; }
+STBIDEF void   stbi_hdr_to_ldr_scale(float scale) { stbi__h2l_scale_i = 1/scale; }
+
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// Common code used by all image loaders
+//
+
+enum
+{
+   STBI__SCAN_load=0,
+   STBI__SCAN_type,
+   STBI__SCAN_header
+};
+
+static void stbi__refill_buffer(stbi__context *s)
+{
+   int n = (s->io.read)(s->io_user_data,(char*)s->buffer_start,s->buflen);
+   s->callback_already_read += (int) (s->img_buffer - s->img_buffer_original);
+   if (n == 0) {
+      // at end of file, treat same as if from memory, but need to handle case
+      // where s->img_buffer isn't pointing to safe memory, e.g. 0-byte file
       s->read_from_callbacks = 0;
       s->img_buffer = s->buffer_start;
       s->img_buffer_end = s->buffer_start+1;
@@ -1600,7 +2218,7 @@ static void stbi__skip(stbi__context *s, int n)
 }
 #endif
 
-#if defined(STBI_NO_PNG) && defined(STBI_NO_TGA) && defined(STBI_NO_HDR) && defined(STBI_NO_PNM)
+#if defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_TGA) && defined(STBI_NO_HDR) && defined(STBI_NO_PNM)
 // nothing
 #else
 static int stbi__getn(stbi__context *s, stbi_uc *buffer, int n)
@@ -1691,23 +2309,14 @@ static stbi_uc stbi__compute_y(int r, int g, int b)
 #if defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM)
 // nothing
 #else
-static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y)
+// converts y rows of x pixels between separate buffers; returns 0 on an
+// unsupported combination
+static int stbi__convert_rows(unsigned char *good, unsigned char const *data, int img_n, int req_comp, unsigned int x, unsigned int y)
 {
    int i,j;
-   unsigned char *good;
-
-   if (req_comp == img_n) return data;
-   STBI_ASSERT(req_comp >= 1 && req_comp <= 4);
-
-   good = (unsigned char *) stbi__malloc_mad3(req_comp, x, y, 0);
-   if (good == NULL) {
-      STBI_FREE(data);
-      return stbi__errpuc("outofmem", "Out of memory");
-   }
-
    for (j=0; j < (int) y; ++j) {
-      unsigned char *src  = data + j * x * img_n   ;
-      unsigned char *dest = good + j * x * req_comp;
+      unsigned char const *src = data + j * x * img_n   ;
+      unsigned char *dest      = good + j * x * req_comp;
 
       #define STBI__COMBO(a,b)  ((a)*8+(b))
       #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
@@ -1726,11 +2335,30 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
          STBI__CASE(4,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
          STBI__CASE(4,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = src[3]; } break;
          STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                    } break;
-         default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return stbi__errpuc("unsupported", "Unsupported format conversion");
+         default: STBI_ASSERT(0); return stbi__err("unsupported", "Unsupported format conversion");
       }
       #undef STBI__CASE
    }
+   return 1;
+}
 
+static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y)
+{
+   unsigned char *good;
+
+   if (req_comp == img_n) return data;
+   STBI_ASSERT(req_comp >= 1 && req_comp <= 4);
+
+   good = (unsigned char *) stbi__malloc_mad3(req_comp, x, y, 0);
+   if (good == NULL) {
+      STBI_FREE(data);
+      return stbi__errpuc("outofmem", "Out of memory");
+   }
+
+   if (!stbi__convert_rows(good, data, img_n, req_comp, x, y)) {
+      STBI_FREE(good);
+      good = NULL;
+   }
    STBI_FREE(data);
    return good;
 }
@@ -1748,23 +2376,12 @@ static stbi__uint16 stbi__compute_y_16(int r, int g, int b)
 #if defined(STBI_NO_PNG) && defined(STBI_NO_PSD)
 // nothing
 #else
-static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int req_comp, unsigned int x, unsigned int y)
+static int stbi__convert_rows16(stbi__uint16 *good, stbi__uint16 const *data, int img_n, int req_comp, unsigned int x, unsigned int y)
 {
    int i,j;
-   stbi__uint16 *good;
-
-   if (req_comp == img_n) return data;
-   STBI_ASSERT(req_comp >= 1 && req_comp <= 4);
-
-   good = (stbi__uint16 *) stbi__malloc(req_comp * x * y * 2);
-   if (good == NULL) {
-      STBI_FREE(data);
-      return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory");
-   }
-
    for (j=0; j < (int) y; ++j) {
-      stbi__uint16 *src  = data + j * x * img_n   ;
-      stbi__uint16 *dest = good + j * x * req_comp;
+      stbi__uint16 const *src = data + j * x * img_n   ;
+      stbi__uint16 *dest      = good + j * x * req_comp;
 
       #define STBI__COMBO(a,b)  ((a)*8+(b))
       #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
@@ -1783,11 +2400,30 @@ static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int r
          STBI__CASE(4,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
          STBI__CASE(4,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = src[3]; } break;
          STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                       } break;
-         default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return (stbi__uint16*) stbi__errpuc("unsupported", "Unsupported format conversion");
+         default: STBI_ASSERT(0); return stbi__err("unsupported", "Unsupported format conversion");
       }
       #undef STBI__CASE
    }
+   return 1;
+}
+
+static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int req_comp, unsigned int x, unsigned int y)
+{
+   stbi__uint16 *good;
+
+   if (req_comp == img_n) return data;
+   STBI_ASSERT(req_comp >= 1 && req_comp <= 4);
+
+   good = (stbi__uint16 *) stbi__malloc(req_comp * x * y * 2);
+   if (good == NULL) {
+      STBI_FREE(data);
+      return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory");
+   }
 
+   if (!stbi__convert_rows16(good, data, img_n, req_comp, x, y)) {
+      STBI_FREE(good);
+      good = NULL;
+   }
    STBI_FREE(data);
    return good;
 }
@@ -1911,8 +2547,9 @@ typedef struct
       stbi_uc *data;
       void *raw_data, *raw_coeff;
       stbi_uc *linebuf;
-      short   *coeff;   // progressive only
+      short   *coeff;   // progressive or coeff_only
       int      coeff_w, coeff_h; // number of 8x8 coefficient blocks
+      int      win_bx, win_by;   // block at the top left of 'data'
    } img_comp[4];
 
    stbi__uint32   code_buffer; // jpeg entropy-coded buffer
@@ -1933,12 +2570,33 @@ typedef struct
    int scan_n, order[4];
    int restart_interval, todo;
 
+// region decoding: 'data' only holds the window of MCUs that cover the
+// roi_* rectangle (plus a margin for chroma upsampling); the rest of the
+// image never gets an IDCT or color conversion
+   int roi, roi_flip;
+   int roi_x, roi_y, roi_w, roi_h;
+   int win_x0, win_y0, win_w, win_h;
+
+// coefficient decoding: entropy decode every scan into 'coeff' and stop,
+// leaving the coefficients quantized; 'data' is never allocated
+   int coeff_only;
+
+// banded decoding: 'data' only holds a ring of ring_mcus MCU rows, so a
+// single scan baseline image is upsampled and converted as it's decoded.
+// band_out is where load_jpeg_image wants the rows (a stbi__jpeg_out)
+   int ring_mcus;
+   void *band_out;
+
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
    void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
    stbi_uc *(*resample_row_hv_2_kernel)(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs);
 } stbi__jpeg;
 
+// MCU rows in a banded decode's ring: the row being converted, and the ones
+// either side of it that the upsamplers blend in
+#define STBI__JPEG_RING_MCUS  3
+
 static int stbi__build_huffman(stbi__huffman *h, int *count)
 {
    int i,j,k=0;
@@ -2872,67 +3530,246 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
-static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
+// steps over entropy-coded data without decoding it, up to and including
+// the next restart marker (returns 1) or up to another marker, which is
+// left in z->marker (returns 0). only valid at a restart boundary.
+static int stbi__jpeg_skip_entropy(stbi__jpeg *z)
 {
+   stbi__context *s = z->s;
+   for (;;) {
+      int c;
+      if (!s->io.read) { // memory source: let memchr find the next 0xff
+         stbi_uc *p = (stbi_uc *) memchr(s->img_buffer, 0xff, s->img_buffer_end - s->img_buffer);
+         s->img_buffer = p ? p : s->img_buffer_end;
+      }
+      if (stbi__at_eof(s)) return 0;
+      if (stbi__get8(s) != 0xff) continue;
+      do c = stbi__get8(s); while (c == 0xff && !stbi__at_eof(s));
+      if (c == 0) continue; // stuffed 0xff byte
+      if (STBI__RESTART(c)) return 1;
+      z->marker = (stbi_uc) c;
+      return 0;
+   }
+}
+
+// moves to the marker after a scan that was left partly decoded
+static void stbi__jpeg_skip_scan(stbi__jpeg *z)
+{
+   if (z->marker != STBI__MARKER_none && !STBI__RESTART(z->marker))
+      return; // the entropy decoder already ran into it
+   z->marker = STBI__MARKER_none;
+   while (stbi__jpeg_skip_entropy(z))
+      ;
+}
+
+// baseline scans for a region decode. units are MCUs (or single blocks for
+// a non-interleaved scan); each is entropy-decoded up to the last unit row
+// the window needs, but only blocks inside the window get an IDCT, and a
+// restart interval without any such unit is skipped undecoded.
+static int stbi__parse_entropy_coded_data_roi(stbi__jpeg *z)
+{
+   STBI_SIMD_ALIGN(short, data[64]);
+   int n0 = z->order[0];
+   int uh = z->scan_n == 1 ? 1 : z->img_comp[n0].h; // blocks per unit
+   int uv = z->scan_n == 1 ? 1 : z->img_comp[n0].v;
+   int bx0 = z->img_comp[n0].win_bx, bx1 = bx0 + z->img_comp[n0].w2/8;
+   int by0 = z->img_comp[n0].win_by, by1 = by0 + z->img_comp[n0].h2/8;
+   int ux, uy, m, last, k, x, y;
+
+   if (z->scan_n == 1) {
+      ux = (z->img_comp[n0].x+7) >> 3;
+      uy = (z->img_comp[n0].y+7) >> 3;
+   } else {
+      ux = z->img_mcu_x;
+      uy = z->img_mcu_y;
+   }
+   if (uy > by1 / uv) uy = by1 / uv; // nothing below the window is needed
+   last = ux * uy;
+
    stbi__jpeg_reset(z);
-   if (!z->progressive) {
-      if (z->scan_n == 1) {
-         int i,j;
-         STBI_SIMD_ALIGN(short, data[64]);
-         int n = z->order[0];
-         // non-interleaved data, we just need to process one block at a time,
-         // in trivial scanline order
-         // number of blocks to do just depends on how many actual "pixels" this
-         // component has, independent of interleaved MCU blocking and such
-         int w = (z->img_comp[n].x+7) >> 3;
-         int h = (z->img_comp[n].y+7) >> 3;
-         for (j=0; j < h; ++j) {
-            for (i=0; i < w; ++i) {
+   for (m=0; m < last; ) {
+      int i = m % ux, j = m / ux;
+      if (z->restart_interval && z->todo == z->restart_interval) {
+         // at the start of a restart interval: skip it if it misses the window
+         int e = m + z->restart_interval < last ? m + z->restart_interval : last, q;
+         for (q=m; q < e; ++q) {
+            int qx = (q % ux) * uh, qy = (q / ux) * uv;
+            if (qx >= bx0 && qx < bx1 && qy >= by0) break;
+         }
+         if (q == e) {
+            if (!stbi__jpeg_skip_entropy(z)) return 1; // ran out of data
+            m += z->restart_interval;
+            stbi__jpeg_reset(z);
+            continue;
+         }
+      }
+      for (k=0; k < z->scan_n; ++k) {
+         int n = z->order[k];
+         int bh = z->scan_n == 1 ? 1 : z->img_comp[n].h;
+         int bv = z->scan_n == 1 ? 1 : z->img_comp[n].v;
+         for (y=0; y < bv; ++y) {
+            for (x=0; x < bh; ++x) {
+               int bx = i*bh + x - z->img_comp[n].win_bx;
+               int by = j*bv + y - z->img_comp[n].win_by;
                int ha = z->img_comp[n].ha;
                if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
-               // every data block is an MCU, so countdown the restart interval
-               if (--z->todo <= 0) {
-                  if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-                  // if it's NOT a restart, then just bail, so we get corrupt data
-                  // rather than no data
-                  if (!STBI__RESTART(z->marker)) return 1;
-                  stbi__jpeg_reset(z);
-               }
+               if (bx >= 0 && by >= 0 && bx*8 < z->img_comp[n].w2 && by*8 < z->img_comp[n].h2)
+                  z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*by*8+bx*8, z->img_comp[n].w2, data);
             }
          }
-         return 1;
-      } else { // interleaved
-         int i,j,k,x,y;
-         STBI_SIMD_ALIGN(short, data[64]);
-         for (j=0; j < z->img_mcu_y; ++j) {
-            for (i=0; i < z->img_mcu_x; ++i) {
-               // scan an interleaved mcu... process scan_n components in order
-               for (k=0; k < z->scan_n; ++k) {
-                  int n = z->order[k];
-                  // scan out an mcu's worth of this component; that's just determined
-                  // by the basic H and V specified for the component
-                  for (y=0; y < z->img_comp[n].v; ++y) {
-                     for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
-                        int ha = z->img_comp[n].ha;
-                        if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
-                     }
+      }
+      ++m;
+      if (--z->todo <= 0) {
+         if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+         if (!STBI__RESTART(z->marker)) return 1;
+         stbi__jpeg_reset(z);
+      }
+   }
+   return 1;
+}
+
+// baseline scan into the coefficient buffers, for coeff_only; decoding with
+// a table of ones leaves the coefficients quantized
+static int stbi__parse_entropy_coded_coeffs(stbi__jpeg *z)
+{
+   int i,j,k,x,y;
+   stbi__uint16 unit[64];
+   for (i=0; i < 64; ++i) unit[i] = 1;
+   stbi__jpeg_reset(z);
+   if (z->scan_n == 1) {
+      int n = z->order[0];
+      int w = (z->img_comp[n].x+7) >> 3;
+      int h = (z->img_comp[n].y+7) >> 3;
+      int ha = z->img_comp[n].ha;
+      for (j=0; j < h; ++j) {
+         for (i=0; i < w; ++i) {
+            short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
+            if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, unit)) return 0;
+            if (--z->todo <= 0) {
+               if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+               if (!STBI__RESTART(z->marker)) return 1;
+               stbi__jpeg_reset(z);
+            }
+         }
+      }
+   } else {
+      for (j=0; j < z->img_mcu_y; ++j) {
+         for (i=0; i < z->img_mcu_x; ++i) {
+            for (k=0; k < z->scan_n; ++k) {
+               int n = z->order[k];
+               int ha = z->img_comp[n].ha;
+               for (y=0; y < z->img_comp[n].v; ++y) {
+                  for (x=0; x < z->img_comp[n].h; ++x) {
+                     int x2 = i*z->img_comp[n].h + x;
+                     int y2 = j*z->img_comp[n].v + y;
+                     short *data = z->img_comp[n].coeff + 64 * (x2 + y2 * z->img_comp[n].coeff_w);
+                     if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, unit)) return 0;
                   }
                }
-               // after all interleaved components, that's an interleaved MCU,
-               // so now count down the restart interval
-               if (--z->todo <= 0) {
-                  if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-                  if (!STBI__RESTART(z->marker)) return 1;
-                  stbi__jpeg_reset(z);
+            }
+            if (--z->todo <= 0) {
+               if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+               if (!STBI__RESTART(z->marker)) return 1;
+               stbi__jpeg_reset(z);
+            }
+         }
+      }
+   }
+   return 1;
+}
+
+// a baseline scan is decoded a row of units at a time: MCUs for an
+// interleaved scan, otherwise blocks of the one component
+static int stbi__jpeg_unit_rows(stbi__jpeg *z)
+{
+   return z->scan_n == 1 ? (z->img_comp[z->order[0]].y+7) >> 3 : z->img_mcu_y;
+}
+
+// image rows covered by a row of units
+static int stbi__jpeg_unit_height(stbi__jpeg *z)
+{
+   return z->scan_n == 1 ? 8 * (z->img_v_max / z->img_comp[z->order[0]].v) : z->img_mcu_h;
+}
+
+// decodes unit row j of a baseline scan. returns 2 if the scan stopped early
+// at something other than a restart marker, which leaves the rest of the
+// image corrupt rather than failing
+static int stbi__jpeg_decode_unit_row(stbi__jpeg *z, int j)
+{
+   STBI_SIMD_ALIGN(short, data[64]);
+   if (z->scan_n == 1) {
+      int i;
+      int n = z->order[0];
+      // non-interleaved data, we just need to process one block at a time,
+      // in trivial scanline order
+      // number of blocks to do just depends on how many actual "pixels" this
+      // component has, independent of interleaved MCU blocking and such
+      int w = (z->img_comp[n].x+7) >> 3;
+      int y2 = z->ring_mcus ? j*8 % z->img_comp[n].h2 : j*8;
+      for (i=0; i < w; ++i) {
+         int ha = z->img_comp[n].ha;
+         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+         z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+i*8, z->img_comp[n].w2, data);
+         // every data block is an MCU, so countdown the restart interval
+         if (--z->todo <= 0) {
+            if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+            // if it's NOT a restart, then just bail, so we get corrupt data
+            // rather than no data
+            if (!STBI__RESTART(z->marker)) return 2;
+            stbi__jpeg_reset(z);
+         }
+      }
+   } else { // interleaved
+      int i,k,x,y;
+      int jr = z->ring_mcus ? j % z->ring_mcus : j;
+      for (i=0; i < z->img_mcu_x; ++i) {
+         // scan an interleaved mcu... process scan_n components in order
+         for (k=0; k < z->scan_n; ++k) {
+            int n = z->order[k];
+            // scan out an mcu's worth of this component; that's just determined
+            // by the basic H and V specified for the component
+            for (y=0; y < z->img_comp[n].v; ++y) {
+               for (x=0; x < z->img_comp[n].h; ++x) {
+                  int x2 = (i*z->img_comp[n].h + x)*8;
+                  int y2 = (jr*z->img_comp[n].v + y)*8;
+                  int ha = z->img_comp[n].ha;
+                  if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+                  z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
                }
             }
          }
-         return 1;
+         // after all interleaved components, that's an interleaved MCU,
+         // so now count down the restart interval
+         if (--z->todo <= 0) {
+            if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+            if (!STBI__RESTART(z->marker)) return 2;
+            stbi__jpeg_reset(z);
+         }
+      }
+   }
+   return 1;
+}
+
+static int stbi__jpeg_out_rows(stbi__jpeg *z, int upto);
+
+static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
+{
+   if (z->coeff_only && !z->progressive)
+      return stbi__parse_entropy_coded_coeffs(z);
+   if (z->roi && !z->progressive)
+      return stbi__parse_entropy_coded_data_roi(z);
+   stbi__jpeg_reset(z);
+   if (!z->progressive) {
+      int j, r;
+      for (j=0; j < stbi__jpeg_unit_rows(z); ++j) {
+         r = stbi__jpeg_decode_unit_row(z, j);
+         if (r != 1) return r != 0;
+         // rows in the ring have to be converted before they're decoded
+         // over. the upsamplers look a row ahead, so only those above the
+         // last unit row are done
+         if (z->ring_mcus && z->band_out && !stbi__jpeg_out_rows(z, j * stbi__jpeg_unit_height(z))) return 0;
       }
+      return 1;
    } else {
       if (z->scan_n == 1) {
          int i,j;
@@ -3009,13 +3846,17 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
       // dequantize and idct the data
       int i,j,n;
       for (n=0; n < z->s->img_n; ++n) {
+         int bx = z->img_comp[n].win_bx, by = z->img_comp[n].win_by;
          int w = (z->img_comp[n].x+7) >> 3;
          int h = (z->img_comp[n].y+7) >> 3;
-         for (j=0; j < h; ++j) {
-            for (i=0; i < w; ++i) {
+         // only the blocks inside the window
+         if (w > bx + z->img_comp[n].w2/8) w = bx + z->img_comp[n].w2/8;
+         if (h > by + z->img_comp[n].h2/8) h = by + z->img_comp[n].h2/8;
+         for (j=by; j < h; ++j) {
+            for (i=bx; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*(j-by)*8+(i-bx)*8, z->img_comp[n].w2, data);
             }
          }
       }
@@ -3190,6 +4031,7 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
 {
    stbi__context *s = z->s;
    int Lf,p,i,q, h_max=1,v_max=1,c;
+   int mx0,my0,mx1,my1;
    Lf = stbi__get16be(s);         if (Lf < 11) return stbi__err("bad SOF len","Corrupt JPEG"); // JPEG
    p  = stbi__get8(s);            if (p != 8) return stbi__err("only 8-bit","JPEG format not supported: 8-bit only"); // JPEG baseline
    s->img_y = stbi__get16be(s);   if (s->img_y == 0) return stbi__err("no header height", "JPEG format not supported: delayed height"); // Legal, but we don't handle it--but neither does IJG
@@ -3220,7 +4062,7 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
 
    if (scan != STBI__SCAN_load) return 1;
 
-   if (!stbi__mad3sizes_valid(s->img_x, s->img_y, s->img_n, 0)) return stbi__err("too large", "Image too large to decode");
+   if (!stbi__mad3sizes_valid_wide(s->img_x, s->img_y, s->img_n, 0)) return stbi__err("too large", "Image too large to decode");
 
    for (i=0; i < s->img_n; ++i) {
       if (z->img_comp[i].h > h_max) h_max = z->img_comp[i].h;
@@ -3236,6 +4078,39 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
    z->img_mcu_x = (s->img_x + z->img_mcu_w-1) / z->img_mcu_w;
    z->img_mcu_y = (s->img_y + z->img_mcu_h-1) / z->img_mcu_h;
 
+   // pick the window of MCUs to reconstruct
+   if (z->roi) {
+      // upsampled chroma blends in its neighbors, so take one more MCU
+      // all around to get the same pixels as a full decode
+      int margin = (h_max > 1 || v_max > 1);
+      if (z->roi_w <= 0 || z->roi_h <= 0 || z->roi_x < 0 || z->roi_y < 0 ||
+          z->roi_w > (int) s->img_x - z->roi_x || z->roi_h > (int) s->img_y - z->roi_y)
+         return stbi__err("bad region", "Region is outside the image");
+      if (z->roi_flip) z->roi_y = s->img_y - z->roi_y - z->roi_h;
+      mx0 = z->roi_x / z->img_mcu_w - margin;
+      my0 = z->roi_y / z->img_mcu_h - margin;
+      mx1 = (z->roi_x + z->roi_w + z->img_mcu_w-1) / z->img_mcu_w + margin;
+      my1 = (z->roi_y + z->roi_h + z->img_mcu_h-1) / z->img_mcu_h + margin;
+      if (mx0 < 0) mx0 = 0;
+      if (my0 < 0) my0 = 0;
+      if (mx1 > z->img_mcu_x) mx1 = z->img_mcu_x;
+      if (my1 > z->img_mcu_y) my1 = z->img_mcu_y;
+   } else {
+      z->roi_x = z->roi_y = 0;
+      z->roi_w = s->img_x;
+      z->roi_h = s->img_y;
+      mx0 = my0 = 0;
+      mx1 = z->img_mcu_x;
+      my1 = z->img_mcu_y;
+   }
+   z->win_x0 = mx0 * z->img_mcu_w;
+   z->win_y0 = my0 * z->img_mcu_h;
+   z->win_w = (mx1 * z->img_mcu_w < (int) s->img_x ? mx1 * z->img_mcu_w : (int) s->img_x) - z->win_x0;
+   z->win_h = (my1 * z->img_mcu_h < (int) s->img_y ? my1 * z->img_mcu_h : (int) s->img_y) - z->win_y0;
+   // a progressive image needs all of it until the last scan
+   if (z->progressive || z->roi || z->coeff_only || z->ring_mcus >= my1 - my0)
+      z->ring_mcus = 0;
+
    for (i=0; i < s->img_n; ++i) {
       // number of effective pixels (e.g. for non-interleaved MCU)
       z->img_comp[i].x = (s->img_x * z->img_comp[i].h + h_max-1) / h_max;
@@ -3247,24 +4122,32 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       //
       // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
       // so these muls can't overflow with 32-bit ints (which we require)
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      z->img_comp[i].w2 = (mx1 - mx0) * z->img_comp[i].h * 8;
+      z->img_comp[i].h2 = (z->ring_mcus ? z->ring_mcus : my1 - my0) * z->img_comp[i].v * 8;
+      z->img_comp[i].win_bx = mx0 * z->img_comp[i].h;
+      z->img_comp[i].win_by = my0 * z->img_comp[i].v;
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
-      z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].h2, 15);
-      if (z->img_comp[i].raw_data == NULL)
-         return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
-      // align blocks for idct using mmx/sse
-      z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
-      if (z->progressive) {
-         // w2, h2 are multiples of 8 (see above)
-         z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-         z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+      z->img_comp[i].data = NULL;
+      if (!z->coeff_only) {
+         z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].h2, 15);
+         if (z->img_comp[i].raw_data == NULL)
+            return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
+         // align blocks for idct using mmx/sse
+         z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
+      }
+      if (z->progressive || z->coeff_only) {
+         // coefficients are kept for the whole image, windowed or not
+         z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+         z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
+         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].coeff_w * 8, z->img_comp[i].coeff_h * 8, sizeof(short), 15);
          if (z->img_comp[i].raw_coeff == NULL)
             return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
          z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
+         // blocks outside a non-interleaved scan's extent are never coded
+         if (z->coeff_only)
+            memset(z->img_comp[i].coeff, 0, z->img_comp[i].coeff_w * z->img_comp[i].coeff_h * 64 * sizeof(short));
       }
    }
 
@@ -3304,6 +4187,24 @@ static int stbi__decode_jpeg_header(stbi__jpeg *z, int scan)
    return 1;
 }
 
+// swaps the ring for whole components, before anything is decoded into it
+static int stbi__jpeg_unring(stbi__jpeg *z)
+{
+   int i;
+   for (i=0; i < z->s->img_n; ++i) {
+      STBI_FREE(z->img_comp[i].raw_data);
+      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].h2, 15);
+      if (z->img_comp[i].raw_data == NULL) {
+         z->img_comp[i].data = NULL;
+         return stbi__err("outofmem", "Out of memory");
+      }
+      z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
+   }
+   z->ring_mcus = 0;
+   return 1;
+}
+
 // decode image to YCbCr format
 static int stbi__decode_jpeg_image(stbi__jpeg *j)
 {
@@ -3318,7 +4219,16 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
    while (!stbi__EOI(m)) {
       if (stbi__SOS(m)) {
          if (!stbi__process_scan_header(j)) return 0;
+         // only an image in one scan can go through the ring
+         if (j->ring_mcus && j->scan_n != j->s->img_n && !stbi__jpeg_unring(j)) return 0;
          if (!stbi__parse_entropy_coded_data(j)) return 0;
+         if (j->ring_mcus) return 1;
+         if (j->roi && !j->progressive) {
+            // a region decode stops short of the end of the scan; once
+            // every component is in, the rest of the file isn't needed
+            if (j->scan_n == j->s->img_n) return 1;
+            stbi__jpeg_skip_scan(j);
+         }
          if (j->marker == STBI__MARKER_none ) {
             // handle 0s at the end of image data from IP Kamera 9060
             while (!stbi__at_eof(j->s)) {
@@ -3340,7 +4250,7 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
       }
       m = stbi__get_marker(j);
    }
-   if (j->progressive)
+   if (j->progressive && !j->coeff_only)
       stbi__jpeg_finish(j);
    return 1;
 }
@@ -3750,6 +4660,7 @@ typedef struct
    stbi_uc *line0,*line1;
    int hs,vs;   // expansion factor in each axis
    int w_lores; // horizontal pixels pre-expansion
+   int h_lores; // vertical pixels pre-expansion
    int ystep;   // how far through vertical expansion we are
    int ypos;    // which pre-expansion row we're on
 } stbi__resample;
@@ -3761,163 +4672,286 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
-static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+// true if the three components are R,G,B rather than Y,Cb,Cr
+static int stbi__jpeg_is_rgb(stbi__jpeg *z)
 {
-   int n, decode_n, is_rgb;
-   z->s->img_n = 0; // make stbi__cleanup_jpeg safe
+   return z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+}
 
-   // validate req_comp
-   if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+// upsamples and color converts the decoded component rows, one output row
+// at a time from the top of the window
+typedef struct
+{
+   stbi__resample res_comp[4];
+   int n, decode_n, is_rgb;
+} stbi__jpeg_convert;
 
-   // load a jpeg image from whichever source, but leave in YCbCr format
-   if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
+// allocates the line buffers, which stbi__cleanup_jpeg frees
+static int stbi__jpeg_convert_begin(stbi__jpeg *z, stbi__jpeg_convert *c, int req_comp)
+{
+   int k;
 
    // determine actual number of components to generate
-   n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
+   c->n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
 
-   is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+   c->is_rgb = stbi__jpeg_is_rgb(z);
 
-   if (z->s->img_n == 3 && n < 3 && !is_rgb)
-      decode_n = 1;
+   if (z->s->img_n == 3 && c->n < 3 && !c->is_rgb)
+      c->decode_n = 1;
    else
-      decode_n = z->s->img_n;
+      c->decode_n = z->s->img_n;
+
+   for (k=0; k < c->decode_n; ++k) {
+      stbi__resample *r = &c->res_comp[k];
+
+      // allocate line buffer big enough for upsampling off the edges
+      // with upsample factor of 4
+      z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->win_w + 3);
+      if (!z->img_comp[k].linebuf) return stbi__err("outofmem", "Out of memory");
+
+      r->hs      = z->img_h_max / z->img_comp[k].h;
+      r->vs      = z->img_v_max / z->img_comp[k].v;
+      r->ystep   = r->vs >> 1;
+      r->w_lores = (z->win_w + r->hs-1) / r->hs;
+      r->h_lores = (z->win_h * z->img_comp[k].v + z->img_v_max-1) / z->img_v_max;
+      r->ypos    = 0;
+      r->line0   = r->line1 = z->img_comp[k].data;
+
+      if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+      else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+      else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+      else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+      else                               r->resample = stbi__resample_row_generic;
+   }
+   return 1;
+}
 
-   // resample and color-convert
-   {
-      int k;
-      unsigned int i,j;
-      stbi_uc *output;
-      stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
-
-      stbi__resample res_comp[4];
-
-      for (k=0; k < decode_n; ++k) {
-         stbi__resample *r = &res_comp[k];
-
-         // allocate line buffer big enough for upsampling off the edges
-         // with upsample factor of 4
-         z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
-         if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-         r->hs      = z->img_h_max / z->img_comp[k].h;
-         r->vs      = z->img_v_max / z->img_comp[k].v;
-         r->ystep   = r->vs >> 1;
-         r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
-         r->ypos    = 0;
-         r->line0   = r->line1 = z->img_comp[k].data;
-
-         if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
-         else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
-         else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
-         else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
-         else                               r->resample = stbi__resample_row_generic;
-      }
-
-      // can't error after this so, this is safe
-      output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-      if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-      // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
-         for (k=0; k < decode_n; ++k) {
-            stbi__resample *r = &res_comp[k];
-            int y_bot = r->ystep >= (r->vs >> 1);
-            coutput[k] = r->resample(z->img_comp[k].linebuf,
-                                     y_bot ? r->line1 : r->line0,
-                                     y_bot ? r->line0 : r->line1,
-                                     r->w_lores, r->hs);
-            if (++r->ystep >= r->vs) {
-               r->ystep = 0;
-               r->line0 = r->line1;
-               if (++r->ypos < z->img_comp[k].y)
-                  r->line1 += z->img_comp[k].w2;
-            }
+// steps the upsamplers down a row of the window and, unless 'skip', converts
+// the region's part of it into 'out'. 1- and 3-channel output may be written
+// one byte past the end of the row. an upsampler can look at the component
+// row after the current one, so that has to be decoded already, and with
+// ring_mcus set the one before it mustn't be decoded over yet.
+static void stbi__jpeg_convert_row(stbi__jpeg *z, stbi__jpeg_convert *c, stbi_uc *out, int skip)
+{
+   int k, n = c->n;
+   unsigned int i, rw = z->roi_w;
+   int rx = z->roi_x - z->win_x0;
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+
+   for (k=0; k < c->decode_n; ++k) {
+      stbi__resample *r = &c->res_comp[k];
+      int y_bot = r->ystep >= (r->vs >> 1);
+      if (!skip)
+         coutput[k] = r->resample(z->img_comp[k].linebuf,
+                                  y_bot ? r->line1 : r->line0,
+                                  y_bot ? r->line0 : r->line1,
+                                  r->w_lores, r->hs) + rx;
+      if (++r->ystep >= r->vs) {
+         r->ystep = 0;
+         r->line0 = r->line1;
+         if (++r->ypos < r->h_lores) {
+            r->line1 += z->img_comp[k].w2;
+            if (r->line1 == z->img_comp[k].data + z->img_comp[k].w2 * z->img_comp[k].h2)
+               r->line1 = z->img_comp[k].data;
          }
-         if (n >= 3) {
-            stbi_uc *y = coutput[0];
-            if (z->s->img_n == 3) {
-               if (is_rgb) {
-                  for (i=0; i < z->s->img_x; ++i) {
-                     out[0] = y[i];
-                     out[1] = coutput[1][i];
-                     out[2] = coutput[2][i];
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else {
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else if (z->s->img_n == 4) {
-               if (z->app14_color_transform == 0) { // CMYK
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(coutput[0][i], m);
-                     out[1] = stbi__blinn_8x8(coutput[1][i], m);
-                     out[2] = stbi__blinn_8x8(coutput[2][i], m);
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else if (z->app14_color_transform == 2) { // YCCK
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(255 - out[0], m);
-                     out[1] = stbi__blinn_8x8(255 - out[1], m);
-                     out[2] = stbi__blinn_8x8(255 - out[2], m);
-                     out += n;
-                  }
-               } else { // YCbCr + alpha?  Ignore the fourth channel for now
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
-                  out += n;
-               }
+      }
+   }
+   if (skip) return;
+   if (n >= 3) {
+      stbi_uc *y = coutput[0];
+      if (z->s->img_n == 3) {
+         if (c->is_rgb) {
+            for (i=0; i < rw; ++i) {
+               out[0] = y[i];
+               out[1] = coutput[1][i];
+               out[2] = coutput[2][i];
+               out[3] = 255;
+               out += n;
+            }
          } else {
-            if (is_rgb) {
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i)
-                     *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-               else {
-                  for (i=0; i < z->s->img_x; ++i, out += 2) {
-                     out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                     out[1] = 255;
-                  }
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  stbi_uc m = coutput[3][i];
-                  stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-                  stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-                  stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-                  out[0] = stbi__compute_y(r, g, b);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else {
-               stbi_uc *y = coutput[0];
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
-               else
-                  for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+            z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], rw, n);
+         }
+      } else if (z->s->img_n == 4) {
+         if (z->app14_color_transform == 0) { // CMYK
+            for (i=0; i < rw; ++i) {
+               stbi_uc m = coutput[3][i];
+               out[0] = stbi__blinn_8x8(coutput[0][i], m);
+               out[1] = stbi__blinn_8x8(coutput[1][i], m);
+               out[2] = stbi__blinn_8x8(coutput[2][i], m);
+               out[3] = 255;
+               out += n;
+            }
+         } else if (z->app14_color_transform == 2) { // YCCK
+            z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], rw, n);
+            for (i=0; i < rw; ++i) {
+               stbi_uc m = coutput[3][i];
+               out[0] = stbi__blinn_8x8(255 - out[0], m);
+               out[1] = stbi__blinn_8x8(255 - out[1], m);
+               out[2] = stbi__blinn_8x8(255 - out[2], m);
+               out += n;
+            }
+         } else { // YCbCr + alpha?  Ignore the fourth channel for now
+            z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], rw, n);
+         }
+      } else
+         for (i=0; i < rw; ++i) {
+            out[0] = out[1] = out[2] = y[i];
+            out[3] = 255; // not used if n==3
+            out += n;
+         }
+   } else {
+      if (c->is_rgb) {
+         if (n == 1)
+            for (i=0; i < rw; ++i)
+               *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+         else {
+            for (i=0; i < rw; ++i, out += 2) {
+               out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+               out[1] = 255;
             }
          }
+      } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+         for (i=0; i < rw; ++i) {
+            stbi_uc m = coutput[3][i];
+            stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+            stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+            stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+            out[0] = stbi__compute_y(r, g, b);
+            out[1] = 255;
+            out += n;
+         }
+      } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+         for (i=0; i < rw; ++i) {
+            out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+            out[1] = 255;
+            out += n;
+         }
+      } else {
+         stbi_uc *y = coutput[0];
+         if (n == 1)
+            for (i=0; i < rw; ++i) out[i] = y[i];
+         else
+            for (i=0; i < rw; ++i) { *out++ = y[i]; *out++ = 255; }
+      }
+   }
+}
+
+// where load_jpeg_image's rows go: 'output', or for stbi_load_rows the
+// callback a band at a time. it's set up once the frame header is known,
+// which for a banded decode is partway through the scan
+typedef struct
+{
+   stbi__jpeg_convert c;
+   int req_comp, started, own;
+   stbi_uc *output, *first_row, *scratch;
+   int out_stride;
+   int j;       // next row of the window
+   stbi__rows *rows;
+   stbi__band band;
+   stbi_uc *band_mem;
+} stbi__jpeg_out;
+
+static int stbi__jpeg_out_begin(stbi__jpeg *z, stbi__jpeg_out *o)
+{
+   if (!stbi__jpeg_convert_begin(z, &o->c, o->req_comp)) return 0;
+   if (o->rows) {
+      size_t stride = (size_t) o->c.n * z->s->img_x;
+      size_t band_rows = STBI__ROWS_BAND_BYTES / stride;
+      if (band_rows < 1) band_rows = 1;
+      *o->rows->x = z->s->img_x;
+      *o->rows->y = z->s->img_y;
+      if (o->rows->comp) *o->rows->comp = z->s->img_n >= 3 ? 3 : 1;
+      // converters may write a byte past the row, which bottom up would
+      // land on a finished one
+      o->band_mem = (stbi_uc *) stbi__malloc(band_rows * stride + 1);
+      if (!o->band_mem) return stbi__err("outofmem", "Out of memory");
+      if (stbi__vertically_flip_on_load && (o->c.n == 1 || o->c.n == 3)) {
+         o->scratch = (stbi_uc *) stbi__malloc(stride + 1);
+         if (!o->scratch) return stbi__err("outofmem", "Out of memory");
+      }
+      stbi__band_begin(&o->band, o->band_mem, stride, z->s->img_y, (stbi__uint32) band_rows);
+   } else if (!o->output) {
+      o->output = (stbi_uc *) stbi__malloc_mad3_wide(o->c.n, z->roi_w, z->roi_h, 1);
+      if (!o->output) return stbi__err("outofmem", "Out of memory");
+      o->own = 1;
+      o->out_stride = o->c.n * z->roi_w;
+   } else {
+      if (!o->out_stride) o->out_stride = o->c.n * z->roi_w;
+      // some converters store one byte past the last pixel of a 1- or
+      // 3-channel row, which our own allocation leaves room for but the
+      // caller's may not
+      if (o->c.n == 1 || o->c.n == 3) {
+         o->scratch = (stbi_uc *) stbi__malloc_mad2(o->c.n, z->roi_w, 1);
+         if (!o->scratch) return stbi__err("outofmem", "Out of memory");
       }
+   }
+   o->first_row = o->output;
+   if (z->roi_flip) { // a region decode writes straight to the caller, so flip here
+      o->first_row += (size_t) (z->roi_h-1) * o->out_stride;
+      o->out_stride = -o->out_stride;
+   }
+   o->j = 0;
+   o->started = 1;
+   return 1;
+}
+
+// resamples the window down to row 'upto'; the window around a region is
+// stepped through for the upsamplers, but only the region is converted
+static int stbi__jpeg_out_rows(stbi__jpeg *z, int upto)
+{
+   stbi__jpeg_out *o = (stbi__jpeg_out *) z->band_out;
+   int ry = z->roi_y - z->win_y0;
+   if (!o->started && !stbi__jpeg_out_begin(z, o)) return 0;
+   if (upto > ry + z->roi_h) upto = ry + z->roi_h;
+   for (; o->j < upto; ++o->j) {
+      stbi_uc *dest = o->rows ? stbi__band_row(&o->band, o->j) : o->first_row + (ptrdiff_t) o->out_stride * (o->j - ry);
+      stbi__jpeg_convert_row(z, &o->c, o->scratch ? o->scratch : dest, o->j < ry);
+      if (o->scratch && o->j >= ry) memcpy(dest, o->scratch, (size_t) z->roi_w * o->c.n);
+      if (o->rows && stbi__band_full(&o->band, o->j + 1))
+         if (!stbi__band_flush(&o->band, o->rows, o->j + 1)) return 0;
+   }
+   return 1;
+}
+
+// decodes into 'output' (allocated if NULL) the roi_* rectangle set up by
+// stbi__process_frame_header, which is the whole image unless z->roi. a
+// baseline image in one scan is converted as it goes, otherwise once it's
+// all decoded
+static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp, stbi_uc *output, int out_stride)
+{
+   stbi__jpeg_out o;
+   z->s->img_n = 0; // make stbi__cleanup_jpeg safe
+
+   // validate req_comp
+   if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+
+   o.req_comp = req_comp;
+   o.output = output;
+   o.out_stride = out_stride;
+   o.scratch = o.band_mem = NULL;
+   o.started = o.own = 0;
+   o.rows = z->roi ? NULL : z->s->rows;
+   z->band_out = &o;
+   if (!stbi__decode_jpeg_image(z) || !stbi__jpeg_out_rows(z, z->win_h)) {
       stbi__cleanup_jpeg(z);
-      *out_x = z->s->img_x;
-      *out_y = z->s->img_y;
-      if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
-      return output;
+      STBI_FREE(o.scratch);
+      STBI_FREE(o.band_mem);
+      if (o.own) STBI_FREE(o.output);
+      z->band_out = NULL;
+      return NULL;
+   }
+   STBI_FREE(o.scratch);
+   STBI_FREE(o.band_mem);
+   stbi__cleanup_jpeg(z);
+   z->band_out = NULL;
+   if (o.rows) { // the rows went to the caller's callback
+      o.rows->streamed = 1;
+      return NULL;
    }
+   *out_x = z->s->img_x;
+   *out_y = z->s->img_y;
+   if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
+   return o.output;
 }
 
 static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
@@ -3927,8 +4961,142 @@ static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int re
    STBI_NOTUSED(ri);
    j->s = s;
    stbi__setup_jpeg(j);
-   result = load_jpeg_image(j, x,y,comp,req_comp);
+   j->roi = j->roi_flip = 0;
+   j->coeff_only = 0;
+   j->ring_mcus = STBI__JPEG_RING_MCUS;
+   result = load_jpeg_image(j, x,y,comp,req_comp, NULL, 0);
+   STBI_FREE(j);
+   return result;
+}
+
+static int stbi__jpeg_load_region(stbi__context *s, int *x, int *y, int *comp, int req_comp, int rx, int ry, int rw, int rh, stbi_uc *out, int out_stride)
+{
+   stbi_uc *result;
+   stbi__jpeg* j = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
+   if (!j) return stbi__err("outofmem", "Out of memory");
+   j->s = s;
+   stbi__setup_jpeg(j);
+   j->roi = 1;
+   j->coeff_only = 0;
+   j->ring_mcus = 0;
+   j->roi_flip = stbi__vertically_flip_on_load;
+   j->roi_x = rx;
+   j->roi_y = ry;
+   j->roi_w = rw;
+   j->roi_h = rh;
+   result = load_jpeg_image(j, x,y,comp,req_comp, out, out_stride);
    STBI_FREE(j);
+   return result != NULL;
+}
+
+static stbi_uc *stbi__jpeg_load_ycbcr(stbi__context *s, int *x, int *y, int *plane_w, int *plane_h)
+{
+   stbi_uc *result = NULL;
+   stbi__jpeg* z = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
+   if (!z) return stbi__errpuc("outofmem", "Out of memory");
+   z->s = s;
+   stbi__setup_jpeg(z);
+   z->roi = z->roi_flip = 0;
+   z->coeff_only = 0;
+   z->ring_mcus = 0;
+   s->img_n = 0; // make stbi__cleanup_jpeg safe
+
+   if (stbi__decode_jpeg_image(z)) {
+      if (s->img_n != 3 || stbi__jpeg_is_rgb(z)) {
+         stbi__err("not YCbCr", "Image is not stored as YCbCr");
+      } else {
+         int k, j;
+         size_t total = 0;
+         // no plane is bigger than img_x*img_y, and the frame header checked
+         // img_x*img_y*3 fits in half of size_t, so this can't overflow. it
+         // can be over 2GB though, so it's never held in an int
+         for (k=0; k < 3; ++k) {
+            plane_w[k] = z->img_comp[k].x;
+            plane_h[k] = z->img_comp[k].y;
+            total += (size_t) plane_w[k] * plane_h[k];
+         }
+         result = (stbi_uc *) stbi__malloc(total);
+         if (!result) {
+            stbi__err("outofmem", "Out of memory");
+         } else {
+            stbi_uc *p = result;
+            for (k=0; k < 3; ++k) {
+               for (j=0; j < plane_h[k]; ++j) {
+                  int row = stbi__vertically_flip_on_load ? plane_h[k]-1 - j : j;
+                  memcpy(p, z->img_comp[k].data + (size_t) row * z->img_comp[k].w2, plane_w[k]);
+                  p += plane_w[k];
+               }
+            }
+            *x = s->img_x;
+            *y = s->img_y;
+         }
+      }
+   }
+   stbi__cleanup_jpeg(z);
+   STBI_FREE(z);
+   return result;
+}
+
+static stbi_jpeg_coefficients *stbi__jpeg_load_coefficients(stbi__context *s)
+{
+   stbi_jpeg_coefficients *result = NULL;
+   stbi__jpeg* z = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
+   if (!z) return (stbi_jpeg_coefficients *) stbi__errpuc("outofmem", "Out of memory");
+   z->s = s;
+   stbi__setup_jpeg(z);
+   z->roi = z->roi_flip = 0;
+   z->coeff_only = 1;
+   z->ring_mcus = 0;
+   s->img_n = 0; // make stbi__cleanup_jpeg safe
+
+   if (stbi__decode_jpeg_image(z)) {
+      if (s->img_n == 4 || stbi__jpeg_is_rgb(z)) {
+         stbi__err("not YCbCr", "Image is not stored as grayscale or YCbCr");
+      } else {
+         int k, i, j, v;
+         size_t total = sizeof(stbi_jpeg_coefficients);
+         // each plane's grid was already allocated once as raw_coeff, so
+         // none of these sizes overflow
+         for (k=0; k < s->img_n; ++k)
+            total += (size_t) z->img_comp[k].coeff_w * z->img_comp[k].coeff_h * 64 * sizeof(short);
+         result = (stbi_jpeg_coefficients *) stbi__malloc(total);
+         if (!result) {
+            stbi__err("outofmem", "Out of memory");
+         } else {
+            short *p = (short *) (result + 1);
+            memset(result, 0, sizeof(*result));
+            result->x = s->img_x;
+            result->y = s->img_y;
+            result->n = s->img_n;
+            result->h_max = z->img_h_max;
+            result->v_max = z->img_v_max;
+            result->flip = stbi__vertically_flip_on_load;
+            for (k=0; k < s->img_n; ++k) {
+               stbi_jpeg_plane *plane = &result->plane[k];
+               int stride = z->img_comp[k].coeff_w * 8;
+               plane->w = z->img_comp[k].x;
+               plane->h = z->img_comp[k].y;
+               plane->coeff_w = stride;
+               plane->coeff_h = z->img_comp[k].coeff_h * 8;
+               plane->h_samp = z->img_comp[k].h;
+               plane->v_samp = z->img_comp[k].v;
+               memcpy(plane->quant, z->dequant[z->img_comp[k].tq], sizeof(plane->quant));
+               plane->coeff = p;
+               // scatter each block's 8 rows of frequencies into place
+               for (j=0; j < z->img_comp[k].coeff_h; ++j) {
+                  for (i=0; i < z->img_comp[k].coeff_w; ++i) {
+                     short *block = z->img_comp[k].coeff + 64 * (i + j * z->img_comp[k].coeff_w);
+                     for (v=0; v < 8; ++v)
+                        memcpy(p + (size_t) (j*8+v) * stride + i*8, block + v*8, 8 * sizeof(short));
+                  }
+               }
+               p += (size_t) stride * plane->coeff_h;
+            }
+         }
+      }
+   }
+   stbi__cleanup_jpeg(z);
+   STBI_FREE(z);
    return result;
 }
 
@@ -4061,6 +5229,12 @@ static int stbi__zbuild_huffman(stbi__zhuffman *z, const stbi_uc *sizelist, int
 //    and it's annoying structurally to have PNG call ZLIB call PNG,
 //    we require PNG read all the IDATs and combine them into a single
 //    memory buffer
+//
+//    the exception is when 'zrefill' is set: it hands out the input a
+//    piece at a time, so PNG can pass the IDAT payloads along as they are
+//    (see stbi__png_idat_refill). streaming decode adds to that an output
+//    that's a sliding window the inflater suspends on when full (see
+//    stbi__zstream_run)
 
 typedef struct
 {
@@ -4073,12 +5247,22 @@ typedef struct
    char *zout_end;
    int   z_expandable;
 
+   // optional source of more input once zbuffer runs dry; returns 0 at end
+   int (*zrefill)(void *user, stbi_uc **start, stbi_uc **end);
+   void *zrefill_user;
+
+   // resumable state, only used when z_streaming is set
+   int z_streaming;
+   int zstate, zfinal, zstored;
+   int zpend_len, zpend_dist, zpend_lit;
+
    stbi__zhuffman z_length, z_distance;
 } stbi__zbuf;
 
 stbi_inline static int stbi__zeof(stbi__zbuf *z)
 {
-   return (z->zbuffer >= z->zbuffer_end);
+   if (z->zbuffer < z->zbuffer_end) return 0;
+   return !z->zrefill || !z->zrefill(z->zrefill_user, &z->zbuffer, &z->zbuffer_end);
 }
 
 stbi_inline static stbi_uc stbi__zget8(stbi__zbuf *z)
@@ -4190,6 +5374,11 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
       if (z < 256) {
          if (z < 0) return stbi__err("bad huffman code","Corrupt PNG"); // error in huffman codes
          if (zout >= a->zout_end) {
+            if (a->z_streaming) { // window full; emit the literal on resume
+               a->zpend_len = 1; a->zpend_dist = 0; a->zpend_lit = z;
+               a->zout = zout;
+               return 2;
+            }
             if (!stbi__zexpand(a, zout, 1)) return 0;
             zout = a->zout;
          }
@@ -4210,6 +5399,11 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
          if (stbi__zdist_extra[z]) dist += stbi__zreceive(a, stbi__zdist_extra[z]);
          if (zout - a->zout_start < dist) return stbi__err("bad dist","Corrupt PNG");
          if (zout + len > a->zout_end) {
+            if (a->z_streaming) { // window full; copy the match on resume
+               a->zpend_len = len; a->zpend_dist = dist;
+               a->zout = zout;
+               return 2;
+            }
             if (!stbi__zexpand(a, zout, len)) return 0;
             zout = a->zout;
          }
@@ -4274,7 +5468,8 @@ static int stbi__compute_huffman_codes(stbi__zbuf *a)
    return 1;
 }
 
-static int stbi__parse_uncompressed_block(stbi__zbuf *a)
+// reads a stored block's header, returning its length or -1
+static int stbi__parse_uncompressed_header(stbi__zbuf *a)
 {
    stbi_uc header[4];
    int len,nlen,k;
@@ -4287,16 +5482,32 @@ static int stbi__parse_uncompressed_block(stbi__zbuf *a)
       a->code_buffer >>= 8;
       a->num_bits -= 8;
    }
-   if (a->num_bits < 0) return stbi__err("zlib corrupt","Corrupt PNG");
+   if (a->num_bits < 0) return stbi__err("zlib corrupt","Corrupt PNG") - 1;
    // now fill header the normal way
    while (k < 4)
       header[k++] = stbi__zget8(a);
    len  = header[1] * 256 + header[0];
    nlen = header[3] * 256 + header[2];
-   if (nlen != (len ^ 0xffff)) return stbi__err("zlib corrupt","Corrupt PNG");
-   if (a->zbuffer + len > a->zbuffer_end) return stbi__err("read past buffer","Corrupt PNG");
+   if (nlen != (len ^ 0xffff)) return stbi__err("zlib corrupt","Corrupt PNG") - 1;
+   return len;
+}
+
+static int stbi__parse_uncompressed_block(stbi__zbuf *a)
+{
+   int len = stbi__parse_uncompressed_header(a);
+   if (len < 0) return 0;
+   if (!a->zrefill && a->zbuffer + len > a->zbuffer_end) return stbi__err("read past buffer","Corrupt PNG");
    if (a->zout + len > a->zout_end)
       if (!stbi__zexpand(a, a->zout, len)) return 0;
+   // with a refill the stored data may straddle input pieces
+   while (a->zbuffer + len > a->zbuffer_end) {
+      int n = (int) (a->zbuffer_end - a->zbuffer);
+      memcpy(a->zout, a->zbuffer, n);
+      a->zbuffer += n;
+      a->zout += n;
+      len -= n;
+      if (stbi__zeof(a)) return stbi__err("read past buffer","Corrupt PNG");
+   }
    memcpy(a->zout, a->zbuffer, len);
    a->zbuffer += len;
    a->zout += len;
@@ -4370,27 +5581,531 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
          }
          if (!stbi__parse_huffman_block(a)) return 0;
       }
-   } while (!final);
+   } while (!final);
+   return 1;
+}
+
+static int stbi__do_zlib(stbi__zbuf *a, char *obuf, int olen, int exp, int parse_header)
+{
+   a->zout_start = obuf;
+   a->zout       = obuf;
+   a->zout_end   = obuf + olen;
+   a->z_expandable = exp;
+   a->z_streaming = 0;
+
+   return stbi__parse_zlib(a, parse_header);
+}
+
+// resumable inflate, for decoding into a bounded sliding window
+enum
+{
+   STBI__ZSTATE_header,
+   STBI__ZSTATE_block_header,
+   STBI__ZSTATE_stored,
+   STBI__ZSTATE_huffman,
+   STBI__ZSTATE_done
+};
+
+static void stbi__zstream_begin(stbi__zbuf *a, char *window, int window_len, int parse_header)
+{
+   a->zout_start = a->zout = window;
+   a->zout_end = window + window_len;
+   a->z_expandable = 0;
+   a->z_streaming = 1;
+   // the header is read by the first run, so no input is needed yet
+   a->zstate = parse_header ? STBI__ZSTATE_header : STBI__ZSTATE_block_header;
+   a->zfinal = a->zstored = a->zpend_len = 0;
+   a->num_bits = 0;
+   a->code_buffer = 0;
+}
+
+// discard window contents before 'keep', but never the last 32KB, which
+// later matches may still refer to. returns how far the contents moved.
+static int stbi__zstream_slide(stbi__zbuf *a, char *keep)
+{
+   int shift;
+   if (a->zout - keep < 32768) keep = a->zout - 32768;
+   if (keep <= a->zout_start) return 0;
+   shift = (int) (keep - a->zout_start);
+   memmove(a->zout_start, keep, a->zout - keep);
+   a->zout -= shift;
+   return shift;
+}
+
+// inflate until the window is full (returns 2), the stream ends (1) or the
+// data is corrupt (0). the caller slides the window between calls.
+static int stbi__zstream_run(stbi__zbuf *a)
+{
+   for (;;) {
+      if (a->zpend_len) {
+         // finish the symbol that didn't fit last time
+         while (a->zpend_len && a->zout < a->zout_end) {
+            *a->zout = a->zpend_dist ? a->zout[-a->zpend_dist] : (char) a->zpend_lit;
+            ++a->zout;
+            --a->zpend_len;
+         }
+         if (a->zpend_len) return 2;
+      }
+      switch (a->zstate) {
+         case STBI__ZSTATE_header:
+            if (!stbi__parse_zlib_header(a)) return 0;
+            a->zstate = STBI__ZSTATE_block_header;
+            break;
+         case STBI__ZSTATE_block_header: {
+            int type;
+            if (a->zfinal) { a->zstate = STBI__ZSTATE_done; return 1; }
+            a->zfinal = stbi__zreceive(a,1);
+            type = stbi__zreceive(a,2);
+            if (type == 0) {
+               a->zstored = stbi__parse_uncompressed_header(a);
+               if (a->zstored < 0) return 0;
+               a->zstate = STBI__ZSTATE_stored;
+            } else if (type == 3) {
+               return 0;
+            } else {
+               if (type == 1) {
+                  if (!stbi__zbuild_huffman(&a->z_length  , stbi__zdefault_length  , 288)) return 0;
+                  if (!stbi__zbuild_huffman(&a->z_distance, stbi__zdefault_distance,  32)) return 0;
+               } else {
+                  if (!stbi__compute_huffman_codes(a)) return 0;
+               }
+               a->zstate = STBI__ZSTATE_huffman;
+            }
+            break;
+         }
+         case STBI__ZSTATE_stored:
+            // stored data may straddle input pieces, so copy piecewise
+            while (a->zstored) {
+               int n = a->zstored;
+               if (a->zout >= a->zout_end) return 2;
+               if (stbi__zeof(a)) return stbi__err("read past buffer","Corrupt PNG");
+               if (a->zout >= a->zout_end) return 2; // the refill may stop us
+               if (n > a->zbuffer_end - a->zbuffer) n = (int) (a->zbuffer_end - a->zbuffer);
+               if (n > a->zout_end - a->zout) n = (int) (a->zout_end - a->zout);
+               memcpy(a->zout, a->zbuffer, n);
+               a->zbuffer += n;
+               a->zout += n;
+               a->zstored -= n;
+            }
+            a->zstate = STBI__ZSTATE_block_header;
+            break;
+         case STBI__ZSTATE_huffman: {
+            int r = stbi__parse_huffman_block(a);
+            if (r != 1) return r;
+            a->zstate = STBI__ZSTATE_block_header;
+            break;
+         }
+         default:
+            return 1;
+      }
+   }
+}
+
+#ifdef STBI_PARALLEL_INFLATE
+// speculative parallel inflate
+//
+// a deflate stream has no sync points, so each worker guesses where a block
+// starts inside its share of the input and decodes from there without the
+// 32KB of output that precedes it. bytes copied out of that unknown window
+// are kept as markers (256 + offset into the window) in 16-bit output, and
+// are replaced once everything before the chunk is known. a guess is only
+// trusted if the previous chunk's decode ends exactly on it; anything
+// unexpected falls back to the serial inflate, which reports real errors.
+//
+// only dynamic and stored blocks are looked for, since fixed-code blocks
+// have too little header to recognize. a share with no recognizable block
+// is merged into the one before it.
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#ifndef STBI_PARALLEL_INFLATE_MIN
+#define STBI_PARALLEL_INFLATE_MIN  (1 << 20) // compressed bytes per thread
+#endif
+#define STBI__ZPAR_MAX_THREADS     64
+#define STBI__ZPAR_WINDOW          32768
+
+enum
+{
+   STBI__ZPAR_find,
+   STBI__ZPAR_decode,
+   STBI__ZPAR_resolve
+};
+
+typedef struct
+{
+   stbi__zbuf z;
+   stbi_uc *data;          // whole compressed stream
+   size_t data_len;
+   int phase, ok;
+   size_t search_from, search_to; // bit range to look for a block start in
+   size_t start, stop;     // bit offsets of the chunk; stop is 0 for the last
+   stbi__uint16 *sym;      // STBI__ZPAR_WINDOW markers, then the output
+   size_t len, cap;        // output symbols, excluding the markers
+   size_t dest, resolved;  // offset in the final output; symbols resolved
+   stbi_uc *out;           // the final output
+} stbi__zpar_chunk;
+
+static int stbi__zpar_threads = 0;
+
+STBIDEF void stbi_set_inflate_threads(int num_threads)
+{
+   stbi__zpar_threads = num_threads;
+}
+
+static size_t stbi__zpar_bitpos(stbi__zpar_chunk *c)
+{
+   return (size_t) (c->z.zbuffer - c->data) * 8 - c->z.num_bits;
+}
+
+static void stbi__zpar_seek(stbi__zpar_chunk *c, size_t bit)
+{
+   c->z.zbuffer = c->data + (bit >> 3);
+   c->z.zbuffer_end = c->data + c->data_len;
+   c->z.zrefill = NULL;
+   c->z.num_bits = 0;
+   c->z.code_buffer = 0;
+   if (bit & 7) stbi__zreceive(&c->z, (int) (bit & 7));
+}
+
+// up to 25 bits at an arbitrary bit offset, without touching the decoder
+static unsigned int stbi__zpar_peek(stbi__zpar_chunk *c, size_t bit, int n)
+{
+   size_t i = bit >> 3;
+   unsigned int v = 0;
+   int k;
+   for (k=0; k < 4 && i+k < c->data_len; ++k)
+      v |= (unsigned int) c->data[i+k] << (8*k);
+   return (v >> (bit & 7)) & ((1u << n) - 1);
+}
+
+static int stbi__zpar_reserve(stbi__zpar_chunk *c, size_t n)
+{
+   stbi__uint16 *p;
+   size_t cap = c->cap;
+   if (c->len + n <= cap) return 1;
+   while (c->len + n > cap) cap *= 2;
+   p = (stbi__uint16 *) STBI_REALLOC(c->sym, (STBI__ZPAR_WINDOW + cap) * sizeof(*p));
+   if (!p) return 0;
+   c->sym = p;
+   c->cap = cap;
+   return 1;
+}
+
+// stbi__parse_huffman_block into 16-bit symbols; stricter, since it is also
+// used to reject false block starts
+static int stbi__zpar_huffman_block(stbi__zpar_chunk *c)
+{
+   stbi__zbuf *a = &c->z;
+   for(;;) {
+      int z = stbi__zhuffman_decode(a, &a->z_length);
+      if (!stbi__zpar_reserve(c, 258)) return 0;
+      if (z < 256) {
+         if (z < 0) return 0;
+         c->sym[STBI__ZPAR_WINDOW + c->len++] = (stbi__uint16) z;
+      } else {
+         stbi__uint16 *p, *q;
+         int len,dist;
+         if (z == 256) return 1;
+         z -= 257;
+         if (z >= 29) return 0;
+         len = stbi__zlength_base[z];
+         if (stbi__zlength_extra[z]) len += stbi__zreceive(a, stbi__zlength_extra[z]);
+         z = stbi__zhuffman_decode(a, &a->z_distance);
+         if (z < 0 || z >= 30) return 0;
+         dist = stbi__zdist_base[z];
+         if (stbi__zdist_extra[z]) dist += stbi__zreceive(a, stbi__zdist_extra[z]);
+         // the markers make every distance up to the window size valid
+         q = c->sym + STBI__ZPAR_WINDOW + c->len;
+         p = q - dist;
+         c->len += len;
+         do *q++ = *p++; while (--len);
+      }
+   }
+}
+
+// decodes one block whose header starts at the current position. 'strict'
+// is for telling real blocks from noise: it wants zero padding before
+// stored data and complete codes, as real encoders write, and rejects
+// fixed-code blocks, whose 3-bit header says too little
+static int stbi__zpar_block(stbi__zpar_chunk *c, int *final, int strict)
+{
+   stbi__zbuf *a = &c->z;
+   int type;
+   *final = stbi__zreceive(a,1);
+   type = stbi__zreceive(a,2);
+   if (type == 0) {
+      int i, len;
+      if (strict && (a->code_buffer & ((1u << (a->num_bits & 7)) - 1))) return 0;
+      len = stbi__parse_uncompressed_header(a);
+      if (len < 0 || a->zbuffer + len > a->zbuffer_end) return 0;
+      if (!stbi__zpar_reserve(c, len)) return 0;
+      for (i=0; i < len; ++i)
+         c->sym[STBI__ZPAR_WINDOW + c->len++] = a->zbuffer[i];
+      a->zbuffer += len;
+      return 1;
+   } else if (type == 1) {
+      if (strict) return 0;
+      if (!stbi__zbuild_huffman(&a->z_length  , stbi__zdefault_length  , 288)) return 0;
+      if (!stbi__zbuild_huffman(&a->z_distance, stbi__zdefault_distance,  32)) return 0;
+   } else if (type == 2) {
+      if (!stbi__compute_huffman_codes(a)) return 0;
+      if (strict) {
+         if (a->z_length.maxcode[15] != 0x10000) return 0;
+         // a lone distance code is allowed to leave that code incomplete
+         if (a->z_distance.maxcode[15] != 0x10000 && a->z_distance.maxcode[15] != 0x8000) return 0;
+      }
+   } else {
+      return 0;
+   }
+   return stbi__zpar_huffman_block(c);
+}
+
+// cheap test of a dynamic block header at 'bit': counts in range and a
+// complete code-length code, as every real encoder writes
+static int stbi__zpar_plausible(stbi__zpar_chunk *c, size_t bit)
+{
+   static const int length_dezigzag[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
+   unsigned int h = stbi__zpar_peek(c, bit, 17);
+   int i, hclen, kraft = 0;
+   stbi_uc sizes[19];
+   if ((h & 7) != 4) return 0;         // not final, type 2
+   if (((h >> 3) & 31) > 29) return 0; // hlit > 286
+   if (((h >> 8) & 31) > 29) return 0; // hdist > 30
+   hclen = ((h >> 13) & 15) + 4;
+   memset(sizes, 0, sizeof(sizes));
+   for (i=0; i < hclen; ++i)
+      sizes[length_dezigzag[i]] = (stbi_uc) stbi__zpar_peek(c, bit + 17 + i*3, 3);
+   for (i=0; i < 19; ++i)
+      if (sizes[i]) kraft += 128 >> sizes[i];
+   return kraft == 128;
+}
+
+// finds the first bit in [search_from, search_to) where a strict block
+// decodes cleanly, followed by another one
+static int stbi__zpar_find(stbi__zpar_chunk *c)
+{
+   size_t bit;
+   int final;
+   for (bit = c->search_from; bit < c->search_to; ++bit) {
+      unsigned int h = stbi__zpar_peek(c, bit, 3);
+      if (h == 0) {
+         // stored: LEN and NLEN at the next byte boundary must agree
+         size_t b = (bit + 3 + 7) & ~(size_t) 7;
+         if ((stbi__zpar_peek(c, b, 16) ^ stbi__zpar_peek(c, b + 16, 16)) != 0xffff) continue;
+      } else if (!stbi__zpar_plausible(c, bit)) {
+         continue;
+      }
+      stbi__zpar_seek(c, bit);
+      c->len = 0;
+      if (!stbi__zpar_block(c, &final, 1)) continue;
+      if (!stbi__zpar_block(c, &final, 1)) continue;
+      c->start = bit;
+      return 1;
+   }
+   return 0;
+}
+
+// a stored block's header is zero bits up to a byte boundary, so offsets a
+// few bits apart can decode identically, and a search may find either
+static int stbi__zpar_same_stored(stbi__zpar_chunk *c, size_t early, size_t late)
+{
+   return (early + 10) >> 3 == (late + 10) >> 3 && stbi__zpar_peek(c, early, (int) (late - early) + 3) == 0;
+}
+
+// decodes whole blocks from c->start until landing exactly on c->stop, or
+// through the final block when this is the last chunk
+static int stbi__zpar_decode(stbi__zpar_chunk *c)
+{
+   int k, final = 0;
+   for (k=0; k < STBI__ZPAR_WINDOW; ++k)
+      c->sym[k] = (stbi__uint16) (256 + k);
+   c->len = 0;
+   stbi__zpar_seek(c, c->start);
+   for (;;) {
+      if (c->stop) {
+         size_t pos = stbi__zpar_bitpos(c);
+         if (pos >= c->stop) return pos == c->stop || stbi__zpar_same_stored(c, c->stop, pos);
+         if (stbi__zpar_same_stored(c, pos, c->stop)) return 1;
+      }
+      if (!stbi__zpar_block(c, &final, 0)) return 0;
+      if (final) return !c->stop;
+   }
+}
+
+// writes output symbols [from,to) of the chunk as bytes, looking markers up
+// in the output that precedes it
+static int stbi__zpar_resolve(stbi__zpar_chunk *c, size_t from, size_t to)
+{
+   stbi__uint16 *s = c->sym + STBI__ZPAR_WINDOW;
+   stbi_uc *o = c->out + c->dest;
+   size_t i;
+   for (i=from; i < to; ++i) {
+      int v = s[i];
+      if (v < 256) {
+         o[i] = (stbi_uc) v;
+      } else {
+         size_t back = STBI__ZPAR_WINDOW - (v - 256);
+         if (back > c->dest) return 0; // reaches before the start of the stream
+         o[i] = o[-(ptrdiff_t) back];
+      }
+   }
    return 1;
 }
 
-static int stbi__do_zlib(stbi__zbuf *a, char *obuf, int olen, int exp, int parse_header)
+static void stbi__zpar_work(stbi__zpar_chunk *c)
 {
-   a->zout_start = obuf;
-   a->zout       = obuf;
-   a->zout_end   = obuf + olen;
-   a->z_expandable = exp;
+   switch (c->phase) {
+      case STBI__ZPAR_find:    c->ok = stbi__zpar_find(c); break;
+      case STBI__ZPAR_decode:  c->ok = stbi__zpar_decode(c); break;
+      case STBI__ZPAR_resolve: c->ok = stbi__zpar_resolve(c, 0, c->resolved); break;
+   }
+}
 
-   return stbi__parse_zlib(a, parse_header);
+#ifdef _WIN32
+typedef HANDLE stbi__zpar_thread;
+static unsigned __stdcall stbi__zpar_entry(void *c) { stbi__zpar_work((stbi__zpar_chunk *) c); return 0; }
+static int stbi__zpar_spawn(stbi__zpar_thread *t, stbi__zpar_chunk *c)
+{
+   *t = (HANDLE) _beginthreadex(NULL, 0, stbi__zpar_entry, c, 0, NULL);
+   return *t != 0;
+}
+static void stbi__zpar_join(stbi__zpar_thread t) { WaitForSingleObject(t, INFINITE); CloseHandle(t); }
+static int stbi__zpar_cores(void) { SYSTEM_INFO si; GetSystemInfo(&si); return (int) si.dwNumberOfProcessors; }
+#else
+typedef pthread_t stbi__zpar_thread;
+static void *stbi__zpar_entry(void *c) { stbi__zpar_work((stbi__zpar_chunk *) c); return NULL; }
+static int stbi__zpar_spawn(stbi__zpar_thread *t, stbi__zpar_chunk *c) { return pthread_create(t, NULL, stbi__zpar_entry, c) == 0; }
+static void stbi__zpar_join(stbi__zpar_thread t) { pthread_join(t, NULL); }
+static int stbi__zpar_cores(void) { long n = sysconf(_SC_NPROCESSORS_ONLN); return n > 0 ? (int) n : 1; }
+#endif
+
+// runs 'phase' on every chunk, chunk 0 on the calling thread; returns 1 if
+// every chunk succeeded
+static int stbi__zpar_run(stbi__zpar_chunk *c, int n, int phase)
+{
+   stbi__zpar_thread t[STBI__ZPAR_MAX_THREADS];
+   int i, ok = 1, spawned[STBI__ZPAR_MAX_THREADS];
+   for (i=0; i < n; ++i)
+      c[i].phase = phase;
+   for (i=1; i < n; ++i)
+      spawned[i] = stbi__zpar_spawn(&t[i], &c[i]);
+   stbi__zpar_work(&c[0]);
+   for (i=1; i < n; ++i) {
+      if (spawned[i]) stbi__zpar_join(t[i]);
+      else stbi__zpar_work(&c[i]); // out of threads; do it here
+   }
+   for (i=0; i < n; ++i)
+      ok &= c[i].ok;
+   return ok;
+}
+
+// how many threads a stream of 'len' compressed bytes would be split across
+static int stbi__zpar_count(stbi__uint32 len)
+{
+   int n = stbi__zpar_threads ? stbi__zpar_threads : stbi__zpar_cores();
+   if ((stbi__uint32) n > len / STBI_PARALLEL_INFLATE_MIN) n = (int) (len / STBI_PARALLEL_INFLATE_MIN);
+   if (n > STBI__ZPAR_MAX_THREADS) n = STBI__ZPAR_MAX_THREADS;
+   return n;
+}
+
+// returns NULL whenever the serial inflate should be used instead
+static char *stbi__zpar_inflate(const char *buffer, int len, int initial_size, int *outlen, int parse_header)
+{
+   stbi__zpar_chunk *c;
+   stbi_uc *out = NULL;
+   size_t total, bits = (size_t) len * 8;
+   int i, n, k;
+
+   n = stbi__zpar_count((stbi__uint32) len);
+   if (n < 2 || bits / 8 != (size_t) len) return NULL;
+
+   c = (stbi__zpar_chunk *) stbi__malloc(sizeof(*c) * n);
+   if (!c) return NULL;
+   for (i=0; i < n; ++i) {
+      c[i].data = (stbi_uc *) buffer;
+      c[i].data_len = len;
+      c[i].search_from = bits / n * i;
+      c[i].search_to = bits / n * (i+1);
+      // room for this share of the expected output, plus some
+      c[i].cap = (size_t) initial_size / n + (initial_size / n) / 4 + 65536;
+      c[i].sym = (stbi__uint16 *) stbi__malloc((STBI__ZPAR_WINDOW + c[i].cap) * sizeof(stbi__uint16));
+      if (!c[i].sym) { n = i; goto fail; }
+   }
+
+   // chunk 0 starts after the zlib header; the rest have to search
+   stbi__zpar_seek(&c[0], 0);
+   if (parse_header && !stbi__parse_zlib_header(&c[0].z)) goto fail;
+   stbi__zpar_run(c+1, n-1, STBI__ZPAR_find);
+   c[0].start = parse_header ? 16 : 0;
+   for (i=1, k=1; i < n; ++i) {
+      if (c[i].ok) c[k++] = c[i];
+      else STBI_FREE(c[i].sym);
+   }
+   n = k;
+   if (n < 2) goto fail;
+   for (i=0; i < n; ++i)
+      c[i].stop = i+1 < n ? c[i+1].start : 0;
+
+   if (!stbi__zpar_run(c, n, STBI__ZPAR_decode)) goto fail;
+
+   total = 0;
+   for (i=0; i < n; ++i) {
+      c[i].dest = total;
+      total += c[i].len;
+   }
+   if (total > INT_MAX) goto fail;
+   out = (stbi_uc *) stbi__malloc(total ? total : 1);
+   if (!out) goto fail;
+
+   // markers only reach back one window, so once the last window of each
+   // chunk is resolved in order, the rest of every chunk can go in parallel
+   for (i=0; i < n; ++i) {
+      size_t tail = c[i].len < STBI__ZPAR_WINDOW ? c[i].len : STBI__ZPAR_WINDOW;
+      c[i].out = out;
+      c[i].resolved = c[i].len - tail;
+      if (!stbi__zpar_resolve(&c[i], c[i].resolved, c[i].len)) goto fail;
+   }
+   if (!stbi__zpar_run(c, n, STBI__ZPAR_resolve)) goto fail;
+
+   for (i=0; i < n; ++i)
+      STBI_FREE(c[i].sym);
+   STBI_FREE(c);
+   if (outlen) *outlen = (int) total;
+   return (char *) out;
+
+fail:
+   for (i=0; i < n; ++i)
+      STBI_FREE(c[i].sym);
+   STBI_FREE(c);
+   STBI_FREE(out);
+   return NULL;
+}
+#else
+STBIDEF void stbi_set_inflate_threads(int num_threads)
+{
+   STBI_NOTUSED(num_threads);
 }
+#endif // STBI_PARALLEL_INFLATE
 
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen)
 {
    stbi__zbuf a;
-   char *p = (char *) stbi__malloc(initial_size);
+   char *p;
+#ifdef STBI_PARALLEL_INFLATE
+   p = stbi__zpar_inflate(buffer, len, initial_size, outlen, 1);
+   if (p) return p;
+#endif
+   p = (char *) stbi__malloc(initial_size);
    if (p == NULL) return NULL;
    a.zbuffer = (stbi_uc *) buffer;
    a.zbuffer_end = (stbi_uc *) buffer + len;
+   a.zrefill = NULL;
    if (stbi__do_zlib(&a, p, initial_size, 1, 1)) {
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
@@ -4408,10 +6123,16 @@ STBIDEF char *stbi_zlib_decode_malloc(char const *buffer, int len, int *outlen)
 STBIDEF char *stbi_zlib_decode_malloc_guesssize_headerflag(const char *buffer, int len, int initial_size, int *outlen, int parse_header)
 {
    stbi__zbuf a;
-   char *p = (char *) stbi__malloc(initial_size);
+   char *p;
+#ifdef STBI_PARALLEL_INFLATE
+   p = stbi__zpar_inflate(buffer, len, initial_size, outlen, parse_header);
+   if (p) return p;
+#endif
+   p = (char *) stbi__malloc(initial_size);
    if (p == NULL) return NULL;
    a.zbuffer = (stbi_uc *) buffer;
    a.zbuffer_end = (stbi_uc *) buffer + len;
+   a.zrefill = NULL;
    if (stbi__do_zlib(&a, p, initial_size, 1, parse_header)) {
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
@@ -4426,6 +6147,7 @@ STBIDEF int stbi_zlib_decode_buffer(char *obuffer, int olen, char const *ibuffer
    stbi__zbuf a;
    a.zbuffer = (stbi_uc *) ibuffer;
    a.zbuffer_end = (stbi_uc *) ibuffer + ilen;
+   a.zrefill = NULL;
    if (stbi__do_zlib(&a, obuffer, olen, 0, 1))
       return (int) (a.zout - a.zout_start);
    else
@@ -4439,6 +6161,7 @@ STBIDEF char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int
    if (p == NULL) return NULL;
    a.zbuffer = (stbi_uc *) buffer;
    a.zbuffer_end = (stbi_uc *) buffer+len;
+   a.zrefill = NULL;
    if (stbi__do_zlib(&a, p, 16384, 1, 0)) {
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
@@ -4453,6 +6176,7 @@ STBIDEF int stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const char
    stbi__zbuf a;
    a.zbuffer = (stbi_uc *) ibuffer;
    a.zbuffer_end = (stbi_uc *) ibuffer + ilen;
+   a.zrefill = NULL;
    if (stbi__do_zlib(&a, obuffer, olen, 0, 0))
       return (int) (a.zout - a.zout_start);
    else
@@ -4499,6 +6223,8 @@ typedef struct
    stbi__context *s;
    stbi_uc *idata, *expanded, *out;
    int depth;
+   int bpc; // bits per channel the caller will end up with
+   int big; // too big to inflate whole, so decoded a row at a time
 } stbi__png;
 
 
@@ -4535,19 +6261,185 @@ static int stbi__paeth(int a, int b, int c)
 
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
+// unfilters one scanline from 'raw' into 'cur'; 'prior' is the previous
+// unfiltered scanline, laid out the same way. for depth < 8 both hold the
+// packed bytes, otherwise out_n channels per pixel.
+static void stbi__png_unfilter_row(stbi_uc *cur, stbi_uc *prior, stbi_uc *raw, int filter, stbi__uint32 x, int img_n, int out_n, int depth, stbi__uint32 img_width_bytes)
+{
+   int bytes = (depth == 16? 2 : 1);
+   int output_bytes = out_n*bytes;
+   int filter_bytes = img_n*bytes;
+   int width = x;
+   stbi_uc *row = cur;
+   stbi__uint32 i;
+   int k;
+
+   if (depth < 8) {
+      filter_bytes = 1;
+      width = img_width_bytes;
+   }
+
+   // handle first byte explicitly
+   for (k=0; k < filter_bytes; ++k) {
+      switch (filter) {
+         case STBI__F_none       : cur[k] = raw[k]; break;
+         case STBI__F_sub        : cur[k] = raw[k]; break;
+         case STBI__F_up         : cur[k] = STBI__BYTECAST(raw[k] + prior[k]); break;
+         case STBI__F_avg        : cur[k] = STBI__BYTECAST(raw[k] + (prior[k]>>1)); break;
+         case STBI__F_paeth      : cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(0,prior[k],0)); break;
+         case STBI__F_avg_first  : cur[k] = raw[k]; break;
+         case STBI__F_paeth_first: cur[k] = raw[k]; break;
+      }
+   }
+
+   if (depth == 8) {
+      if (img_n != out_n)
+         cur[img_n] = 255; // first pixel
+      raw += img_n;
+      cur += out_n;
+      prior += out_n;
+   } else if (depth == 16) {
+      if (img_n != out_n) {
+         cur[filter_bytes]   = 255; // first pixel top byte
+         cur[filter_bytes+1] = 255; // first pixel bottom byte
+      }
+      raw += filter_bytes;
+      cur += output_bytes;
+      prior += output_bytes;
+   } else {
+      raw += 1;
+      cur += 1;
+      prior += 1;
+   }
+
+   // this is a little gross, so that we don't switch per-pixel or per-component
+   if (depth < 8 || img_n == out_n) {
+      int nk = (width - 1)*filter_bytes;
+      #define STBI__CASE(f) \
+          case f:     \
+             for (k=0; k < nk; ++k)
+      switch (filter) {
+         // "none" filter turns into a memcpy here; make that explicit.
+         case STBI__F_none:         memcpy(cur, raw, nk); break;
+         STBI__CASE(STBI__F_sub)          { cur[k] = STBI__BYTECAST(raw[k] + cur[k-filter_bytes]); } break;
+         STBI__CASE(STBI__F_up)           { cur[k] = STBI__BYTECAST(raw[k] + prior[k]); } break;
+         STBI__CASE(STBI__F_avg)          { cur[k] = STBI__BYTECAST(raw[k] + ((prior[k] + cur[k-filter_bytes])>>1)); } break;
+         STBI__CASE(STBI__F_paeth)        { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k-filter_bytes],prior[k],prior[k-filter_bytes])); } break;
+         STBI__CASE(STBI__F_avg_first)    { cur[k] = STBI__BYTECAST(raw[k] + (cur[k-filter_bytes] >> 1)); } break;
+         STBI__CASE(STBI__F_paeth_first)  { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k-filter_bytes],0,0)); } break;
+      }
+      #undef STBI__CASE
+      raw += nk;
+   } else {
+      STBI_ASSERT(img_n+1 == out_n);
+      #define STBI__CASE(f) \
+          case f:     \
+             for (i=x-1; i >= 1; --i, cur[filter_bytes]=255,raw+=filter_bytes,cur+=output_bytes,prior+=output_bytes) \
+                for (k=0; k < filter_bytes; ++k)
+      switch (filter) {
+         STBI__CASE(STBI__F_none)         { cur[k] = raw[k]; } break;
+         STBI__CASE(STBI__F_sub)          { cur[k] = STBI__BYTECAST(raw[k] + cur[k- output_bytes]); } break;
+         STBI__CASE(STBI__F_up)           { cur[k] = STBI__BYTECAST(raw[k] + prior[k]); } break;
+         STBI__CASE(STBI__F_avg)          { cur[k] = STBI__BYTECAST(raw[k] + ((prior[k] + cur[k- output_bytes])>>1)); } break;
+         STBI__CASE(STBI__F_paeth)        { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k- output_bytes],prior[k],prior[k- output_bytes])); } break;
+         STBI__CASE(STBI__F_avg_first)    { cur[k] = STBI__BYTECAST(raw[k] + (cur[k- output_bytes] >> 1)); } break;
+         STBI__CASE(STBI__F_paeth_first)  { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k- output_bytes],0,0)); } break;
+      }
+      #undef STBI__CASE
+
+      // the loop above sets the high byte of the pixels' alpha, but for
+      // 16 bit png files we also need the low byte set. we'll do that here.
+      if (depth == 16) {
+         cur = row; // start at the beginning of the row again
+         for (i=0; i < x; ++i,cur+=output_bytes) {
+            cur[filter_bytes+1] = 255;
+         }
+      }
+   }
+}
+
+// unpacks one scanline of 1/2/4-bit samples from 'in' into 8-bit samples
+// in 'cur', which may overlap 'in' if it starts at least as far left
+static void stbi__png_expand_bits_row(stbi_uc *cur, stbi_uc *in, stbi__uint32 x, int img_n, int out_n, int depth, int color)
+{
+   stbi_uc *row = cur;
+   int k;
+   // unpack 1/2/4-bit into a 8-bit buffer. allows us to keep the common 8-bit path optimal at minimal cost for 1/2/4-bit
+   // png guarante byte alignment, if width is not multiple of 8/4/2 we'll decode dummy trailing data that will be skipped in the later loop
+   stbi_uc scale = (color == 0) ? stbi__depth_scale_table[depth] : 1; // scale grayscale values to 0..255 range
+
+   // note that the final byte might overshoot and write more data than desired.
+   // we can allocate enough data that this never writes out of memory, but it
+   // could also overwrite the next scanline. can it overwrite non-empty data
+   // on the next scanline? yes, consider 1-pixel-wide scanlines with 1-bit-per-pixel.
+   // so we need to explicitly clamp the final ones
+
+   if (depth == 4) {
+      for (k=x*img_n; k >= 2; k-=2, ++in) {
+         *cur++ = scale * ((*in >> 4)       );
+         *cur++ = scale * ((*in     ) & 0x0f);
+      }
+      if (k > 0) *cur++ = scale * ((*in >> 4)       );
+   } else if (depth == 2) {
+      for (k=x*img_n; k >= 4; k-=4, ++in) {
+         *cur++ = scale * ((*in >> 6)       );
+         *cur++ = scale * ((*in >> 4) & 0x03);
+         *cur++ = scale * ((*in >> 2) & 0x03);
+         *cur++ = scale * ((*in     ) & 0x03);
+      }
+      if (k > 0) *cur++ = scale * ((*in >> 6)       );
+      if (k > 1) *cur++ = scale * ((*in >> 4) & 0x03);
+      if (k > 2) *cur++ = scale * ((*in >> 2) & 0x03);
+   } else if (depth == 1) {
+      for (k=x*img_n; k >= 8; k-=8, ++in) {
+         *cur++ = scale * ((*in >> 7)       );
+         *cur++ = scale * ((*in >> 6) & 0x01);
+         *cur++ = scale * ((*in >> 5) & 0x01);
+         *cur++ = scale * ((*in >> 4) & 0x01);
+         *cur++ = scale * ((*in >> 3) & 0x01);
+         *cur++ = scale * ((*in >> 2) & 0x01);
+         *cur++ = scale * ((*in >> 1) & 0x01);
+         *cur++ = scale * ((*in     ) & 0x01);
+      }
+      if (k > 0) *cur++ = scale * ((*in >> 7)       );
+      if (k > 1) *cur++ = scale * ((*in >> 6) & 0x01);
+      if (k > 2) *cur++ = scale * ((*in >> 5) & 0x01);
+      if (k > 3) *cur++ = scale * ((*in >> 4) & 0x01);
+      if (k > 4) *cur++ = scale * ((*in >> 3) & 0x01);
+      if (k > 5) *cur++ = scale * ((*in >> 2) & 0x01);
+      if (k > 6) *cur++ = scale * ((*in >> 1) & 0x01);
+   }
+   if (img_n != out_n) {
+      int q;
+      // insert alpha = 255
+      cur = row;
+      if (img_n == 1) {
+         for (q=x-1; q >= 0; --q) {
+            cur[q*2+1] = 255;
+            cur[q*2+0] = cur[q];
+         }
+      } else {
+         STBI_ASSERT(img_n == 3);
+         for (q=x-1; q >= 0; --q) {
+            cur[q*4+3] = 255;
+            cur[q*4+2] = cur[q*3+2];
+            cur[q*4+1] = cur[q*3+1];
+            cur[q*4+0] = cur[q*3+0];
+         }
+      }
+   }
+}
+
 // create the png data from post-deflated data
 static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
 {
    int bytes = (depth == 16? 2 : 1);
    stbi__context *s = a->s;
-   stbi__uint32 i,j,stride = x*out_n*bytes;
+   stbi__uint32 j,stride = x*out_n*bytes;
    stbi__uint32 img_len, img_width_bytes;
-   int k;
    int img_n = s->img_n; // copy it into a local for later
 
    int output_bytes = out_n*bytes;
-   int filter_bytes = img_n*bytes;
-   int width = x;
 
    STBI_ASSERT(out_n == s->img_n || out_n == s->img_n+1);
    a->out = (stbi_uc *) stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
@@ -4573,91 +6465,14 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       if (depth < 8) {
          if (img_width_bytes > x) return stbi__err("invalid width","Corrupt PNG");
          cur += x*out_n - img_width_bytes; // store output to the rightmost img_len bytes, so we can decode in place
-         filter_bytes = 1;
-         width = img_width_bytes;
       }
       prior = cur - stride; // bugfix: need to compute this after 'cur +=' computation above
 
       // if first row, use special filter that doesn't sample previous row
       if (j == 0) filter = first_row_filter[filter];
 
-      // handle first byte explicitly
-      for (k=0; k < filter_bytes; ++k) {
-         switch (filter) {
-            case STBI__F_none       : cur[k] = raw[k]; break;
-            case STBI__F_sub        : cur[k] = raw[k]; break;
-            case STBI__F_up         : cur[k] = STBI__BYTECAST(raw[k] + prior[k]); break;
-            case STBI__F_avg        : cur[k] = STBI__BYTECAST(raw[k] + (prior[k]>>1)); break;
-            case STBI__F_paeth      : cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(0,prior[k],0)); break;
-            case STBI__F_avg_first  : cur[k] = raw[k]; break;
-            case STBI__F_paeth_first: cur[k] = raw[k]; break;
-         }
-      }
-
-      if (depth == 8) {
-         if (img_n != out_n)
-            cur[img_n] = 255; // first pixel
-         raw += img_n;
-         cur += out_n;
-         prior += out_n;
-      } else if (depth == 16) {
-         if (img_n != out_n) {
-            cur[filter_bytes]   = 255; // first pixel top byte
-            cur[filter_bytes+1] = 255; // first pixel bottom byte
-         }
-         raw += filter_bytes;
-         cur += output_bytes;
-         prior += output_bytes;
-      } else {
-         raw += 1;
-         cur += 1;
-         prior += 1;
-      }
-
-      // this is a little gross, so that we don't switch per-pixel or per-component
-      if (depth < 8 || img_n == out_n) {
-         int nk = (width - 1)*filter_bytes;
-         #define STBI__CASE(f) \
-             case f:     \
-                for (k=0; k < nk; ++k)
-         switch (filter) {
-            // "none" filter turns into a memcpy here; make that explicit.
-            case STBI__F_none:         memcpy(cur, raw, nk); break;
-            STBI__CASE(STBI__F_sub)          { cur[k] = STBI__BYTECAST(raw[k] + cur[k-filter_bytes]); } break;
-            STBI__CASE(STBI__F_up)           { cur[k] = STBI__BYTECAST(raw[k] + prior[k]); } break;
-            STBI__CASE(STBI__F_avg)          { cur[k] = STBI__BYTECAST(raw[k] + ((prior[k] + cur[k-filter_bytes])>>1)); } break;
-            STBI__CASE(STBI__F_paeth)        { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k-filter_bytes],prior[k],prior[k-filter_bytes])); } break;
-            STBI__CASE(STBI__F_avg_first)    { cur[k] = STBI__BYTECAST(raw[k] + (cur[k-filter_bytes] >> 1)); } break;
-            STBI__CASE(STBI__F_paeth_first)  { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k-filter_bytes],0,0)); } break;
-         }
-         #undef STBI__CASE
-         raw += nk;
-      } else {
-         STBI_ASSERT(img_n+1 == out_n);
-         #define STBI__CASE(f) \
-             case f:     \
-                for (i=x-1; i >= 1; --i, cur[filter_bytes]=255,raw+=filter_bytes,cur+=output_bytes,prior+=output_bytes) \
-                   for (k=0; k < filter_bytes; ++k)
-         switch (filter) {
-            STBI__CASE(STBI__F_none)         { cur[k] = raw[k]; } break;
-            STBI__CASE(STBI__F_sub)          { cur[k] = STBI__BYTECAST(raw[k] + cur[k- output_bytes]); } break;
-            STBI__CASE(STBI__F_up)           { cur[k] = STBI__BYTECAST(raw[k] + prior[k]); } break;
-            STBI__CASE(STBI__F_avg)          { cur[k] = STBI__BYTECAST(raw[k] + ((prior[k] + cur[k- output_bytes])>>1)); } break;
-            STBI__CASE(STBI__F_paeth)        { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k- output_bytes],prior[k],prior[k- output_bytes])); } break;
-            STBI__CASE(STBI__F_avg_first)    { cur[k] = STBI__BYTECAST(raw[k] + (cur[k- output_bytes] >> 1)); } break;
-            STBI__CASE(STBI__F_paeth_first)  { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k- output_bytes],0,0)); } break;
-         }
-         #undef STBI__CASE
-
-         // the loop above sets the high byte of the pixels' alpha, but for
-         // 16 bit png files we also need the low byte set. we'll do that here.
-         if (depth == 16) {
-            cur = a->out + stride*j; // start at the beginning of the row again
-            for (i=0; i < x; ++i,cur+=output_bytes) {
-               cur[filter_bytes+1] = 255;
-            }
-         }
-      }
+      stbi__png_unfilter_row(cur, prior, raw, filter, x, img_n, out_n, depth, img_width_bytes);
+      raw += img_width_bytes;
    }
 
    // we make a separate pass to expand bits to pixels; for performance,
@@ -4667,84 +6482,13 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       for (j=0; j < y; ++j) {
          stbi_uc *cur = a->out + stride*j;
          stbi_uc *in  = a->out + stride*j + x*out_n - img_width_bytes;
-         // unpack 1/2/4-bit into a 8-bit buffer. allows us to keep the common 8-bit path optimal at minimal cost for 1/2/4-bit
-         // png guarante byte alignment, if width is not multiple of 8/4/2 we'll decode dummy trailing data that will be skipped in the later loop
-         stbi_uc scale = (color == 0) ? stbi__depth_scale_table[depth] : 1; // scale grayscale values to 0..255 range
-
-         // note that the final byte might overshoot and write more data than desired.
-         // we can allocate enough data that this never writes out of memory, but it
-         // could also overwrite the next scanline. can it overwrite non-empty data
-         // on the next scanline? yes, consider 1-pixel-wide scanlines with 1-bit-per-pixel.
-         // so we need to explicitly clamp the final ones
-
-         if (depth == 4) {
-            for (k=x*img_n; k >= 2; k-=2, ++in) {
-               *cur++ = scale * ((*in >> 4)       );
-               *cur++ = scale * ((*in     ) & 0x0f);
-            }
-            if (k > 0) *cur++ = scale * ((*in >> 4)       );
-         } else if (depth == 2) {
-            for (k=x*img_n; k >= 4; k-=4, ++in) {
-               *cur++ = scale * ((*in >> 6)       );
-               *cur++ = scale * ((*in >> 4) & 0x03);
-               *cur++ = scale * ((*in >> 2) & 0x03);
-               *cur++ = scale * ((*in     ) & 0x03);
-            }
-            if (k > 0) *cur++ = scale * ((*in >> 6)       );
-            if (k > 1) *cur++ = scale * ((*in >> 4) & 0x03);
-            if (k > 2) *cur++ = scale * ((*in >> 2) & 0x03);
-         } else if (depth == 1) {
-            for (k=x*img_n; k >= 8; k-=8, ++in) {
-               *cur++ = scale * ((*in >> 7)       );
-               *cur++ = scale * ((*in >> 6) & 0x01);
-               *cur++ = scale * ((*in >> 5) & 0x01);
-               *cur++ = scale * ((*in >> 4) & 0x01);
-               *cur++ = scale * ((*in >> 3) & 0x01);
-               *cur++ = scale * ((*in >> 2) & 0x01);
-               *cur++ = scale * ((*in >> 1) & 0x01);
-               *cur++ = scale * ((*in     ) & 0x01);
-            }
-            if (k > 0) *cur++ = scale * ((*in >> 7)       );
-            if (k > 1) *cur++ = scale * ((*in >> 6) & 0x01);
-            if (k > 2) *cur++ = scale * ((*in >> 5) & 0x01);
-            if (k > 3) *cur++ = scale * ((*in >> 4) & 0x01);
-            if (k > 4) *cur++ = scale * ((*in >> 3) & 0x01);
-            if (k > 5) *cur++ = scale * ((*in >> 2) & 0x01);
-            if (k > 6) *cur++ = scale * ((*in >> 1) & 0x01);
-         }
-         if (img_n != out_n) {
-            int q;
-            // insert alpha = 255
-            cur = a->out + stride*j;
-            if (img_n == 1) {
-               for (q=x-1; q >= 0; --q) {
-                  cur[q*2+1] = 255;
-                  cur[q*2+0] = cur[q];
-               }
-            } else {
-               STBI_ASSERT(img_n == 3);
-               for (q=x-1; q >= 0; --q) {
-                  cur[q*4+3] = 255;
-                  cur[q*4+2] = cur[q*3+2];
-                  cur[q*4+1] = cur[q*3+1];
-                  cur[q*4+0] = cur[q*3+0];
-               }
-            }
-         }
-      }
-   } else if (depth == 16) {
-      // force the image data from big-endian to platform-native.
-      // this is done in a separate pass due to the decoding relying
-      // on the data being untouched, but could probably be done
-      // per-line during decode if care is taken.
-      stbi_uc *cur = a->out;
-      stbi__uint16 *cur16 = (stbi__uint16*)cur;
-
-      for(i=0; i < x*y*out_n; ++i,cur16++,cur+=2) {
-         *cur16 = (cur[0] << 8) | cur[1];
+         stbi__png_expand_bits_row(cur, in, x, img_n, out_n, depth, color);
       }
    }
 
+   // 16-bit samples are still big-endian here; stbi__png_finish_image
+   // converts them, since the unfiltering above relies on the raw bytes
+
    return 1;
 }
 
@@ -4792,91 +6536,176 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
    return 1;
 }
 
-static int stbi__compute_transparency(stbi__png *z, stbi_uc tc[3], int out_n)
-{
-   stbi__context *s = z->s;
-   stbi__uint32 i, pixel_count = s->img_x * s->img_y;
-   stbi_uc *p = z->out;
+// the post-unfilter steps below each work on a single row, so that
+// stbi__png_finish_image can run all of them while the row is in cache
 
-   // compute color-based transparency, assuming we've
-   // already got 255 as the alpha value in the output
+// compute color-based transparency, assuming we've
+// already got 255 as the alpha value in the output
+static void stbi__png_key_row(stbi_uc *p, stbi__uint32 w, int out_n, stbi_uc tc[3], int simd)
+{
+   stbi__uint32 i = 0;
    STBI_ASSERT(out_n == 2 || out_n == 4);
+   STBI_NOTUSED(simd);
 
    if (out_n == 2) {
-      for (i=0; i < pixel_count; ++i) {
-         p[1] = (p[0] == tc[0] ? 0 : 255);
-         p += 2;
+      #ifdef STBI_SSE2
+      if (simd) {
+         __m128i key = _mm_set1_epi16(tc[0]);
+         __m128i lo = _mm_set1_epi16(0x00ff), hi = _mm_set1_epi16((short) 0xff00);
+         for (; i+8 <= w; i += 8) {
+            __m128i g = _mm_and_si128(_mm_loadu_si128((__m128i *) (p + i*2)), lo);
+            __m128i eq = _mm_cmpeq_epi16(g, key);
+            _mm_storeu_si128((__m128i *) (p + i*2), _mm_or_si128(g, _mm_andnot_si128(eq, hi)));
+         }
       }
+      #endif
+      for (; i < w; ++i)
+         p[i*2+1] = (p[i*2] == tc[0] ? 0 : 255);
    } else {
-      for (i=0; i < pixel_count; ++i) {
-         if (p[0] == tc[0] && p[1] == tc[1] && p[2] == tc[2])
-            p[3] = 0;
-         p += 4;
+      #ifdef STBI_SSE2
+      if (simd) {
+         __m128i amask = _mm_set1_epi32((int) 0xff000000);
+         __m128i key = _mm_or_si128(_mm_set1_epi32(tc[0] | (tc[1] << 8) | (tc[2] << 16)), amask);
+         __m128i ones = _mm_cmpeq_epi32(key, key);
+         for (; i+4 <= w; i += 4) {
+            __m128i v = _mm_loadu_si128((__m128i *) (p + i*4));
+            __m128i eq = _mm_cmpeq_epi8(_mm_or_si128(v, amask), key);
+            __m128i hit = _mm_cmpeq_epi32(eq, ones); // all of r,g,b matched
+            _mm_storeu_si128((__m128i *) (p + i*4), _mm_andnot_si128(_mm_and_si128(hit, amask), v));
+         }
+      }
+      #endif
+      #ifdef STBI_NEON
+      {
+         uint32x4_t amask = vdupq_n_u32(0xff000000);
+         uint32x4_t key = vdupq_n_u32(tc[0] | (tc[1] << 8) | (tc[2] << 16) | 0xff000000);
+         for (; i+4 <= w; i += 4) {
+            uint32x4_t v = vreinterpretq_u32_u8(vld1q_u8(p + i*4));
+            uint32x4_t hit = vceqq_u32(vorrq_u32(v, amask), key);
+            vst1q_u8(p + i*4, vreinterpretq_u8_u32(vbicq_u32(v, vandq_u32(hit, amask))));
+         }
+      }
+      #endif
+      for (; i < w; ++i) {
+         stbi_uc *q = p + i*4;
+         if (q[0] == tc[0] && q[1] == tc[1] && q[2] == tc[2])
+            q[3] = 0;
       }
    }
-   return 1;
 }
 
-static int stbi__compute_transparency16(stbi__png *z, stbi__uint16 tc[3], int out_n)
+// compute color-based transparency, assuming we've
+// already got 65535 as the alpha value in the output
+static void stbi__png_key_row16(stbi__uint16 *p, stbi__uint32 w, int out_n, stbi__uint16 tc[3], int simd)
 {
-   stbi__context *s = z->s;
-   stbi__uint32 i, pixel_count = s->img_x * s->img_y;
-   stbi__uint16 *p = (stbi__uint16*) z->out;
-
-   // compute color-based transparency, assuming we've
-   // already got 65535 as the alpha value in the output
+   stbi__uint32 i = 0;
    STBI_ASSERT(out_n == 2 || out_n == 4);
+   STBI_NOTUSED(simd);
 
    if (out_n == 2) {
-      for (i = 0; i < pixel_count; ++i) {
-         p[1] = (p[0] == tc[0] ? 0 : 65535);
-         p += 2;
+      #ifdef STBI_SSE2
+      if (simd) {
+         __m128i key = _mm_set1_epi32(tc[0]);
+         __m128i lo = _mm_set1_epi32(0x0000ffff), hi = _mm_set1_epi32((int) 0xffff0000);
+         for (; i+4 <= w; i += 4) {
+            __m128i g = _mm_and_si128(_mm_loadu_si128((__m128i *) (p + i*2)), lo);
+            __m128i eq = _mm_cmpeq_epi32(g, key);
+            _mm_storeu_si128((__m128i *) (p + i*2), _mm_or_si128(g, _mm_andnot_si128(eq, hi)));
+         }
       }
+      #endif
+      for (; i < w; ++i)
+         p[i*2+1] = (p[i*2] == tc[0] ? 0 : 65535);
    } else {
-      for (i = 0; i < pixel_count; ++i) {
-         if (p[0] == tc[0] && p[1] == tc[1] && p[2] == tc[2])
-            p[3] = 0;
-         p += 4;
+      #ifdef STBI_SSE2
+      if (simd) {
+         __m128i amask = _mm_set_epi16(-1,0,0,0, -1,0,0,0);
+         __m128i key = _mm_or_si128(_mm_set_epi16(0,(short) tc[2],(short) tc[1],(short) tc[0], 0,(short) tc[2],(short) tc[1],(short) tc[0]), amask);
+         __m128i ones = _mm_cmpeq_epi32(key, key);
+         for (; i+2 <= w; i += 2) {
+            __m128i v = _mm_loadu_si128((__m128i *) (p + i*4));
+            __m128i eq = _mm_cmpeq_epi32(_mm_cmpeq_epi16(_mm_or_si128(v, amask), key), ones);
+            __m128i hit = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2,3,0,1))); // 64-bit lanes
+            _mm_storeu_si128((__m128i *) (p + i*4), _mm_andnot_si128(_mm_and_si128(hit, amask), v));
+         }
+      }
+      #endif
+      for (; i < w; ++i) {
+         stbi__uint16 *q = p + i*4;
+         if (q[0] == tc[0] && q[1] == tc[1] && q[2] == tc[2])
+            q[3] = 0;
       }
    }
-   return 1;
 }
 
-static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int pal_img_n)
+// force 16-bit samples from big-endian to platform-native
+static void stbi__png_swap16_row(stbi__uint16 *p, stbi__uint32 n, int simd)
 {
-   stbi__uint32 i, pixel_count = a->s->img_x * a->s->img_y;
-   stbi_uc *p, *temp_out, *orig = a->out;
-
-   p = (stbi_uc *) stbi__malloc_mad2(pixel_count, pal_img_n, 0);
-   if (p == NULL) return stbi__err("outofmem", "Out of memory");
+   stbi__uint32 i = 0;
+   STBI_NOTUSED(simd);
+   #ifdef STBI_SSE2
+   if (simd) {
+      for (; i+8 <= n; i += 8) {
+         __m128i v = _mm_loadu_si128((__m128i *) (p + i));
+         _mm_storeu_si128((__m128i *) (p + i), _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+      }
+   }
+   #endif
+   #ifdef STBI_NEON
+   for (; i+8 <= n; i += 8)
+      vst1q_u8((stbi_uc *) (p + i), vrev16q_u8(vld1q_u8((stbi_uc *) (p + i))));
+   #endif
+   for (; i < n; ++i) {
+      stbi_uc *b = (stbi_uc *) (p + i);
+      p[i] = (stbi__uint16) ((b[0] << 8) | b[1]);
+   }
+}
 
-   // between here and free(out) below, exitting would leak
-   temp_out = p;
+// top half of each sample is sufficient approx of 16->8 bit scaling.
+// 'out' may alias 'p', since it never gets ahead of the input.
+static void stbi__png_reduce16_row(stbi_uc *out, stbi__uint16 *p, stbi__uint32 n, int simd)
+{
+   stbi__uint32 i = 0;
+   STBI_NOTUSED(simd);
+   #ifdef STBI_SSE2
+   if (simd) {
+      for (; i+16 <= n; i += 16) {
+         __m128i a = _mm_srli_epi16(_mm_loadu_si128((__m128i *) (p + i  )), 8);
+         __m128i b = _mm_srli_epi16(_mm_loadu_si128((__m128i *) (p + i+8)), 8);
+         _mm_storeu_si128((__m128i *) (out + i), _mm_packus_epi16(a, b));
+      }
+   }
+   #endif
+   #ifdef STBI_NEON
+   for (; i+16 <= n; i += 16) {
+      uint8x8_t a = vshrn_n_u16(vld1q_u16(p + i  ), 8);
+      uint8x8_t b = vshrn_n_u16(vld1q_u16(p + i+8), 8);
+      vst1q_u8(out + i, vcombine_u8(a, b));
+   }
+   #endif
+   for (; i < n; ++i)
+      out[i] = (stbi_uc) (p[i] >> 8);
+}
 
+static void stbi__png_expand_palette_row(stbi_uc *out, stbi_uc const *idx, stbi__uint32 w, stbi_uc *palette, int pal_img_n)
+{
+   // there's no gather in SSE2/NEON, so this moves whole 32-bit palette
+   // entries instead; for 3 components each store overlaps the next pixel
+   stbi__uint32 i = 0;
    if (pal_img_n == 3) {
-      for (i=0; i < pixel_count; ++i) {
-         int n = orig[i]*4;
-         p[0] = palette[n  ];
-         p[1] = palette[n+1];
-         p[2] = palette[n+2];
-         p += 3;
-      }
+      for (; i+1 < w; ++i, out += 3)
+         memcpy(out, palette + idx[i]*4, 4);
+      memcpy(out, palette + idx[i]*4, 3);
    } else {
-      for (i=0; i < pixel_count; ++i) {
-         int n = orig[i]*4;
-         p[0] = palette[n  ];
-         p[1] = palette[n+1];
-         p[2] = palette[n+2];
-         p[3] = palette[n+3];
-         p += 4;
+      for (; i+4 <= w; i += 4, out += 16) {
+         memcpy(out   , palette + idx[i  ]*4, 4);
+         memcpy(out+ 4, palette + idx[i+1]*4, 4);
+         memcpy(out+ 8, palette + idx[i+2]*4, 4);
+         memcpy(out+12, palette + idx[i+3]*4, 4);
       }
+      for (; i < w; ++i, out += 4)
+         memcpy(out, palette + idx[i]*4, 4);
    }
-   STBI_FREE(a->out);
-   a->out = temp_out;
-
-   STBI_NOTUSED(len);
-
-   return 1;
 }
 
 static int stbi__unpremultiply_on_load = 0;
@@ -4892,24 +6721,22 @@ STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert)
    stbi__de_iphone_flag = flag_true_if_should_convert;
 }
 
-static void stbi__de_iphone(stbi__png *z)
+static void stbi__de_iphone_row(stbi_uc *p, stbi__uint32 w, int out_n)
 {
-   stbi__context *s = z->s;
-   stbi__uint32 i, pixel_count = s->img_x * s->img_y;
-   stbi_uc *p = z->out;
+   stbi__uint32 i;
 
-   if (s->img_out_n == 3) {  // convert bgr to rgb
-      for (i=0; i < pixel_count; ++i) {
+   if (out_n == 3) {  // convert bgr to rgb
+      for (i=0; i < w; ++i) {
          stbi_uc t = p[0];
          p[0] = p[2];
          p[2] = t;
          p += 3;
       }
    } else {
-      STBI_ASSERT(s->img_out_n == 4);
+      STBI_ASSERT(out_n == 4);
       if (stbi__unpremultiply_on_load) {
          // convert bgr to rgb and unpremultiply
-         for (i=0; i < pixel_count; ++i) {
+         for (i=0; i < w; ++i) {
             stbi_uc a = p[3];
             stbi_uc t = p[0];
             if (a) {
@@ -4925,7 +6752,7 @@ static void stbi__de_iphone(stbi__png *z)
          }
       } else {
          // convert bgr to rgb
-         for (i=0; i < pixel_count; ++i) {
+         for (i=0; i < w; ++i) {
             stbi_uc t = p[0];
             p[0] = p[2];
             p[2] = t;
@@ -4935,27 +6762,465 @@ static void stbi__de_iphone(stbi__png *z)
    }
 }
 
+// everything between unfiltering and handing the image back -- 16-bit byte
+// order, tRNS color keys, iPhone BGR, palette lookup and 16->8 reduction --
+// in one pass over the rows instead of one full-image pass per step
+static int stbi__png_finish_image(stbi__png *z, stbi_uc *palette, int pal_out_n, int has_trans, stbi_uc tc[3], stbi__uint16 tc16[3], int de_iphone)
+{
+   stbi__context *s = z->s;
+   stbi__uint32 j, x = s->img_x, y = s->img_y;
+   int out_n = s->img_out_n;
+   int reduce16 = (z->depth == 16 && z->bpc == 8);
+   int final_n = pal_out_n ? pal_out_n : out_n;
+   int final_bytes = (z->depth == 16 && !reduce16) ? 2 : 1;
+   size_t in_stride = (size_t) x * out_n * (z->depth == 16 ? 2 : 1);
+   size_t final_stride = (size_t) x * final_n * final_bytes;
+   stbi_uc *final = z->out;
+   int simd = 0;
+   #ifdef STBI_SSE2
+   simd = stbi__sse2_available();
+   #endif
+
+   if (!pal_out_n && !has_trans && !de_iphone && z->depth != 16)
+      return 1; // nothing to do
+
+   if (final_stride > in_stride) { // only palette expansion grows
+      final = (stbi_uc *) stbi__malloc_mad3(x, y, final_n * final_bytes, 0);
+      if (final == NULL) return stbi__err("outofmem", "Out of memory");
+   }
+
+   for (j=0; j < y; ++j) {
+      stbi_uc *row = z->out + in_stride * j;
+      stbi_uc *dest = final + final_stride * j;
+      if (z->depth == 16) {
+         stbi__uint16 *row16 = (stbi__uint16 *) row;
+         stbi__png_swap16_row(row16, x*out_n, simd);
+         if (has_trans) stbi__png_key_row16(row16, x, out_n, tc16, simd);
+         if (reduce16) stbi__png_reduce16_row(dest, row16, x*out_n, simd);
+      } else {
+         if (has_trans) stbi__png_key_row(row, x, out_n, tc, simd);
+         if (de_iphone) stbi__de_iphone_row(row, x, out_n);
+         if (pal_out_n) stbi__png_expand_palette_row(dest, row, x, palette, pal_out_n);
+      }
+   }
+
+   if (final != z->out) {
+      STBI_FREE(z->out);
+      z->out = final;
+   } else if (reduce16) {
+      stbi_uc *p = (stbi_uc *) STBI_REALLOC_SIZED(z->out, in_stride*y, final_stride*y);
+      if (p) z->out = p; // failing to shrink is harmless
+   }
+   return 1;
+}
+
 #define STBI__PNG_TYPE(a,b,c,d)  (((unsigned) (a) << 24) + ((unsigned) (b) << 16) + ((unsigned) (c) << 8) + (unsigned) (d))
 
+// feeds the inflater the IDAT payloads one piece at a time, stopping at
+// the first chunk that isn't an IDAT
+typedef struct
+{
+   stbi__context *s;
+   stbi__uint32 remain; // unread bytes of the current IDAT
+   stbi_uc *buf;        // staging buffer for callback sources
+   int eof;
+   stbi__pngchunk next; // the chunk after the IDATs; type 0 if the data ran out
+} stbi__png_idat;
+
+#define STBI__PNG_IDAT_PIECE  65536
+
+static int stbi__png_idat_refill(void *user, stbi_uc **start, stbi_uc **end)
+{
+   stbi__png_idat *d = (stbi__png_idat *) user;
+   stbi__context *s = d->s;
+   stbi__uint32 n;
+   while (d->remain == 0) {
+      stbi__pngchunk c;
+      if (d->eof) return 0;
+      stbi__get32be(s); // CRC of the previous IDAT
+      c = stbi__get_chunk_header(s);
+      if (c.type != STBI__PNG_TYPE('I','D','A','T')) {
+         d->eof = 1;
+         d->next = c;
+         return 0;
+      }
+      d->remain = c.length;
+   }
+   if (!s->io.read) {
+      // memory source: hand out the payload in place
+      n = (stbi__uint32) (s->img_buffer_end - s->img_buffer);
+      if (n == 0) { d->eof = 1; return 0; }
+      if (n > d->remain) n = d->remain;
+      *start = s->img_buffer;
+      s->img_buffer += n;
+   } else {
+      n = d->remain < STBI__PNG_IDAT_PIECE ? d->remain : STBI__PNG_IDAT_PIECE;
+      if (!stbi__getn(s, d->buf, n)) { d->eof = 1; return 0; }
+      *start = d->buf;
+   }
+   d->remain -= n;
+   *end = *start + n;
+   return 1;
+}
+
+// decodes a non-interlaced image a scanline at a time for stbi_load_rows,
+// inflating the IDATs into a sliding window rather than collecting them.
+// does the same per-row steps as create_png_image_raw + png_finish_image,
+// plus stbi__convert_format, into a band that goes to the callback when full.
+//
+// the state lives in a struct so that the push decoder can stop whenever its
+// input runs dry and carry on later; stbi__png_stream_rows runs it straight
+// through.
+typedef struct
+{
+   stbi__rows *rows;
+   stbi__uint32 x, y, j;
+   int img_n, out_n, depth, color, req_comp, final_n, req_n;
+   int conv16, simd, r, stalled;
+   int pal_out_n, has_trans, de_iphone;
+   size_t row_bytes, work_bytes;
+   stbi_uc *mem, *cur, *prior, *work, *tmp16, *pal, *staging;
+   char *rd, *window_end;
+   stbi__band band;
+   stbi_uc palette[1024], tc[3];
+   stbi__uint16 tc16[3];
+   stbi__zbuf a;
+} stbi__png_rows;
+
+// sets up 'st' for the image whose IDATs come next. 'staging' reserves that
+// many bytes at st->staging for the input source.
+static int stbi__png_rows_begin(stbi__png_rows *st, stbi__png *z, int req_comp, int color, stbi_uc *palette, int pal_out_n, int has_trans, stbi_uc tc[3], stbi__uint16 tc16[3], int is_iphone, int de_iphone, size_t staging)
+{
+   stbi__context *s = z->s;
+   stbi__uint32 x = s->img_x, y = s->img_y;
+   int img_n = s->img_n, out_n = s->img_out_n, depth = z->depth;
+   int bytes = (depth == 16 ? 2 : 1);
+   size_t unf_bytes, band_stride, band_rows, window_len, off[7];
+
+   st->rows = s->rows;
+   st->x = x;
+   st->y = y;
+   st->img_n = img_n;
+   st->out_n = out_n;
+   st->depth = depth;
+   st->color = color;
+   st->req_comp = req_comp;
+   st->pal_out_n = pal_out_n;
+   st->has_trans = has_trans;
+   st->de_iphone = de_iphone;
+   st->final_n = pal_out_n ? pal_out_n : out_n;
+   st->req_n = req_comp ? req_comp : st->final_n;
+   // stbi_load does RGB->Y on the 16-bit samples, so match it
+   st->conv16 = (depth == 16 && (req_comp == 1 || req_comp == 2) && req_comp != out_n);
+   st->simd = 0;
+   #ifdef STBI_SSE2
+   st->simd = stbi__sse2_available();
+   #endif
+   if (pal_out_n) memcpy(st->palette, palette, sizeof(st->palette));
+   if (has_trans) {
+      memcpy(st->tc, tc, sizeof(st->tc));
+      if (depth == 16) memcpy(st->tc16, tc16, sizeof(st->tc16));
+   }
+
+   if (!stbi__mad3sizes_valid(img_n, x, depth, 7)) return stbi__err("too large", "Corrupt PNG");
+   st->row_bytes = (((img_n * x * depth) + 7) >> 3);
+   if (depth < 8 && st->row_bytes > x) return stbi__err("invalid width","Corrupt PNG");
+   st->work_bytes = (size_t) x * out_n * bytes;
+   unf_bytes = depth < 8 ? st->row_bytes : st->work_bytes;
+   band_stride = (size_t) x * st->req_n;
+   band_rows = STBI__ROWS_BAND_BYTES / band_stride;
+   if (band_rows < 1) band_rows = 1;
+   if (band_rows > y) band_rows = y;
+   // enough window for the 32KB of history plus a couple of rows
+   window_len = 32768 + 2 * (st->row_bytes + 1) + 131072;
+
+   // one allocation, carved into 16-byte aligned pieces
+   off[0] = 0;
+   off[1] = off[0] + ((unf_bytes + 15) & ~(size_t) 15);             // cur
+   off[2] = off[1] + ((unf_bytes + 15) & ~(size_t) 15);             // prior
+   off[3] = off[2] + ((st->work_bytes + 15) & ~(size_t) 15);        // work
+   off[4] = off[3] + (st->conv16 ? (size_t) x * req_comp * 2 + 16 : 0); // tmp16
+   off[5] = off[4] + (pal_out_n ? (size_t) x * 4 + 16 : 0);         // pal
+   off[6] = off[5] + ((band_rows * band_stride + 15) & ~(size_t) 15); // band
+   st->mem = (stbi_uc *) stbi__malloc(off[6] + window_len + staging);
+   if (!st->mem) return stbi__err("outofmem", "Out of memory");
+   st->cur   = st->mem + off[0];
+   st->prior = st->mem + off[1];
+   st->work  = st->mem + off[2];
+   st->tmp16 = st->mem + off[3];
+   st->pal   = st->mem + off[4];
+   stbi__band_begin(&st->band, st->mem + off[5], band_stride, y, (stbi__uint32) band_rows);
+   st->staging = st->mem + off[6] + window_len;
+   memset(st->cur, 0, unf_bytes * 2);
+
+   st->a.zbuffer = st->a.zbuffer_end = NULL;
+   st->a.zrefill = NULL;
+   stbi__zstream_begin(&st->a, (char *) st->mem + off[6], (int) window_len, !is_iphone);
+   st->window_end = st->a.zout_end;
+   st->rd = st->a.zout;
+   st->j = 0;
+   st->r = 2;
+   st->stalled = 0;
+   return 1;
+}
+
+// decodes rows until the image is done (returns 1), the data is corrupt (0)
+// or the input source asks to stop (2). a source stops the inflater by
+// setting zout_end to zout_start, which the inflater treats as a full window.
+static int stbi__png_rows_run(stbi__png_rows *st)
+{
+   stbi__zbuf *a = &st->a;
+   stbi__uint32 x = st->x;
+   int img_n = st->img_n, out_n = st->out_n, depth = st->depth;
+   int req_comp = st->req_comp, final_n = st->final_n, req_n = st->req_n;
+   int simd = st->simd;
+   while (st->j < st->y) {
+      stbi_uc *p, *fin, *dest, *t;
+      int filter;
+
+      while ((size_t) (a->zout - st->rd) < st->row_bytes + 1) {
+         if (st->r == 1) return stbi__err("not enough pixels","Corrupt PNG");
+         if (st->stalled) {
+            st->stalled = 0;
+            return 2;
+         }
+         st->rd -= stbi__zstream_slide(a, st->rd);
+         st->r = stbi__zstream_run(a);
+         if (!st->r) return 0; // zlib should set error
+         if (a->zout_end != st->window_end) {
+            // the source stopped us; use up what was inflated first
+            a->zout_end = st->window_end;
+            st->stalled = 1;
+         }
+      }
+      filter = (stbi_uc) *st->rd;
+      if (filter > 4) return stbi__err("invalid filter","Corrupt PNG");
+      if (st->j == 0) filter = first_row_filter[filter];
+      stbi__png_unfilter_row(st->cur, st->prior, (stbi_uc *) st->rd + 1, filter, x, img_n, out_n, depth, (stbi__uint32) st->row_bytes);
+      st->rd += st->row_bytes + 1;
+
+      dest = stbi__band_row(&st->band, st->j);
+
+      // the next row filters against 'cur', so anything that changes the
+      // color channels works on a copy
+      p = st->cur;
+      if (depth < 8) {
+         stbi__png_expand_bits_row(st->work, st->cur, x, img_n, out_n, depth, st->color);
+         p = st->work;
+      } else if (depth == 16 || st->de_iphone) {
+         memcpy(st->work, st->cur, st->work_bytes);
+         p = st->work;
+      }
+      if (depth == 16) {
+         stbi__uint16 *p16 = (stbi__uint16 *) p;
+         stbi__png_swap16_row(p16, x*out_n, simd);
+         if (st->has_trans) stbi__png_key_row16(p16, x, out_n, st->tc16, simd);
+         if (st->conv16) {
+            if (!stbi__convert_rows16((stbi__uint16 *) st->tmp16, p16, out_n, req_comp, x, 1)) return 0;
+            stbi__png_reduce16_row(dest, (stbi__uint16 *) st->tmp16, x*req_comp, simd);
+            fin = dest;
+         } else {
+            stbi__png_reduce16_row(p, p16, x*out_n, simd);
+            fin = p;
+         }
+      } else {
+         if (st->has_trans) stbi__png_key_row(p, x, out_n, st->tc, simd);
+         if (st->de_iphone) stbi__de_iphone_row(p, x, out_n);
+         fin = p;
+         if (st->pal_out_n) {
+            fin = (req_n == final_n) ? dest : st->pal;
+            stbi__png_expand_palette_row(fin, p, x, st->palette, st->pal_out_n);
+         }
+      }
+      if (fin != dest) {
+         if (req_n != final_n) {
+            if (!stbi__convert_rows(dest, fin, final_n, req_n, x, 1)) return 0;
+         } else {
+            memcpy(dest, fin, st->band.stride);
+         }
+      }
+
+      ++st->j;
+      if (stbi__band_full(&st->band, st->j))
+         if (!stbi__band_flush(&st->band, st->rows, st->j)) return 0;
+
+      t = st->cur; st->cur = st->prior; st->prior = t;
+   }
+   return 1;
+}
+
+static int stbi__png_stream_rows(stbi__png *z, stbi__uint32 first_len, int req_comp, int color, stbi_uc *palette, int pal_out_n, int has_trans, stbi_uc tc[3], stbi__uint16 tc16[3], int is_iphone, int de_iphone)
+{
+   stbi__context *s = z->s;
+   stbi__png_rows *st;
+   stbi__png_idat idat;
+   int ok = 0;
+
+   st = (stbi__png_rows *) stbi__malloc(sizeof(*st));
+   if (!st) return stbi__err("outofmem", "Out of memory");
+   if (stbi__png_rows_begin(st, z, req_comp, color, palette, pal_out_n, has_trans, tc, tc16, is_iphone, de_iphone,
+                            s->io.read ? STBI__PNG_IDAT_PIECE : 0)) {
+      idat.s = s;
+      idat.remain = first_len;
+      idat.buf = st->staging;
+      idat.eof = 0;
+      idat.next.type = 0;
+      st->a.zrefill = stbi__png_idat_refill;
+      st->a.zrefill_user = &idat;
+      ok = stbi__png_rows_run(st);
+      if (ok) s->rows->streamed = 1;
+      STBI_FREE(st->mem);
+   }
+   STBI_FREE(st);
+   return ok;
+}
+
+// a stbi_load of a PNG too big to inflate whole: the row decoder fills in
+// the image instead, which needs a 64-bit size_t to be worth it
+typedef struct
+{
+   stbi__rows rows;
+   int x, y, comp;
+   stbi_uc *out;
+   size_t stride;
+} stbi__png_big;
+
+static int stbi__png_big_rows(void *user, stbi_uc *rows, int y, int num_rows)
+{
+   stbi__png_big *b = (stbi__png_big *) user;
+   memcpy(b->out + (size_t) y * b->stride, rows, (size_t) num_rows * b->stride);
+   return 1;
+}
+
+// whether the IDATs of a whole-image load should still be collected into one
+// buffer: the parallel inflater needs the stream in one piece, which is worth
+// the copy if there's enough of it. a memory source's chunks can be looked
+// over first; a single IDAT is already in one piece
+static int stbi__png_gather_idat(stbi__context *s, stbi__uint32 first_len)
+{
+#ifdef STBI_PARALLEL_INFLATE
+   size_t at, left;
+   stbi__uint32 total = first_len;
+   int count = 1;
+   if (s->io.read) // can't look ahead, so only if there are threads to use
+      return stbi__zpar_count(0xffffffff) >= 2;
+   left = (size_t) (s->img_buffer_end - s->img_buffer);
+   at = (size_t) first_len + 4;
+   while (first_len <= left && at + 8 <= left) {
+      stbi_uc *c = s->img_buffer + at;
+      stbi__uint32 len = ((stbi__uint32) c[0] << 24) + (c[1] << 16) + (c[2] << 8) + c[3];
+      if (STBI__PNG_TYPE(c[4],c[5],c[6],c[7]) != STBI__PNG_TYPE('I','D','A','T')) break;
+      if (len > left || total + len < total) break;
+      total += len;
+      at += (size_t) len + 12;
+      ++count;
+   }
+   return count > 1 && stbi__zpar_count(total) >= 2;
+#else
+   STBI_NOTUSED(s);
+   STBI_NOTUSED(first_len);
+   return 0;
+#endif
+}
+
+// inflates the IDATs of a whole-image load as they're read, memory sources'
+// payloads in place, instead of collecting them first. leaves the header of
+// the chunk after them, already read, in *next
+static int stbi__png_inflate_idat(stbi__png *z, stbi__uint32 first_len, stbi__uint32 *raw_len, int parse_header, stbi__pngchunk *next)
+{
+   stbi__context *s = z->s;
+   stbi__png_idat idat;
+   stbi__zbuf a;
+   char *p;
+   int ok;
+
+   idat.s = s;
+   idat.remain = first_len;
+   idat.buf = NULL;
+   idat.eof = 0;
+   idat.next.type = 0;
+   a.zbuffer = a.zbuffer_end = NULL;
+#ifdef STBI_PARALLEL_INFLATE
+   // a lone IDAT is the whole stream, so the parallel inflater can take it
+   if (!s->io.read && first_len <= (stbi__uint32) (s->img_buffer_end - s->img_buffer) && first_len < 0x80000000u
+       && stbi__zpar_count(first_len) >= 2) {
+      int outlen;
+      z->expanded = (stbi_uc *) stbi__zpar_inflate((char *) s->img_buffer, (int) first_len, (int) *raw_len, &outlen, parse_header);
+      if (z->expanded) {
+         *raw_len = (stbi__uint32) outlen;
+         s->img_buffer += first_len;
+         idat.remain = 0;
+      }
+   }
+   if (!z->expanded)
+#endif
+   {
+      if (s->io.read) {
+         idat.buf = (stbi_uc *) stbi__malloc(STBI__PNG_IDAT_PIECE);
+         if (!idat.buf) return stbi__err("outofmem", "Out of memory");
+      }
+      p = (char *) stbi__malloc(*raw_len);
+      if (!p) {
+         STBI_FREE(idat.buf);
+         return stbi__err("outofmem", "Out of memory");
+      }
+      a.zrefill = stbi__png_idat_refill;
+      a.zrefill_user = &idat;
+      ok = stbi__do_zlib(&a, p, (int) *raw_len, 1, parse_header);
+      if (!ok) {
+         STBI_FREE(a.zout_start);
+         STBI_FREE(idat.buf);
+         return 0; // zlib should set error
+      }
+      z->expanded = (stbi_uc *) a.zout_start;
+      *raw_len = (stbi__uint32) (a.zout - a.zout_start);
+   }
+
+   // skip whatever the inflater didn't need, up to the chunk after the IDATs
+   do {
+      stbi__skip(s, (int) idat.remain);
+      idat.remain = 0;
+   } while (stbi__png_idat_refill(&idat, &a.zbuffer, &a.zbuffer_end));
+   STBI_FREE(idat.buf);
+   if (idat.next.type == 0) return stbi__err("outofdata","Corrupt PNG");
+   *next = idat.next;
+   return 1;
+}
+
+// whether an image over the 1GB that's inflated whole can be loaded anyway.
+// stbi_load_rows always can unless it's interlaced, and so can an 8-bit
+// load into a buffer bigger than an int can count
+static int stbi__png_big_ok(stbi__png *z, int scan, int interlace)
+{
+   z->big = 1;
+   if (scan != STBI__SCAN_load) return 1;
+   if (interlace) return 0;
+   if (z->s->rows) return 1;
+   return sizeof(size_t) >= 8 && (z->depth != 16 || z->bpc == 8);
+}
+
 static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
 {
    stbi_uc palette[1024], pal_img_n=0;
    stbi_uc has_trans=0, tc[3]={0};
    stbi__uint16 tc16[3];
-   stbi__uint32 ioff=0, idata_limit=0, i, pal_len=0;
-   int first=1,k,interlace=0, color=0, is_iphone=0;
+   stbi__uint32 ioff=0, idata_limit=0, i, pal_len=0, raw_len=0;
+   int first=1,k,interlace=0, color=0, is_iphone=0, pal_out_n, have_next=0;
+   stbi__pngchunk next;
    stbi__context *s = z->s;
 
    z->expanded = NULL;
    z->idata = NULL;
    z->out = NULL;
+   z->big = 0;
 
    if (!stbi__check_png_header(s)) return 0;
 
    if (scan == STBI__SCAN_type) return 1;
 
    for (;;) {
-      stbi__pngchunk c = stbi__get_chunk_header(s);
+      stbi__pngchunk c = have_next ? next : stbi__get_chunk_header(s);
+      have_next = 0;
       switch (c.type) {
          case STBI__PNG_TYPE('C','g','B','I'):
             is_iphone = 1;
@@ -4980,13 +7245,13 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
             if (!s->img_x || !s->img_y) return stbi__err("0-pixel image","Corrupt PNG");
             if (!pal_img_n) {
                s->img_n = (color & 2 ? 3 : 1) + (color & 4 ? 1 : 0);
-               if ((1 << 30) / s->img_x / s->img_n < s->img_y) return stbi__err("too large", "Image too large to decode");
+               if ((1 << 30) / s->img_x / s->img_n < s->img_y && !stbi__png_big_ok(z, scan, interlace)) return stbi__err("too large", "Image too large to decode");
                if (scan == STBI__SCAN_header) return 1;
             } else {
                // if paletted, then pal_n is our final components, and
                // img_n is # components to decompress/filter.
                s->img_n = 1;
-               if ((1 << 30) / s->img_x / 4 < s->img_y) return stbi__err("too large","Corrupt PNG");
+               if ((1 << 30) / s->img_x / 4 < s->img_y && !stbi__png_big_ok(z, scan, interlace)) return stbi__err("too large","Corrupt PNG");
                // if SCAN_header, have to scan to see if we have a tRNS
             }
             break;
@@ -5026,13 +7291,74 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
                   for (k = 0; k < s->img_n; ++k) tc[k] = (stbi_uc)(stbi__get16be(s) & 255) * stbi__depth_scale_table[z->depth]; // non 8-bit images will be larger
                }
             }
-            break;
-         }
-
-         case STBI__PNG_TYPE('I','D','A','T'): {
-            if (first) return stbi__err("first not IHDR", "Corrupt PNG");
-            if (pal_img_n && !pal_len) return stbi__err("no PLTE","Corrupt PNG");
-            if (scan == STBI__SCAN_header) { s->img_n = pal_img_n; return 1; }
+            break;
+         }
+
+         case STBI__PNG_TYPE('I','D','A','T'): {
+            if (first) return stbi__err("first not IHDR", "Corrupt PNG");
+            if (pal_img_n && !pal_len) return stbi__err("no PLTE","Corrupt PNG");
+            if (scan == STBI__SCAN_header) { s->img_n = pal_img_n; return 1; }
+            if ((s->rows || z->big) && !interlace && !z->idata) {
+               // stbi_load_rows: decode as the IDATs arrive. interlaced
+               // images need all the passes, so they take the path below
+               stbi__png_big big;
+               int ok;
+               if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
+                  s->img_out_n = s->img_n+1;
+               else
+                  s->img_out_n = s->img_n;
+               pal_out_n = 0;
+               if (pal_img_n)
+                  pal_out_n = (req_comp >= 3 ? req_comp : pal_img_n);
+               if (!s->rows) {
+                  int n = req_comp ? req_comp : pal_out_n ? pal_out_n : s->img_out_n;
+                  big.out = (stbi_uc *) stbi__malloc_mad3_wide(n, s->img_x, s->img_y, 0);
+                  if (!big.out) return stbi__err("outofmem", "Out of memory");
+                  z->out = big.out;
+                  big.stride = (size_t) n * s->img_x;
+                  big.rows.callback = stbi__png_big_rows;
+                  big.rows.user = &big;
+                  big.rows.x = &big.x;
+                  big.rows.y = &big.y;
+                  big.rows.comp = &big.comp;
+                  big.rows.resume = NULL;
+                  s->rows = &big.rows;
+               }
+               *s->rows->x = s->img_x;
+               *s->rows->y = s->img_y;
+               if (s->rows->comp) *s->rows->comp = pal_img_n ? pal_img_n : s->img_n + has_trans;
+               if (s->rows->resume) // the push decoder feeds the IDATs itself
+                  return stbi__png_rows_begin((stbi__png_rows *) s->rows->resume, z, req_comp, color, palette, pal_out_n, has_trans, tc, tc16, is_iphone,
+                                              is_iphone && stbi__de_iphone_flag && s->img_out_n > 2 && z->depth == 8, 0);
+               ok = stbi__png_stream_rows(z, c.length, req_comp, color, palette, pal_out_n, has_trans, tc, tc16, is_iphone,
+                                          is_iphone && stbi__de_iphone_flag && s->img_out_n > 2 && z->depth == 8);
+               if (s->rows == &big.rows) {
+                  s->rows = NULL;
+                  s->img_n = big.comp;
+                  s->img_out_n = req_comp ? req_comp : big.comp;
+               }
+               return ok;
+            }
+            if (s->rows && s->rows->resume) {
+               // can't be decoded piecewise, so tell the push decoder to
+               // collect the whole file instead
+               s->rows->resume = NULL;
+               return 0;
+            }
+            if (z->expanded) { // stray IDATs after the ones already inflated
+               stbi__skip(s, c.length);
+               break;
+            }
+            if (!z->idata) {
+               // initial guess for decoded data size to avoid unnecessary reallocs
+               stbi__uint32 bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
+               raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
+               if (!stbi__png_gather_idat(s, c.length)) {
+                  if (!stbi__png_inflate_idat(z, c.length, &raw_len, !is_iphone, &next)) return 0;
+                  have_next = 1;
+                  continue; // the CRCs went with the IDATs
+               }
+            }
             if ((int)(ioff + c.length) < (int)ioff) return 0;
             if (ioff + c.length > idata_limit) {
                stbi__uint32 idata_limit_old = idata_limit;
@@ -5050,37 +7376,28 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
          }
 
          case STBI__PNG_TYPE('I','E','N','D'): {
-            stbi__uint32 raw_len, bpl;
             if (first) return stbi__err("first not IHDR", "Corrupt PNG");
             if (scan != STBI__SCAN_load) return 1;
-            if (z->idata == NULL) return stbi__err("no IDAT","Corrupt PNG");
-            // initial guess for decoded data size to avoid unnecessary reallocs
-            bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
-            raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
-            z->expanded = (stbi_uc *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
-            if (z->expanded == NULL) return 0; // zlib should set error
-            STBI_FREE(z->idata); z->idata = NULL;
+            if (z->idata) {
+               z->expanded = (stbi_uc *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
+               if (z->expanded == NULL) return 0; // zlib should set error
+               STBI_FREE(z->idata); z->idata = NULL;
+            }
+            if (z->expanded == NULL) return stbi__err("no IDAT","Corrupt PNG");
             if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
                s->img_out_n = s->img_n+1;
             else
                s->img_out_n = s->img_n;
             if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, color, interlace)) return 0;
-            if (has_trans) {
-               if (z->depth == 16) {
-                  if (!stbi__compute_transparency16(z, tc16, s->img_out_n)) return 0;
-               } else {
-                  if (!stbi__compute_transparency(z, tc, s->img_out_n)) return 0;
-               }
-            }
-            if (is_iphone && stbi__de_iphone_flag && s->img_out_n > 2)
-               stbi__de_iphone(z);
+            pal_out_n = 0;
+            if (pal_img_n) // pal_img_n == 3 or 4
+               pal_out_n = (req_comp >= 3 ? req_comp : pal_img_n);
+            if (!stbi__png_finish_image(z, palette, pal_out_n, has_trans, tc, tc16,
+                                        is_iphone && stbi__de_iphone_flag && s->img_out_n > 2 && z->depth == 8))
+               return 0;
             if (pal_img_n) {
-               // pal_img_n == 3 or 4
                s->img_n = pal_img_n; // record the actual colors we had
-               s->img_out_n = pal_img_n;
-               if (req_comp >= 3) s->img_out_n = req_comp;
-               if (!stbi__expand_png_palette(z, palette, pal_len, s->img_out_n))
-                  return 0;
+               s->img_out_n = pal_out_n;
             } else if (has_trans) {
                // non-paletted image with tRNS -> source image has (constant) alpha
                ++s->img_n;
@@ -5118,7 +7435,11 @@ static void *stbi__do_png(stbi__png *p, int *x, int *y, int *n, int req_comp, st
    void *result=NULL;
    if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
    if (stbi__parse_png_file(p, STBI__SCAN_load, req_comp)) {
-      if (p->depth <= 8)
+      if (p->s->rows && p->s->rows->streamed)
+         return NULL; // the rows went to the caller's callback
+      if (p->big) // the row decoder did the conversion and any flip too
+         ri->vertically_flipped = stbi__vertically_flip_on_load;
+      if (p->depth <= 8 || p->bpc == 8 || p->big) // 16-bit was already reduced if the caller wants 8
          ri->bits_per_channel = 8;
       else if (p->depth == 16)
          ri->bits_per_channel = 16;
@@ -5145,10 +7466,13 @@ static void *stbi__do_png(stbi__png *p, int *x, int *y, int *n, int req_comp, st
    return result;
 }
 
-static void *stbi__png_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
+static void *stbi__png_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    stbi__png p;
    p.s = s;
+   // RGB->Y conversion is more precise on 16-bit samples, so in that case
+   // leave the 16->8 reduction to stbi__load_and_postprocess_8bit
+   p.bpc = (req_comp == 1 || req_comp == 2) ? 16 : bpc;
    return stbi__do_png(&p, x,y,comp,req_comp, ri);
 }
 
@@ -5193,6 +7517,506 @@ static int stbi__png_is16(stbi__context *s)
 }
 #endif
 
+// push decoding
+//
+// the caller hands over the file in whatever pieces it has. a non-interlaced
+// PNG or single-scan baseline JPEG is decoded as the pieces arrive, with no
+// threads: the state is kept between calls and each call decodes as far as
+// the data allows. anything else is collected and decoded by stbi_push_end.
+//
+// PNG: the IDAT payloads are gathered into 'zdata' and the inflater is only
+// resumed while more than STBI__PUSH_MARGIN bytes of it are unread. when it
+// gets that close to the end, it is given the rest and stopped after the
+// block header or symbol it is on, which can't need more than the margin.
+//
+// JPEG: the entropy-coded data is decoded a row of MCUs at a time. if a row
+// runs out of data partway, the decoder is put back to the start of the row
+// to try again once more has arrived. output rows lag a row of MCUs behind,
+// since the chroma upsamplers look at the component row after.
+
+#define STBI__PUSH_MARGIN  4096
+
+enum
+{
+   STBI__PUSH_unknown,
+   STBI__PUSH_png,
+   STBI__PUSH_jpeg,
+   STBI__PUSH_whole
+};
+
+struct stbi__push
+{
+   int state, format, req_comp, complete;
+   int x, y, comp, rows_done;
+   stbi_rows_callback *callback;
+   void *callback_user;
+   stbi__rows rows;
+   stbi_uc *buf;       // input that isn't used up yet
+   size_t len, cap;
+
+   #ifndef STBI_NO_PNG
+   stbi__png_rows *png;
+   size_t chunk_pos;   // next unread byte of 'buf'
+   stbi__uint32 idat_remain;
+   int idat_done;
+   stbi_uc *zdata;     // IDAT payloads, from the inflater's position on
+   size_t zlen, zcap;
+   size_t zpos;        // how much of zdata the inflater has been given
+   #endif
+
+   #ifndef STBI_NO_JPEG
+   stbi__jpeg *jpeg;
+   stbi__context ctx;  // over 'buf'
+   stbi__jpeg_convert conv;
+   stbi__band band;
+   stbi_uc *band_mem, *scratch;
+   int unit, units, unit_h, row;
+   size_t retry;       // input needed before trying again after running dry
+   #endif
+};
+
+static int stbi__push_rows(void *user, stbi_uc *rows, int y, int num_rows)
+{
+   stbi_push *p = (stbi_push *) user;
+   p->rows_done += num_rows;
+   return p->callback(p->callback_user, rows, y, num_rows);
+}
+
+// appends len bytes to the buffer at *data, growing it as needed
+static int stbi__push_append(stbi_uc **data, size_t *len, size_t *cap, stbi_uc const *add, size_t n)
+{
+   if (*len + n > *cap) {
+      size_t c = *cap ? *cap : 65536;
+      stbi_uc *d;
+      while (c < *len + n) c *= 2;
+      d = (stbi_uc *) STBI_REALLOC_SIZED(*data, *cap, c);
+      if (!d) return stbi__err("outofmem", "Out of memory");
+      *data = d;
+      *cap = c;
+   }
+   memcpy(*data + *len, add, n);
+   *len += n;
+   return 1;
+}
+
+// drops the first n bytes of the input buffer
+static void stbi__push_consume(stbi_push *p, size_t n)
+{
+   if (!n) return;
+   memmove(p->buf, p->buf + n, p->len - n);
+   p->len -= n;
+}
+
+#ifndef STBI_NO_PNG
+static int stbi__push_refill(void *user, stbi_uc **start, stbi_uc **end)
+{
+   stbi_push *p = (stbi_push *) user;
+   size_t safe = p->zlen;
+   if (!p->idat_done)
+      safe = p->zlen > STBI__PUSH_MARGIN ? p->zlen - STBI__PUSH_MARGIN : 0;
+   *start = p->zdata + p->zpos;
+   if (p->zpos < safe) {
+      p->zpos = safe;
+   } else {
+      if (p->zpos >= p->zlen) return 0;
+      // close to the end of what has arrived, so hand out the rest and stop
+      // the inflater before it starts on anything new
+      p->zpos = p->zlen;
+      p->png->a.zout_end = p->png->a.zout_start;
+   }
+   *end = p->zdata + p->zpos;
+   return 1;
+}
+
+// parses the chunks up to the first IDAT, once they have all arrived
+static int stbi__push_png_begin(stbi_push *p)
+{
+   stbi__context s;
+   stbi__png z;
+   while (p->chunk_pos + 8 <= p->len) {
+      stbi_uc *c = p->buf + p->chunk_pos;
+      stbi__uint32 length = ((stbi__uint32) c[0] << 24) + (c[1] << 16) + (c[2] << 8) + c[3];
+      if (STBI__PNG_TYPE(c[4],c[5],c[6],c[7]) == STBI__PNG_TYPE('I','D','A','T')) {
+         p->idat_remain = length;
+         break;
+      }
+      if (length > (1u << 30)) {
+         // nonsense; leave the complaint to the real loader
+         p->format = STBI__PUSH_whole;
+         return 1;
+      }
+      p->chunk_pos += 12 + length;
+   }
+   if (p->chunk_pos + 8 > p->len) {
+      if (p->complete) p->format = STBI__PUSH_whole;
+      return 1;
+   }
+
+   p->png = (stbi__png_rows *) stbi__malloc(sizeof(*p->png));
+   if (!p->png) return stbi__err("outofmem", "Out of memory");
+   p->png->mem = NULL;
+   stbi__start_mem(&s, p->buf, (int) (p->chunk_pos + 8));
+   s.rows = &p->rows;
+   p->rows.resume = p->png;
+   z.s = &s;
+   z.bpc = (p->req_comp == 1 || p->req_comp == 2) ? 16 : 8;
+   if (!stbi__parse_png_file(&z, STBI__SCAN_load, p->req_comp)) {
+      STBI_FREE(p->png->mem);
+      STBI_FREE(p->png);
+      p->png = NULL;
+      if (p->rows.resume) return 0;
+      p->format = STBI__PUSH_whole; // interlaced
+      return 1;
+   }
+   p->png->a.zrefill = stbi__push_refill;
+   p->png->a.zrefill_user = p;
+   p->chunk_pos += 8;
+   p->state = STBI_PUSH_decoding;
+   return 1;
+}
+
+static int stbi__push_png(stbi_push *p)
+{
+   stbi__zbuf *a;
+   int r;
+   if (p->state == STBI_PUSH_waiting) {
+      if (!stbi__push_png_begin(p)) return 0;
+      if (p->state == STBI_PUSH_waiting) return 1;
+   }
+   a = &p->png->a;
+
+   // move the IDAT payloads over to zdata, and drop whatever the inflater
+   // is past
+   while (!p->idat_done) {
+      if (p->idat_remain) {
+         size_t n = p->len - p->chunk_pos;
+         if (n > p->idat_remain) n = p->idat_remain;
+         if (!n) break;
+         if (!stbi__push_append(&p->zdata, &p->zlen, &p->zcap, p->buf + p->chunk_pos, n)) return 0;
+         p->chunk_pos += n;
+         p->idat_remain -= (stbi__uint32) n;
+      } else {
+         // CRC, then the next chunk's header
+         stbi_uc *c;
+         if (p->len - p->chunk_pos < 12) break;
+         c = p->buf + p->chunk_pos + 4;
+         if (STBI__PNG_TYPE(c[4],c[5],c[6],c[7]) == STBI__PNG_TYPE('I','D','A','T'))
+            p->idat_remain = ((stbi__uint32) c[0] << 24) + (c[1] << 16) + (c[2] << 8) + c[3];
+         else
+            p->idat_done = 1;
+         p->chunk_pos += 12;
+      }
+   }
+   stbi__push_consume(p, p->chunk_pos);
+   p->chunk_pos = 0;
+   if (p->complete) p->idat_done = 1;
+
+   if (!p->idat_done && p->zlen - p->zpos <= STBI__PUSH_MARGIN) return 1;
+   // zdata may have moved, but the inflater stopped at its start last time
+   a->zbuffer = p->zdata;
+   a->zbuffer_end = p->zdata + p->zpos;
+   r = stbi__png_rows_run(p->png);
+   if (!r) return 0;
+   if (r == 2) {
+      size_t used = a->zbuffer - p->zdata;
+      memmove(p->zdata, a->zbuffer, p->zlen - used);
+      p->zlen -= used;
+      p->zpos -= used;
+      // hand over whatever rows are done rather than waiting for a full band
+      return stbi__band_flush(&p->png->band, &p->rows, p->png->j);
+   }
+   p->state = STBI_PUSH_done;
+   return 1;
+}
+#endif
+
+#ifndef STBI_NO_JPEG
+// parses the headers up to the first scan, once they have all arrived
+static int stbi__push_jpeg_begin(stbi_push *p)
+{
+   stbi__jpeg *z = p->jpeg;
+   stbi__context *s = &p->ctx;
+   int m, ok;
+   size_t stride, band_rows;
+
+   stbi__start_mem(s, p->buf, (int) p->len);
+   z->s = s;
+   stbi__setup_jpeg(z);
+   z->roi = z->roi_flip = 0;
+   z->coeff_only = 0;
+   z->ring_mcus = STBI__JPEG_RING_MCUS; // rows are converted here instead
+   z->band_out = NULL;
+   s->img_n = 0;
+   for (m = 0; m < 4; m++) {
+      z->img_comp[m].raw_data = NULL;
+      z->img_comp[m].raw_coeff = NULL;
+      z->img_comp[m].linebuf = NULL;
+   }
+   z->restart_interval = 0;
+   ok = stbi__decode_jpeg_header(z, STBI__SCAN_load);
+   if (ok) {
+      m = stbi__get_marker(z);
+      while (ok && !stbi__SOS(m)) {
+         ok = stbi__process_marker(z, m);
+         m = stbi__get_marker(z);
+      }
+   }
+   if (ok) ok = stbi__process_scan_header(z);
+   // reads past the end give zeros, which can pass for the last few header
+   // bytes, so anything that got that far waits for more too
+   if (!ok || (s->img_buffer >= s->img_buffer_end && !p->complete)) {
+      stbi__cleanup_jpeg(z);
+      if (s->img_buffer >= s->img_buffer_end && !p->complete) {
+         p->retry = p->len * 2; // wait for the rest
+         return 1;
+      }
+      return 0;
+   }
+
+   p->x = s->img_x;
+   p->y = s->img_y;
+   p->comp = s->img_n >= 3 ? 3 : 1;
+   p->state = STBI_PUSH_decoding;
+   if (z->progressive || z->scan_n != s->img_n) {
+      // needs every scan before any row is done
+      stbi__cleanup_jpeg(z);
+      p->format = STBI__PUSH_whole;
+      return 1;
+   }
+
+   if (!stbi__jpeg_convert_begin(z, &p->conv, p->req_comp)) return 0;
+   stride = (size_t) p->conv.n * s->img_x;
+   band_rows = STBI__ROWS_BAND_BYTES / stride;
+   if (band_rows < 1) band_rows = 1;
+   // converters may write a byte past the row. going top down that lands
+   // on the next row, or the extra byte at the end, but bottom up it would
+   // land on a finished row
+   p->band_mem = (stbi_uc *) stbi__malloc(band_rows * stride + 1);
+   if (stbi__vertically_flip_on_load && (p->conv.n == 1 || p->conv.n == 3))
+      p->scratch = (stbi_uc *) stbi__malloc(stride + 1);
+   if (!p->band_mem || (stbi__vertically_flip_on_load && (p->conv.n == 1 || p->conv.n == 3) && !p->scratch))
+      return stbi__err("outofmem", "Out of memory");
+   stbi__band_begin(&p->band, p->band_mem, stride, s->img_y, (stbi__uint32) band_rows);
+
+   stbi__jpeg_reset(z);
+   p->retry = 0;
+   p->units = stbi__jpeg_unit_rows(z);
+   p->unit_h = stbi__jpeg_unit_height(z);
+   p->unit = p->row = 0;
+   return 1;
+}
+
+static int stbi__push_jpeg(stbi_push *p)
+{
+   stbi__jpeg *z = p->jpeg;
+   stbi__context *s = &p->ctx;
+   int k, r, ready;
+
+   // each try starts over, so don't try again until there's plenty more
+   if (p->len < p->retry && !p->complete) return 1;
+   if (p->state == STBI_PUSH_waiting) {
+      if (!stbi__push_jpeg_begin(p)) return 0;
+      if (p->state == STBI_PUSH_waiting || p->format != STBI__PUSH_jpeg) return 1;
+      // what's been parsed isn't needed any more
+      stbi__push_consume(p, s->img_buffer - p->buf);
+   }
+   // the buffer may have moved, but it starts where decoding left off
+   stbi__start_mem(s, p->buf, (int) p->len);
+
+   while (p->unit < p->units) {
+      stbi__uint32 code_buffer = z->code_buffer;
+      int code_bits = z->code_bits, nomore = z->nomore, todo = z->todo, dc_pred[4];
+      stbi_uc marker = z->marker;
+      stbi_uc *pos = s->img_buffer;
+      for (k=0; k < 4; ++k) dc_pred[k] = z->img_comp[k].dc_pred;
+
+      r = stbi__jpeg_decode_unit_row(z, p->unit);
+      if (s->img_buffer >= s->img_buffer_end && z->marker == STBI__MARKER_none && !p->complete) {
+         // ran out partway, so try the row again when there's more
+         z->code_buffer = code_buffer;
+         z->code_bits = code_bits;
+         z->nomore = nomore;
+         z->todo = todo;
+         z->marker = marker;
+         s->img_buffer = pos;
+         for (k=0; k < 4; ++k) z->img_comp[k].dc_pred = dc_pred[k];
+         stbi__push_consume(p, pos - p->buf);
+         p->retry = p->len * 2;
+         return stbi__band_flush(&p->band, &p->rows, p->row);
+      }
+      if (!r) return 0;
+      p->retry = 0;
+      // a scan that stops early leaves the rest of the image corrupt, as usual
+      p->unit = r == 2 ? p->units : p->unit + 1;
+
+      ready = p->unit == p->units ? p->y : (p->unit - 1) * p->unit_h;
+      if (ready > p->y) ready = p->y;
+      for (; p->row < ready; ++p->row) {
+         stbi_uc *dest = stbi__band_row(&p->band, p->row);
+         stbi__jpeg_convert_row(z, &p->conv, p->scratch ? p->scratch : dest, 0);
+         if (p->scratch) memcpy(dest, p->scratch, p->band.stride);
+         if (stbi__band_full(&p->band, p->row + 1))
+            if (!stbi__band_flush(&p->band, &p->rows, p->row + 1)) return 0;
+      }
+   }
+   stbi__cleanup_jpeg(z);
+   p->state = STBI_PUSH_done;
+   return 1;
+}
+#endif
+
+// decodes as far as the input allows
+static int stbi__push_step(stbi_push *p)
+{
+   if (p->format == STBI__PUSH_unknown) {
+      #ifndef STBI_NO_JPEG
+      if (p->len >= 2 && p->buf[0] == 0xff && p->buf[1] == 0xd8) {
+         p->jpeg = (stbi__jpeg *) stbi__malloc(sizeof(stbi__jpeg));
+         if (!p->jpeg) return stbi__err("outofmem", "Out of memory");
+         p->jpeg->s = &p->ctx;
+         p->ctx.img_n = 0;
+         p->format = STBI__PUSH_jpeg;
+      }
+      #endif
+      #ifndef STBI_NO_PNG
+      if (p->len >= 8 && p->format == STBI__PUSH_unknown) {
+         static const stbi_uc png_sig[8] = { 137,80,78,71,13,10,26,10 };
+         if (memcmp(p->buf, png_sig, 8) == 0) {
+            p->format = STBI__PUSH_png;
+            p->chunk_pos = 8;
+         }
+      }
+      #endif
+      if (p->format == STBI__PUSH_unknown && (p->len >= 8 || p->complete))
+         p->format = STBI__PUSH_whole;
+   }
+
+   // either may find it can't decode incrementally, which carries on below
+   #ifndef STBI_NO_PNG
+   if (p->format == STBI__PUSH_png) {
+      if (!stbi__push_png(p)) return 0;
+      if (p->format == STBI__PUSH_png) return 1;
+   }
+   #endif
+   #ifndef STBI_NO_JPEG
+   if (p->format == STBI__PUSH_jpeg) {
+      if (!stbi__push_jpeg(p)) return 0;
+      if (p->format == STBI__PUSH_jpeg) return 1;
+   }
+   #endif
+   if (p->format == STBI__PUSH_whole) {
+      stbi__context s;
+      if (p->complete) {
+         p->state = STBI_PUSH_decoding;
+         stbi__start_mem(&s, p->buf, (int) p->len);
+         if (!stbi__load_rows_main(&s, &p->x, &p->y, &p->comp, p->req_comp, stbi__push_rows, p)) return 0;
+         p->state = STBI_PUSH_done;
+      } else if (p->state == STBI_PUSH_waiting) {
+         // nothing will be decoded before the end, but the size may be known
+         if (stbi_info_from_memory(p->buf, (int) p->len, &p->x, &p->y, &p->comp))
+            p->state = STBI_PUSH_decoding;
+         else
+            p->x = p->y = p->comp = 0;
+      }
+   }
+   return 1;
+}
+
+static void stbi__push_release(stbi_push *p)
+{
+   STBI_FREE(p->buf);
+   p->buf = NULL;
+   p->len = p->cap = 0;
+   #ifndef STBI_NO_PNG
+   if (p->png) STBI_FREE(p->png->mem);
+   STBI_FREE(p->png);
+   STBI_FREE(p->zdata);
+   p->png = NULL;
+   p->zdata = NULL;
+   #endif
+   #ifndef STBI_NO_JPEG
+   if (p->jpeg) stbi__cleanup_jpeg(p->jpeg);
+   STBI_FREE(p->jpeg);
+   STBI_FREE(p->band_mem);
+   STBI_FREE(p->scratch);
+   p->jpeg = NULL;
+   p->band_mem = p->scratch = NULL;
+   #endif
+}
+
+static int stbi__push_fail(stbi_push *p)
+{
+   p->state = STBI_PUSH_error;
+   stbi__push_release(p);
+   return 0;
+}
+
+STBIDEF stbi_push *stbi_push_begin(int desired_channels, stbi_rows_callback *callback, void *callback_user)
+{
+   stbi_push *p;
+   if (desired_channels < 0 || desired_channels > 4) {
+      stbi__err("bad req_comp", "Internal error");
+      return NULL;
+   }
+   p = (stbi_push *) stbi__malloc(sizeof(*p));
+   if (!p) {
+      stbi__err("outofmem", "Out of memory");
+      return NULL;
+   }
+   memset(p, 0, sizeof(*p));
+   p->state = STBI_PUSH_waiting;
+   p->format = STBI__PUSH_unknown;
+   p->req_comp = desired_channels;
+   p->callback = callback;
+   p->callback_user = callback_user;
+   p->rows.callback = stbi__push_rows;
+   p->rows.user = p;
+   p->rows.x = &p->x;
+   p->rows.y = &p->y;
+   p->rows.comp = &p->comp;
+   return p;
+}
+
+STBIDEF int stbi_push_feed(stbi_push *p, stbi_uc const *data, int len)
+{
+   if (p->state == STBI_PUSH_error) return 0;
+   if (p->state == STBI_PUSH_done) return 1; // whatever follows the image
+   if (len < 0) return stbi__push_fail(p);
+   if (!stbi__push_append(&p->buf, &p->len, &p->cap, data, len)) return stbi__push_fail(p);
+   return stbi__push_step(p) ? 1 : stbi__push_fail(p);
+}
+
+STBIDEF int stbi_push_end(stbi_push *p)
+{
+   if (p->state == STBI_PUSH_error) return 0;
+   if (p->state != STBI_PUSH_done) {
+      p->complete = 1;
+      if (!stbi__push_step(p)) return stbi__push_fail(p);
+      if (p->state != STBI_PUSH_done) {
+         stbi__err("truncated", "Image data ended early");
+         return stbi__push_fail(p);
+      }
+   }
+   stbi__push_release(p);
+   return 1;
+}
+
+STBIDEF int stbi_push_poll(stbi_push *p, int *x, int *y, int *channels_in_file, int *rows_done)
+{
+   if (x) *x = p->x;
+   if (y) *y = p->y;
+   if (channels_in_file) *channels_in_file = p->comp;
+   if (rows_done) *rows_done = p->rows_done;
+   return p->state;
+}
+
+STBIDEF void stbi_push_free(stbi_push *p)
+{
+   if (!p) return;
+   stbi__push_release(p);
+   STBI_FREE(p);
+}
+
 // Microsoft/Windows BMP image
 
 #ifndef STBI_NO_BMP
@@ -5360,6 +8184,122 @@ static void *stbi__bmp_parse_header(stbi__context *s, stbi__bmp_data *info)
 }
 
 
+// returns a pointer to the next n bytes of the file; from memory this is the
+// source buffer itself, otherwise the bytes are read into 'scratch'
+static stbi_uc *stbi__bmp_row(stbi__context *s, stbi_uc *scratch, int n)
+{
+   if (!s->io.read && s->img_buffer_end - s->img_buffer >= n) {
+      stbi_uc *row = s->img_buffer;
+      s->img_buffer += n;
+      return row;
+   }
+   memset(scratch, 0, n); // short reads decode as zero, same as stbi__get8
+   stbi__getn(s, scratch, n);
+   return scratch;
+}
+
+// swizzle one row of BGR (src_n=3), BGRA or BGRX (src_n=4) pixels to RGB
+// or RGBA. returns the OR of the alpha values, or 255 if there's no alpha.
+static unsigned int stbi__bmp_swizzle_row(stbi_uc *out, stbi_uc const *src, int w, int src_n, int has_alpha, int target, int simd)
+{
+   unsigned int all_a = has_alpha ? 0 : 255;
+   int i = 0;
+   STBI_NOTUSED(simd);
+
+   if (src_n == 4 && target == 4) {
+      #ifdef STBI_SSE2
+      if (simd) {
+         __m128i mask_ag = _mm_set1_epi32((int) 0xff00ff00);
+         __m128i mask_rb = _mm_set1_epi32(0x00ff00ff);
+         __m128i opaque = _mm_set1_epi32(has_alpha ? 0 : (int) 0xff000000);
+         __m128i alpha = _mm_setzero_si128();
+         for (; i+4 <= w; i += 4) {
+            __m128i v  = _mm_loadu_si128((__m128i const *) (src + i*4));
+            __m128i ag = _mm_and_si128(v, mask_ag);
+            __m128i rb = _mm_and_si128(v, mask_rb);
+            rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+            v = _mm_or_si128(_mm_or_si128(ag, rb), opaque);
+            alpha = _mm_or_si128(alpha, v);
+            _mm_storeu_si128((__m128i *) (out + i*4), v);
+         }
+         if (has_alpha) {
+            alpha = _mm_or_si128(alpha, _mm_srli_si128(alpha, 8));
+            alpha = _mm_or_si128(alpha, _mm_srli_si128(alpha, 4));
+            all_a |= (unsigned int) _mm_cvtsi128_si32(alpha) >> 24;
+         }
+      }
+      #endif
+      #ifdef STBI_NEON
+      {
+         uint8x16_t alpha = vdupq_n_u8(0);
+         for (; i+16 <= w; i += 16) {
+            uint8x16x4_t v = vld4q_u8(src + i*4);
+            uint8x16_t t = v.val[0];
+            v.val[0] = v.val[2];
+            v.val[2] = t;
+            if (!has_alpha) v.val[3] = vdupq_n_u8(255);
+            alpha = vorrq_u8(alpha, v.val[3]);
+            vst4q_u8(out + i*4, v);
+         }
+         if (has_alpha) {
+            uint8x8_t a = vorr_u8(vget_low_u8(alpha), vget_high_u8(alpha));
+            a = vorr_u8(a, vext_u8(a, a, 4));
+            a = vorr_u8(a, vext_u8(a, a, 2));
+            a = vorr_u8(a, vext_u8(a, a, 1));
+            all_a |= vget_lane_u8(a, 0);
+         }
+      }
+      #endif
+   }
+
+   #ifdef STBI_NEON
+   // NEON's structured loads/stores handle the 3-byte layouts directly
+   if (src_n == 3 && target == 3) {
+      for (; i+16 <= w; i += 16) {
+         uint8x16x3_t v = vld3q_u8(src + i*3);
+         uint8x16_t t = v.val[0];
+         v.val[0] = v.val[2];
+         v.val[2] = t;
+         vst3q_u8(out + i*3, v);
+      }
+   } else if (src_n == 3 && target == 4) {
+      for (; i+16 <= w; i += 16) {
+         uint8x16x3_t v = vld3q_u8(src + i*3);
+         uint8x16x4_t o;
+         o.val[0] = v.val[2];
+         o.val[1] = v.val[1];
+         o.val[2] = v.val[0];
+         o.val[3] = vdupq_n_u8(255);
+         vst4q_u8(out + i*4, o);
+      }
+   } else if (src_n == 4 && target == 3) {
+      for (; i+16 <= w; i += 16) {
+         uint8x16x4_t v = vld4q_u8(src + i*4);
+         uint8x16x3_t o;
+         o.val[0] = v.val[2];
+         o.val[1] = v.val[1];
+         o.val[2] = v.val[0];
+         vst3q_u8(out + i*3, o);
+      }
+   }
+   #endif
+
+   // scalar tail (and the whole row for layouts without a SIMD kernel)
+   src += i*src_n;
+   out += i*target;
+   for (; i < w; ++i) {
+      stbi_uc a = (stbi_uc) (has_alpha ? src[3] : 255);
+      out[0] = src[2];
+      out[1] = src[1];
+      out[2] = src[0];
+      if (target == 4) out[3] = a;
+      all_a |= a;
+      src += src_n;
+      out += target;
+   }
+   return all_a;
+}
+
 static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
 {
    stbi_uc *out;
@@ -5368,14 +8308,19 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
    int psize=0,i,j,width;
    int flip_vertically, pad, target;
    stbi__bmp_data info;
-   STBI_NOTUSED(ri);
 
    info.all_a = 255;
    if (stbi__bmp_parse_header(s, &info) == NULL)
       return NULL; // error code already set
 
+   // rows are written straight to their final position, so a bottom-up
+   // file and the caller's flip request cancel out instead of costing a pass
    flip_vertically = ((int) s->img_y) > 0;
    s->img_y = abs((int) s->img_y);
+   if (stbi__vertically_flip_on_load) {
+      flip_vertically = !flip_vertically;
+      ri->vertically_flipped = 1;
+   }
 
    if (s->img_y > STBI_MAX_DIMENSIONS) return stbi__errpuc("too large","Very large image (corrupt?)");
    if (s->img_x > STBI_MAX_DIMENSIONS) return stbi__errpuc("too large","Very large image (corrupt?)");
@@ -5395,7 +8340,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
    }
    if (psize == 0) {
       STBI_ASSERT(info.offset == s->callback_already_read + (int) (s->img_buffer - s->img_buffer_original));
-      if (info.offset != s->callback_already_read + (s->img_buffer - s->buffer_start)) {
+      if (info.offset != s->callback_already_read + (s->img_buffer - s->img_buffer_original)) {
         return stbi__errpuc("bad offset", "Corrupt BMP");
       }
    }
@@ -5434,6 +8379,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
       if (info.bpp == 1) {
          for (j=0; j < (int) s->img_y; ++j) {
             int bit_offset = 7, v = stbi__get8(s);
+            z = (flip_vertically ? (int) s->img_y-1-j : j) * s->img_x * target;
             for (i=0; i < (int) s->img_x; ++i) {
                int color = (v>>bit_offset)&0x1;
                out[z++] = pal[color][0];
@@ -5450,6 +8396,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
          }
       } else {
          for (j=0; j < (int) s->img_y; ++j) {
+            z = (flip_vertically ? (int) s->img_y-1-j : j) * s->img_x * target;
             for (i=0; i < (int) s->img_x; i += 2) {
                int v=stbi__get8(s),v2=0;
                if (info.bpp == 4) {
@@ -5484,8 +8431,29 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
       } else if (info.bpp == 32) {
          if (mb == 0xff && mg == 0xff00 && mr == 0x00ff0000 && ma == 0xff000000)
             easy = 2;
+         else if (mb == 0xff && mg == 0xff00 && mr == 0x00ff0000 && ma == 0)
+            easy = 3; // BGRX, padding byte ignored
       }
-      if (!easy) {
+      if (easy) {
+         // standard layouts: whole rows are swizzled at once, directly from
+         // the source buffer when decoding from memory
+         int src_n = (easy == 1 ? 3 : 4);
+         int simd = 0;
+         stbi_uc *scratch;
+         #ifdef STBI_SSE2
+         simd = stbi__sse2_available();
+         #endif
+         scratch = (stbi_uc *) stbi__malloc_mad2(src_n, s->img_x, 0);
+         if (!scratch) { STBI_FREE(out); return stbi__errpuc("outofmem", "Out of memory"); }
+         for (j=0; j < (int) s->img_y; ++j) {
+            stbi_uc *row = stbi__bmp_row(s, scratch, src_n * s->img_x);
+            z = (flip_vertically ? (int) s->img_y-1-j : j) * s->img_x * target;
+            all_a |= stbi__bmp_swizzle_row(out + z, row, s->img_x, src_n, easy == 2, target, simd);
+            stbi__skip(s, pad);
+         }
+         STBI_FREE(scratch);
+      } else {
+         int bpp = info.bpp;
          if (!mr || !mg || !mb) { STBI_FREE(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
          // right shift amt to put high bit in position #7
          rshift = stbi__high_bit(mr)-7; rcount = stbi__bitcount(mr);
@@ -5493,21 +8461,8 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
          bshift = stbi__high_bit(mb)-7; bcount = stbi__bitcount(mb);
          ashift = stbi__high_bit(ma)-7; acount = stbi__bitcount(ma);
          if (rcount > 8 || gcount > 8 || bcount > 8 || acount > 8) { STBI_FREE(out); return stbi__errpuc("bad masks", "Corrupt BMP"); }
-      }
-      for (j=0; j < (int) s->img_y; ++j) {
-         if (easy) {
-            for (i=0; i < (int) s->img_x; ++i) {
-               unsigned char a;
-               out[z+2] = stbi__get8(s);
-               out[z+1] = stbi__get8(s);
-               out[z+0] = stbi__get8(s);
-               z += 3;
-               a = (easy == 2 ? stbi__get8(s) : 255);
-               all_a |= a;
-               if (target == 4) out[z++] = a;
-            }
-         } else {
-            int bpp = info.bpp;
+         for (j=0; j < (int) s->img_y; ++j) {
+            z = (flip_vertically ? (int) s->img_y-1-j : j) * s->img_x * target;
             for (i=0; i < (int) s->img_x; ++i) {
                stbi__uint32 v = (bpp == 16 ? (stbi__uint32) stbi__get16le(s) : stbi__get32le(s));
                unsigned int a;
@@ -5518,8 +8473,8 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
                all_a |= a;
                if (target == 4) out[z++] = STBI__BYTECAST(a);
             }
+            stbi__skip(s, pad);
          }
-         stbi__skip(s, pad);
       }
    }
 
@@ -5528,17 +8483,6 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
       for (i=4*s->img_x*s->img_y-1; i >= 0; i -= 4)
          out[i] = 255;
 
-   if (flip_vertically) {
-      stbi_uc t;
-      for (j=0; j < (int) s->img_y>>1; ++j) {
-         stbi_uc *p1 = out +      j     *s->img_x*target;
-         stbi_uc *p2 = out + (s->img_y-1-j)*s->img_x*target;
-         for (i=0; i < (int) s->img_x*target; ++i) {
-            t = p1[i]; p1[i] = p2[i]; p2[i] = t;
-         }
-      }
-   }
-
    if (req_comp && req_comp != target) {
       out = stbi__convert_format(out, target, req_comp, s->img_x, s->img_y);
       if (out == NULL) return out; // stbi__convert_format frees input on failure
@@ -7461,6 +10405,75 @@ static int stbi__is_16_main(stbi__context *s)
    return 0;
 }
 
+static int stbi__info_ex_main(stbi__context *s, int *x, int *y, int *comp, int *bits, int *is_hdr)
+{
+   stbi_uc m[24];
+   int i, dummy;
+   if (!bits) bits = &dummy;
+   if (!is_hdr) is_hdr = &dummy;
+   *bits = 8;
+   *is_hdr = 0;
+
+   // this is still in the first buffer, so rewinding works for callbacks too
+   for (i=0; i < 24; ++i)
+      m[i] = stbi__get8(s);
+   stbi__rewind(s);
+
+   #ifndef STBI_NO_PNG
+   if (m[0] == 0x89 && m[1] == 'P' && m[2] == 'N' && m[3] == 'G') {
+      stbi__png p;
+      p.s = s;
+      if (!stbi__png_info_raw(&p, x, y, comp)) return 0;
+      if (p.depth == 16) *bits = 16;
+      return 1;
+   }
+   #endif
+
+   #ifndef STBI_NO_JPEG
+   if (m[0] == 0xff && m[1] == 0xd8)
+      return stbi__jpeg_info(s, x, y, comp);
+   #endif
+
+   #ifndef STBI_NO_GIF
+   if (m[0] == 'G' && m[1] == 'I' && m[2] == 'F' && m[3] == '8')
+      return stbi__gif_info(s, x, y, comp);
+   #endif
+
+   #ifndef STBI_NO_BMP
+   if (m[0] == 'B' && m[1] == 'M')
+      return stbi__bmp_info(s, x, y, comp);
+   #endif
+
+   #ifndef STBI_NO_PSD
+   if (m[0] == '8' && m[1] == 'B' && m[2] == 'P' && m[3] == 'S') {
+      if (!stbi__psd_info(s, x, y, comp)) return 0;
+      if (m[22] == 0 && m[23] == 16) *bits = 16; // depth in the header
+      return 1;
+   }
+   #endif
+
+   #ifndef STBI_NO_PIC
+   if (m[0] == 0x53 && m[1] == 0x80 && m[2] == 0xf6 && m[3] == 0x34)
+      return stbi__pic_info(s, x, y, comp);
+   #endif
+
+   #ifndef STBI_NO_PNM
+   if (m[0] == 'P' && (m[1] == '5' || m[1] == '6'))
+      return stbi__pnm_info(s, x, y, comp);
+   #endif
+
+   #ifndef STBI_NO_HDR
+   if (m[0] == '#' && m[1] == '?') {
+      if (!stbi__hdr_info(s, x, y, comp)) return 0;
+      *bits = 32;
+      *is_hdr = 1;
+      return 1;
+   }
+   #endif
+
+   return stbi__info_main(s, x, y, comp);
+}
+
 #ifndef STBI_NO_STDIO
 STBIDEF int stbi_info(char const *filename, int *x, int *y, int *comp)
 {
@@ -7503,6 +10516,27 @@ STBIDEF int stbi_is_16_bit_from_file(FILE *f)
    fseek(f,pos,SEEK_SET);
    return r;
 }
+
+STBIDEF int stbi_info_ex(char const *filename, int *x, int *y, int *comp, int *bits_per_channel, int *is_hdr)
+{
+    FILE *f = stbi__fopen(filename, "rb");
+    int result;
+    if (!f) return stbi__err("can't fopen", "Unable to open file");
+    result = stbi_info_ex_from_file(f, x, y, comp, bits_per_channel, is_hdr);
+    fclose(f);
+    return result;
+}
+
+STBIDEF int stbi_info_ex_from_file(FILE *f, int *x, int *y, int *comp, int *bits_per_channel, int *is_hdr)
+{
+   int r;
+   stbi__context s;
+   long pos = ftell(f);
+   stbi__start_file(&s, f);
+   r = stbi__info_ex_main(&s,x,y,comp,bits_per_channel,is_hdr);
+   fseek(f,pos,SEEK_SET);
+   return r;
+}
 #endif // !STBI_NO_STDIO
 
 STBIDEF int stbi_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp)
@@ -7533,6 +10567,20 @@ STBIDEF int stbi_is_16_bit_from_callbacks(stbi_io_callbacks const *c, void *user
    return stbi__is_16_main(&s);
 }
 
+STBIDEF int stbi_info_ex_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int *bits_per_channel, int *is_hdr)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__info_ex_main(&s,x,y,comp,bits_per_channel,is_hdr);
+}
+
+STBIDEF int stbi_info_ex_from_callbacks(stbi_io_callbacks const *c, void *user, int *x, int *y, int *comp, int *bits_per_channel, int *is_hdr)
+{
+   stbi__context s;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *) c, user);
+   return stbi__info_ex_main(&s,x,y,comp,bits_per_channel,is_hdr);
+}
+
 #endif // STB_IMAGE_IMPLEMENTATION
 
 /*